@@ -0,0 +1,207 @@
+/* Decode benchmark harness. Runs every backend built into this binary over
+ * a corpus of images and prints one CSV record per backend/file pair that
+ * the backend accepts:
+ *
+ *   backend,file,open_ms,first_frame_ms,next_frames_per_sec,peak_rss_kb
+ *
+ * next_frames_per_sec is 0 for still images. peak_rss_kb is the process
+ * peak so far, so it only ever grows over a run. The output is meant to be
+ * stable enough to diff between builds when bumping backend libraries.
+ *
+ * Usage: bench_decode <directory|file>...
+ */
+
+#include "backend.h"
+#include "image.h"
+#include "source.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+extern const struct imv_backend imv_backend_freeimage;
+extern const struct imv_backend imv_backend_libpng;
+extern const struct imv_backend imv_backend_librsvg;
+extern const struct imv_backend imv_backend_libtiff;
+extern const struct imv_backend imv_backend_libjpeg;
+extern const struct imv_backend imv_backend_libnsgif;
+extern const struct imv_backend imv_backend_libavif;
+extern const struct imv_backend imv_backend_libwebp;
+
+static const struct imv_backend *backends[] = {
+#ifdef IMV_BACKEND_LIBTIFF
+  &imv_backend_libtiff,
+#endif
+#ifdef IMV_BACKEND_LIBPNG
+  &imv_backend_libpng,
+#endif
+#ifdef IMV_BACKEND_LIBJPEG
+  &imv_backend_libjpeg,
+#endif
+#ifdef IMV_BACKEND_LIBRSVG
+  &imv_backend_librsvg,
+#endif
+#ifdef IMV_BACKEND_LIBNSGIF
+  &imv_backend_libnsgif,
+#endif
+#ifdef IMV_BACKEND_LIBAVIF
+  &imv_backend_libavif,
+#endif
+#ifdef IMV_BACKEND_LIBWEBP
+  &imv_backend_libwebp,
+#endif
+#ifdef IMV_BACKEND_FREEIMAGE
+  &imv_backend_freeimage,
+#endif
+  NULL
+};
+
+/* how long to spend measuring animation throughput, at most */
+static const double next_frame_budget = 2.0;
+static const int next_frame_limit = 100;
+
+static double time_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec * 1e-6;
+}
+
+static long peak_rss_kb(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/* state shared with the source callback; loads here are synchronous, so no
+ * locking is needed */
+struct load_state {
+  struct imv_image *image;
+  int frametime;
+};
+
+static void load_callback(struct imv_source_message *msg)
+{
+  struct load_state *state = msg->user_data;
+  if (state->image) {
+    imv_image_free(state->image);
+  }
+  state->image = msg->image;
+  state->frametime = msg->frametime;
+}
+
+static void bench_file(const struct imv_backend *backend, const char *path)
+{
+  struct imv_source *source = NULL;
+
+  double start = time_ms();
+  enum backend_result result = backend->open_path(path, &source);
+  const double open_ms = time_ms() - start;
+
+  if (result != BACKEND_SUCCESS) {
+    return;
+  }
+
+  struct load_state state = {0};
+  imv_source_set_callback(source, &load_callback, &state);
+
+  start = time_ms();
+  imv_source_load_first_frame(source);
+  const double first_frame_ms = time_ms() - start;
+
+  if (!state.image) {
+    fprintf(stderr, "%s failed to decode %s\n", backend->name, path);
+    imv_source_free(source);
+    return;
+  }
+
+  /* for animations, measure steady-state frame decode throughput */
+  double frames_per_sec = 0;
+  if (state.frametime) {
+    int frames = 0;
+    start = time_ms();
+    double elapsed = 0;
+    while (frames < next_frame_limit && elapsed < next_frame_budget * 1000.0) {
+      imv_source_load_next_frame(source);
+      if (!state.image) {
+        break;
+      }
+      ++frames;
+      elapsed = time_ms() - start;
+    }
+    if (frames && elapsed > 0) {
+      frames_per_sec = frames / (elapsed / 1000.0);
+    }
+  }
+
+  if (state.image) {
+    imv_image_free(state.image);
+  }
+  imv_source_free(source);
+
+  printf("%s,%s,%.3f,%.3f,%.1f,%ld\n",
+      backend->name, path, open_ms, first_frame_ms, frames_per_sec,
+      peak_rss_kb());
+}
+
+static void bench_path(const char *path)
+{
+  struct stat info;
+  if (stat(path, &info) == -1) {
+    fprintf(stderr, "cannot stat %s\n", path);
+    return;
+  }
+
+  if (!S_ISDIR(info.st_mode)) {
+    for (size_t i = 0; backends[i]; ++i) {
+      bench_file(backends[i], path);
+    }
+    return;
+  }
+
+  DIR *dir = opendir(path);
+  if (!dir) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return;
+  }
+
+  for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    char file[1024];
+    snprintf(file, sizeof file, "%s/%s", path, entry->d_name);
+    if (stat(file, &info) == 0 && S_ISREG(info.st_mode)) {
+      for (size_t i = 0; backends[i]; ++i) {
+        bench_file(backends[i], file);
+      }
+    }
+  }
+  closedir(dir);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <directory|file>...\n", argv[0]);
+    fprintf(stderr, "Backends built in:");
+    for (size_t i = 0; backends[i]; ++i) {
+      fprintf(stderr, " %s", backends[i]->name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  printf("backend,file,open_ms,first_frame_ms,next_frames_per_sec,peak_rss_kb\n");
+
+  for (int i = 1; i < argc; ++i) {
+    bench_path(argv[i]);
+  }
+
+  return 0;
+}
@@ -6,6 +6,19 @@
 # x11 - Only provide X11 support
 WINDOWS=all
 
+# Decode images into dmabuf-backed buffers (allocated through GBM) that the
+# Wayland window imports directly as textures, skipping the CPU-side texture
+# upload. Falls back to plain memory at runtime when there is no usable
+# render node or the EGL driver lacks dmabuf import.
+# depends: libgbm
+ENABLE_DMABUF=no
+
+# Colour management: bake an image's embedded ICC profile into a 3D lookup
+# texture on a worker thread and apply it in the shader renderer. The target
+# profile comes from the display_profile config option, defaulting to sRGB.
+# depends: lcms2
+ENABLE_ICC=no
+
 # Configure available backends:
 
 # FreeImage http://freeimage.sourceforge.net
@@ -43,3 +56,20 @@ BACKEND_LIBRSVG=yes
 # depends: none
 # license: MIT
 BACKEND_LIBNSGIF=no
+
+# libavif https://github.com/AOMediaCodec/libavif
+# provides: avif, animated avif
+# depends: an AV1 decoder (dav1d, libgav1 or libaom)
+# license: BSD 2-Clause
+BACKEND_LIBAVIF=no
+
+# libwebp https://developers.google.com/speed/webp
+# provides: webp, animated webp
+# depends: none
+# license: BSD 3-Clause
+BACKEND_LIBWEBP=no
+
+# built-in raw-format loader
+# provides: farbfeld, binary netpbm (ppm/pam), qoi
+# depends: none
+BACKEND_RAW=yes
@@ -7,6 +7,11 @@
 
 #include <FreeImage.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Animations up to this many frames keep each composited frame in a ring so
+ * that looping playback stops paying for decodes after the first pass */
+#define FRAME_RING_MAX_FRAMES 256
 
 struct private {
   char *path;
@@ -18,6 +23,10 @@ struct private {
   int next_frame;
   int width;
   int height;
+  /* one slot per frame, filled in as frames are first composited; NULL
+   * until the animation is small enough to cache */
+  struct imv_bitmap **ring;
+  int *ring_frametimes;
 };
 
 static void free_private(void *raw_private)
@@ -46,20 +55,41 @@ static void free_private(void *raw_private)
     private->last_frame = NULL;
   }
 
+  if (private->ring) {
+    for (int i = 0; i < private->num_frames; ++i) {
+      if (private->ring[i]) {
+        imv_bitmap_unref(private->ring[i]);
+      }
+    }
+    free(private->ring);
+    free(private->ring_frametimes);
+  }
+
   free(private);
 }
 
-static struct imv_image *to_image(FIBITMAP *in_bmp)
+static struct imv_bitmap *to_bitmap(FIBITMAP *in_bmp)
 {
-  struct imv_bitmap *bmp = malloc(sizeof *bmp);
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
   bmp->width = FreeImage_GetWidth(in_bmp);
   bmp->height = FreeImage_GetHeight(in_bmp);
   bmp->format = IMV_ARGB;
   bmp->data = malloc(4 * bmp->width * bmp->height);
   FreeImage_ConvertToRawBits(bmp->data, in_bmp, 4 * bmp->width, 32,
       FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, TRUE);
-  struct imv_image *image = imv_image_create_from_bitmap(bmp);
-  return image;
+  const FIICCPROFILE *icc = FreeImage_GetICCProfile(in_bmp);
+  if (icc && icc->data && icc->size > 0) {
+    bmp->profile = malloc(icc->size);
+    memcpy(bmp->profile, icc->data, icc->size);
+    bmp->profile_len = icc->size;
+  }
+  bmp->refs = 1;
+  return bmp;
+}
+
+static struct imv_image *to_image(FIBITMAP *in_bmp)
+{
+  return imv_image_create_from_bitmap(to_bitmap(in_bmp));
 }
 
 static FIBITMAP *normalise_bitmap(FIBITMAP *input)
@@ -166,7 +196,18 @@ static void first_frame(void *raw_private, struct imv_image **image, int *framet
   private->last_frame = bmp;
   private->next_frame = 1 % private->num_frames;
 
-  *image = to_image(bmp);
+  if (private->num_frames > 1 && private->num_frames <= FRAME_RING_MAX_FRAMES) {
+    private->ring = calloc(private->num_frames, sizeof *private->ring);
+    private->ring_frametimes =
+      calloc(private->num_frames, sizeof *private->ring_frametimes);
+  }
+
+  struct imv_bitmap *out = to_bitmap(bmp);
+  if (private->ring) {
+    private->ring[0] = imv_bitmap_ref(out);
+    private->ring_frametimes[0] = *frametime;
+  }
+  *image = imv_image_create_from_bitmap(out);
 }
 
 static void next_frame(void *raw_private, struct imv_image **image, int *frametime)
@@ -181,6 +222,16 @@ static void next_frame(void *raw_private, struct imv_image **image, int *frameti
     return;
   }
 
+  const int this_frame = private->next_frame;
+  if (private->ring && private->ring[this_frame]) {
+    /* already composited on an earlier pass, serve from the ring */
+    *frametime = private->ring_frametimes[this_frame];
+    *image = imv_image_create_from_bitmap(
+        imv_bitmap_ref(private->ring[this_frame]));
+    private->next_frame = (this_frame + 1) % private->num_frames;
+    return;
+  }
+
   FITAG *tag = NULL;
   char disposal_method = 0;
   short top = 0;
@@ -260,9 +311,14 @@ static void next_frame(void *raw_private, struct imv_image **image, int *frameti
       break;
   }
 
-  private->next_frame = (private->next_frame + 1) % private->num_frames;
+  private->next_frame = (this_frame + 1) % private->num_frames;
 
-  *image = to_image(private->last_frame);
+  struct imv_bitmap *out = to_bitmap(private->last_frame);
+  if (private->ring) {
+    private->ring[this_frame] = imv_bitmap_ref(out);
+    private->ring_frametimes[this_frame] = *frametime;
+  }
+  *image = imv_image_create_from_bitmap(out);
 }
 
 static const struct imv_source_vtable vtable = {
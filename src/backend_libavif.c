@@ -0,0 +1,196 @@
+#include "backend.h"
+#include "bitmap.h"
+#include "image.h"
+#include "log.h"
+#include "source.h"
+#include "source_private.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <avif/avif.h>
+
+struct private {
+  int fd;
+  void *data;
+  size_t len;
+  avifDecoder *decoder;
+  /* the decoder is positioned past its first image once we've served it;
+   * a later load_first_frame has to rewind */
+  bool decoded_any;
+};
+
+/* Row-level decode threads, sized to the machine */
+static int num_threads(void)
+{
+  const long procs = sysconf(_SC_NPROCESSORS_ONLN);
+  return procs > 0 ? (int)procs : 1;
+}
+
+static void free_private(void *raw_private)
+{
+  if (!raw_private) {
+    return;
+  }
+  struct private *private = raw_private;
+  avifDecoderDestroy(private->decoder);
+  if (private->fd >= 0) {
+    munmap(private->data, private->len);
+    close(private->fd);
+  }
+  free(private);
+}
+
+static void push_current_image(struct private *private,
+    struct imv_image **image, int *frametime)
+{
+  avifRGBImage rgb;
+  avifRGBImageSetDefaults(&rgb, private->decoder->image);
+  rgb.format = AVIF_RGB_FORMAT_RGBA;
+  rgb.depth = 8;
+  rgb.rowBytes = rgb.width * 4;
+  rgb.pixels = malloc((size_t)rgb.rowBytes * rgb.height);
+
+  if (avifImageYUVToRGB(private->decoder->image, &rgb) != AVIF_RESULT_OK) {
+    imv_log(IMV_DEBUG, "libavif: failed to convert image to RGB\n");
+    free(rgb.pixels);
+    return;
+  }
+
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
+  bmp->width = rgb.width;
+  bmp->height = rgb.height;
+  bmp->format = IMV_ABGR;
+  bmp->data = rgb.pixels;
+  bmp->refs = 1;
+  *image = imv_image_create_from_bitmap(bmp);
+
+  if (private->decoder->imageCount > 1) {
+    *frametime = (int)(private->decoder->imageTiming.duration * 1000.0);
+  }
+}
+
+static void first_frame(void *raw_private, struct imv_image **image, int *frametime)
+{
+  *image = NULL;
+  *frametime = 0;
+
+  struct private *private = raw_private;
+
+  if (private->decoded_any
+      && avifDecoderReset(private->decoder) != AVIF_RESULT_OK) {
+    return;
+  }
+
+  if (avifDecoderNextImage(private->decoder) != AVIF_RESULT_OK) {
+    imv_log(IMV_DEBUG, "libavif: failed to decode first frame\n");
+    return;
+  }
+  private->decoded_any = true;
+
+  push_current_image(private, image, frametime);
+}
+
+static void next_frame(void *raw_private, struct imv_image **image, int *frametime)
+{
+  *image = NULL;
+  *frametime = 0;
+
+  struct private *private = raw_private;
+
+  avifResult result = avifDecoderNextImage(private->decoder);
+  if (result == AVIF_RESULT_NO_IMAGES_REMAINING) {
+    /* loop the animation */
+    if (avifDecoderReset(private->decoder) != AVIF_RESULT_OK) {
+      return;
+    }
+    result = avifDecoderNextImage(private->decoder);
+  }
+  if (result != AVIF_RESULT_OK) {
+    imv_log(IMV_DEBUG, "libavif: failed to decode a frame\n");
+    return;
+  }
+
+  push_current_image(private, image, frametime);
+}
+
+static const struct imv_source_vtable vtable = {
+  .load_first_frame = first_frame,
+  .load_next_frame = next_frame,
+  .free = free_private
+};
+
+/* Build a decoder over the given buffer, which must outlive it */
+static enum backend_result open_buffer(struct private *private,
+    struct imv_source **src)
+{
+  private->decoder = avifDecoderCreate();
+  if (!private->decoder) {
+    return BACKEND_UNSUPPORTED;
+  }
+  private->decoder->maxThreads = num_threads();
+
+  if (avifDecoderSetIOMemory(private->decoder, private->data, private->len)
+        != AVIF_RESULT_OK
+      || avifDecoderParse(private->decoder) != AVIF_RESULT_OK) {
+    avifDecoderDestroy(private->decoder);
+    imv_log(IMV_DEBUG, "libavif: unsupported file\n");
+    return BACKEND_UNSUPPORTED;
+  }
+
+  struct private *new_private = malloc(sizeof *private);
+  memcpy(new_private, private, sizeof *private);
+
+  *src = imv_source_create(&vtable, new_private);
+  return BACKEND_SUCCESS;
+}
+
+static enum backend_result open_path(const char *path, struct imv_source **src)
+{
+  struct private private = { .fd = -1 };
+
+  private.fd = open(path, O_RDONLY);
+  if (private.fd < 0) {
+    return BACKEND_BAD_PATH;
+  }
+
+  off_t len = lseek(private.fd, 0, SEEK_END);
+  if (len < 0) {
+    close(private.fd);
+    return BACKEND_BAD_PATH;
+  }
+
+  private.len = len;
+
+  private.data = mmap(NULL, private.len, PROT_READ, MAP_PRIVATE, private.fd, 0);
+  if (private.data == MAP_FAILED || !private.data) {
+    close(private.fd);
+    return BACKEND_BAD_PATH;
+  }
+
+  enum backend_result result = open_buffer(&private, src);
+  if (result != BACKEND_SUCCESS) {
+    munmap(private.data, private.len);
+    close(private.fd);
+  }
+  return result;
+}
+
+static enum backend_result open_memory(void *data, size_t len, struct imv_source **src)
+{
+  struct private private = { .fd = -1, .data = data, .len = len };
+  return open_buffer(&private, src);
+}
+
+const struct imv_backend imv_backend_libavif = {
+  .name = "libavif",
+  .description = "AVIF decoding library from the Alliance for Open Media",
+  .website = "https://github.com/AOMediaCodec/libavif",
+  .license = "BSD 2-Clause",
+  .open_path = &open_path,
+  .open_memory = &open_memory,
+};
@@ -19,8 +19,12 @@ struct private {
   void *data;
   size_t len;
   tjhandle jpeg;
+  /* full-resolution dimensions from the jpeg header */
   int width;
   int height;
+  /* display size hint, 0x0 to decode at full resolution */
+  int target_width;
+  int target_height;
 };
 
 static void free_private(void *raw_private)
@@ -41,6 +45,36 @@ static void free_private(void *raw_private)
   free(private);
 }
 
+/* Pick the decode size: the smallest of libjpeg-turbo's fixed scaling
+ * factors that still covers the target size, so we never upscale a
+ * reduced decode. Falls back to full resolution with no target set.
+ */
+static void scaled_size(struct private *private, int *width, int *height)
+{
+  *width = private->width;
+  *height = private->height;
+
+  if (private->target_width <= 0 || private->target_height <= 0) {
+    return;
+  }
+
+  int num_factors = 0;
+  tjscalingfactor *factors = tjGetScalingFactors(&num_factors);
+  if (!factors) {
+    return;
+  }
+
+  for (int i = 0; i < num_factors; ++i) {
+    const int w = TJSCALED(private->width, factors[i]);
+    const int h = TJSCALED(private->height, factors[i]);
+    if (w >= private->target_width && h >= private->target_height
+        && w < *width && h < *height) {
+      *width = w;
+      *height = h;
+    }
+  }
+}
+
 static void load_image(void *raw_private, struct imv_image **image, int *frametime)
 {
   *image = NULL;
@@ -48,31 +82,41 @@ static void load_image(void *raw_private, struct imv_image **image, int *frameti
 
   struct private *private = raw_private;
 
-  void *bitmap = malloc(private->height * private->width * 4);
+  int width, height;
+  scaled_size(private, &width, &height);
+
+  /* decode straight into the bitmap's buffer; with dmabuf support built
+   * in that's the same memory the GPU will sample from */
+  struct imv_bitmap *bmp = imv_bitmap_create(width, height, IMV_ABGR);
   int rcode = tjDecompress2(private->jpeg, private->data, private->len,
-      bitmap, private->width, 0, private->height, TJPF_RGBA, TJFLAG_FASTDCT);
+      bmp->data, width, 0, height, TJPF_RGBA, TJFLAG_FASTDCT);
 
   if (rcode) {
-    free(bitmap);
+    imv_bitmap_unref(bmp);
     return;
   }
 
-  struct imv_bitmap *bmp = malloc(sizeof *bmp);
-  bmp->width = private->width;
-  bmp->height = private->height;
-  bmp->format = IMV_ABGR;
-  bmp->data = bitmap;
   *image = imv_image_create_from_bitmap(bmp);
 }
 
+static void set_preferred_size(void *raw_private, int width, int height)
+{
+  struct private *private = raw_private;
+  private->target_width = width;
+  private->target_height = height;
+}
+
 static const struct imv_source_vtable vtable = {
   .load_first_frame = load_image,
+  .set_preferred_size = set_preferred_size,
   .free = free_private
 };
 
 static enum backend_result open_path(const char *path, struct imv_source **src)
 {
   struct private private;
+  private.target_width = 0;
+  private.target_height = 0;
 
   private.fd = open(path, O_RDONLY);
   if (private.fd < 0) {
@@ -119,6 +163,8 @@ static enum backend_result open_path(const char *path, struct imv_source **src)
 static enum backend_result open_memory(void *data, size_t len, struct imv_source **src)
 {
   struct private private;
+  private.target_width = 0;
+  private.target_height = 0;
 
   private.fd = -1;
   private.data = data;
@@ -12,11 +12,18 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+/* Animations up to this many frames keep every decoded frame in a ring so
+ * that looping playback stops paying for decodes after the first pass */
+#define FRAME_RING_MAX_FRAMES 256
+
 struct private {
   int current_frame;
   gif_animation gif;
   void *data;
   size_t len;
+  /* one slot per frame, filled in as frames are first decoded; NULL until
+   * the animation is small enough to cache */
+  struct imv_bitmap **ring;
 };
 
 static void* bitmap_create(int width, int height)
@@ -69,21 +76,45 @@ static void free_private(void *raw_private)
   }
 
   struct private *private = raw_private;
+  if (private->ring) {
+    for (unsigned int i = 0; i < private->gif.frame_count; ++i) {
+      if (private->ring[i]) {
+        imv_bitmap_unref(private->ring[i]);
+      }
+    }
+    free(private->ring);
+  }
   gif_finalise(&private->gif);
   munmap(private->data, private->len);
   free(private);
 }
 
-static void push_current_image(struct private *private,
-    struct imv_image **image, int *frametime)
+static struct imv_bitmap *current_bitmap(struct private *private)
 {
-  struct imv_bitmap *bmp = malloc(sizeof *bmp);
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
   bmp->width = private->gif.width;
   bmp->height = private->gif.height;
   bmp->format = IMV_ABGR;
   size_t len = 4 * bmp->width * bmp->height;
   bmp->data = malloc(len);
+  bmp->refs = 1;
   memcpy(bmp->data, private->gif.frame_image, len);
+  return bmp;
+}
+
+static void push_current_image(struct private *private,
+    struct imv_image **image, int *frametime)
+{
+  struct imv_bitmap *bmp;
+  if (private->ring && private->ring[private->current_frame]) {
+    /* already decoded on an earlier pass, serve from the ring */
+    bmp = imv_bitmap_ref(private->ring[private->current_frame]);
+  } else {
+    bmp = current_bitmap(private);
+    if (private->ring) {
+      private->ring[private->current_frame] = imv_bitmap_ref(bmp);
+    }
+  }
 
   *image = imv_image_create_from_bitmap(bmp);
   *frametime = private->gif.frames[private->current_frame].frame_delay * 10.0;
@@ -97,6 +128,11 @@ static void first_frame(void *raw_private, struct imv_image **image, int *framet
   struct private *private = raw_private;
   private->current_frame = 0;
 
+  if (!private->ring && private->gif.frame_count > 1
+      && private->gif.frame_count <= FRAME_RING_MAX_FRAMES) {
+    private->ring = calloc(private->gif.frame_count, sizeof *private->ring);
+  }
+
   gif_result code = gif_decode_frame(&private->gif, private->current_frame);
   if (code != GIF_OK) {
     imv_log(IMV_DEBUG, "libnsgif: failed to decode first frame\n");
@@ -116,6 +152,12 @@ static void next_frame(void *raw_private, struct imv_image **image, int *frameti
   private->current_frame++;
   private->current_frame %= private->gif.frame_count;
 
+  if (private->ring && private->ring[private->current_frame]) {
+    /* no decode needed, the ring already has this frame */
+    push_current_image(private, image, frametime);
+    return;
+  }
+
   gif_result code = gif_decode_frame(&private->gif, private->current_frame);
   if (code != GIF_OK) {
     imv_log(IMV_DEBUG, "libnsgif: failed to decode a frame\n");
@@ -5,14 +5,37 @@
 #include "source.h"
 #include "source_private.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <png.h>
 
+/* Decodes through libpng's progressive reader so partial images can be
+ * shown while the rest of the file streams in. Interlaced files emit a
+ * preview after each Adam7 pass; the first pass covers the whole image at
+ * 1/8th resolution, so something recognizable appears after ~2% of the
+ * bytes. Plain files emit as each quarter of their rows lands. */
+
+/* How much of the file is handed to libpng per call; rows are delivered in
+ * batches of whatever each chunk contains */
+#define CHUNK_SIZE (64 * 1024)
+
 struct private {
   FILE *file;
   png_structp png;
   png_infop info;
+
+  struct imv_bitmap *bmp; /* decode target, created by info_callback */
+  int passes;             /* Adam7 pass count; 1 when not interlaced */
+  int current_pass;
+  png_uint_32 rows_done;      /* rows landed, when not interlaced */
+  png_uint_32 quarter;        /* preview interval in rows, ditto */
+  png_uint_32 next_milestone; /* row count to emit the next preview at */
+  bool done;
+
+  imv_source_partial_emitter emit;
+  void *emit_context;
 };
 
 static void free_private(void *raw_private)
@@ -26,50 +49,168 @@ static void free_private(void *raw_private)
   if (private->file) {
     fclose(private->file);
   }
+  if (private->bmp) {
+    imv_bitmap_unref(private->bmp);
+  }
   free(private);
 }
 
-static void load_image(void *raw_private, struct imv_image **image, int *frametime)
+/* After an Adam7 pass the decoded pixels sit on a sparse grid; replicate
+ * each across the block of the image it represents, so the preview is a
+ * blocky rendition of the whole picture rather than a sprinkle of dots.
+ * Later passes overwrite every replicated pixel with real data. */
+static void fill_blocks(struct imv_bitmap *bmp, int completed_pass)
 {
-  *image = NULL;
-  *frametime = 0;
-
-  struct private *private = raw_private;
-  if (setjmp(png_jmpbuf(private->png))) {
+  static const int block_w[] = {8, 4, 4, 2, 2, 1, 1};
+  static const int block_h[] = {8, 8, 4, 4, 2, 2, 1};
+  const int bw = block_w[completed_pass];
+  const int bh = block_h[completed_pass];
+  if (bw == 1 && bh == 1) {
     return;
   }
 
-  const int width = png_get_image_width(private->png, private->info);
-  const int height = png_get_image_height(private->png, private->info);
+  const size_t row_len = (size_t)bmp->width * 4;
+  for (int y = 0; y < bmp->height; y += bh) {
+    unsigned char *row = bmp->data + (size_t)y * row_len;
+    if (bw > 1) {
+      for (int x = 0; x < bmp->width; x += bw) {
+        const unsigned char *px = row + (size_t)x * 4;
+        for (int i = 1; i < bw && x + i < bmp->width; ++i) {
+          memcpy(row + (size_t)(x + i) * 4, px, 4);
+        }
+      }
+    }
+    for (int i = 1; i < bh && y + i < bmp->height; ++i) {
+      memcpy(row + (size_t)i * row_len, row, row_len);
+    }
+  }
+}
+
+static void emit_preview(struct private *private)
+{
+  /* decoding continues into bmp, so the receiver gets its own copy */
+  struct imv_bitmap *copy = imv_bitmap_clone(private->bmp);
+  private->emit(private->emit_context, imv_image_create_from_bitmap(copy));
+}
+
+static void info_callback(png_structp png, png_infop info)
+{
+  struct private *private = png_get_progressive_ptr(png);
+
+  /* Tell libpng to give us a consistent output format */
+  png_set_gray_to_rgb(png);
+  png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+  png_set_strip_16(png);
+  png_set_expand(png);
+  png_set_packing(png);
+  private->passes = png_set_interlace_handling(png);
+  png_read_update_info(png, info);
+
+  const int width = png_get_image_width(png, info);
+  const int height = png_get_image_height(png, info);
+  imv_log(IMV_DEBUG, "libpng: info width=%d height=%d bit_depth=%d color_type=%d passes=%d\n",
+      width, height,
+      png_get_bit_depth(png, info),
+      png_get_color_type(png, info),
+      private->passes);
+
+  /* decode straight into the bitmap's buffer; with dmabuf support built
+   * in that's the same memory the GPU will sample from */
+  private->bmp = imv_bitmap_create(width, height, IMV_ABGR);
+  private->quarter = (height + 3) / 4;
+  private->next_milestone = private->quarter;
+
+  png_charp icc_name;
+  int icc_compression;
+  png_bytep icc_data;
+  png_uint_32 icc_len;
+  if (png_get_iCCP(png, info, &icc_name, &icc_compression,
+        &icc_data, &icc_len) == PNG_INFO_iCCP) {
+    private->bmp->profile = malloc(icc_len);
+    memcpy(private->bmp->profile, icc_data, icc_len);
+    private->bmp->profile_len = icc_len;
+  }
+}
+
+static void row_callback(png_structp png, png_bytep new_row,
+    png_uint_32 row_num, int pass)
+{
+  struct private *private = png_get_progressive_ptr(png);
+
+  if (pass != private->current_pass) {
+    /* the previous pass just finished; show it */
+    if (private->emit) {
+      fill_blocks(private->bmp, private->current_pass);
+      emit_preview(private);
+    }
+    private->current_pass = pass;
+  }
+
+  /* new_row is NULL when this pass carries no data for the row */
+  png_progressive_combine_row(png,
+      private->bmp->data + (size_t)row_num * private->bmp->width * 4, new_row);
 
-  png_bytep *rows = malloc(sizeof(png_bytep) * height);
-  size_t row_len = png_get_rowbytes(private->png, private->info);
-  rows[0] = malloc(height * row_len);
-  for (int y = 1; y < height; ++y) {
-    rows[y] = rows[0] + row_len * y;
+  if (private->passes == 1 && private->emit && private->quarter) {
+    ++private->rows_done;
+    if (private->rows_done >= private->next_milestone
+        && private->rows_done < (png_uint_32)private->bmp->height) {
+      emit_preview(private);
+      private->next_milestone += private->quarter;
+    }
   }
+}
+
+static void end_callback(png_structp png, png_infop info)
+{
+  (void)info;
+  struct private *private = png_get_progressive_ptr(png);
+  private->done = true;
+}
+
+static void load_image(void *raw_private, struct imv_image **image,
+    int *frametime, imv_source_partial_emitter emit, void *context)
+{
+  *image = NULL;
+  *frametime = 0;
+
+  struct private *private = raw_private;
+  private->emit = emit;
+  private->emit_context = context;
 
   if (setjmp(png_jmpbuf(private->png))) {
+    if (private->bmp) {
+      imv_bitmap_unref(private->bmp);
+      private->bmp = NULL;
+    }
     return;
   }
 
-  png_read_image(private->png, rows);
-  void *raw_bmp = rows[0];
-  free(rows);
+  unsigned char chunk[CHUNK_SIZE];
+  while (!private->done) {
+    const size_t len = fread(chunk, 1, sizeof chunk, private->file);
+    if (len == 0) {
+      break;
+    }
+    png_process_data(private->png, private->info, chunk, len);
+  }
   fclose(private->file);
   private->file = NULL;
 
+  if (!private->done || !private->bmp) {
+    /* truncated file; nothing landed, or only part of an image did */
+    if (private->bmp) {
+      imv_bitmap_unref(private->bmp);
+      private->bmp = NULL;
+    }
+    return;
+  }
 
-  struct imv_bitmap *bmp = malloc(sizeof *bmp);
-  bmp->width = width;
-  bmp->height = height;
-  bmp->format = IMV_ABGR;
-  bmp->data = raw_bmp;
-  *image = imv_image_create_from_bitmap(bmp);
+  *image = imv_image_create_from_bitmap(private->bmp);
+  private->bmp = NULL;
 }
 
 static const struct imv_source_vtable vtable = {
-  .load_first_frame = load_image,
+  .load_first_frame_streaming = load_image,
   .free = free_private
 };
 
@@ -86,6 +227,8 @@ static enum backend_result open_path(const char *path, struct imv_source **src)
     fclose(f);
     return BACKEND_UNSUPPORTED;
   }
+  /* the progressive reader checks the signature itself */
+  rewind(f);
 
   struct private *private = calloc(1, sizeof *private);
   private->file = f;
@@ -114,29 +257,8 @@ static enum backend_result open_path(const char *path, struct imv_source **src)
     return BACKEND_UNSUPPORTED;
   }
 
-  png_init_io(private->png, private->file);
-  png_set_sig_bytes(private->png, sizeof header);
-  png_read_info(private->png, private->info);
-
-  /* Tell libpng to give us a consistent output format */
-  png_set_gray_to_rgb(private->png);
-  png_set_filler(private->png, 0xff, PNG_FILLER_AFTER);
-  png_set_strip_16(private->png);
-  png_set_expand(private->png);
-  png_set_packing(private->png);
-  png_read_update_info(private->png, private->info);
-  imv_log(IMV_DEBUG, "libpng: info width=%d height=%d bit_depth=%d color_type=%d\n",
-      png_get_image_width(private->png, private->info),
-      png_get_image_height(private->png, private->info),
-      png_get_bit_depth(private->png, private->info),
-      png_get_color_type(private->png, private->info));
-
-  if (setjmp(png_jmpbuf(private->png))) {
-    png_destroy_read_struct(&private->png, &private->info, NULL);
-    fclose(private->file);
-    free(private);
-    return BACKEND_UNSUPPORTED;
-  }
+  png_set_progressive_read_fn(private->png, private,
+      &info_callback, &row_callback, &end_callback);
 
   *src = imv_source_create(&vtable, private);
   return BACKEND_SUCCESS;
@@ -149,4 +271,3 @@ const struct imv_backend imv_backend_libpng = {
   .license = "The libpng license",
   .open_path = &open_path,
 };
-
@@ -4,16 +4,29 @@
 #include "source.h"
 #include "source_private.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <tiffio.h>
 
 struct private {
   TIFF *tiff;
+  char *path; /* NULL when opened from memory */
   void *data;
   size_t pos, len;
   int width;
   int height;
+  /* display size hint, 0x0 to decode at full resolution */
+  int target_width;
+  int target_height;
+};
+
+/* An independent TIFF handle owned by an emitted image, so region decodes
+ * keep working for however long the image is drawn */
+struct region_handle {
+  TIFF *tiff;
+  int width;
+  int height;
 };
 
 static tsize_t mem_read(thandle_t data, tdata_t buffer, tsize_t len)
@@ -68,10 +81,165 @@ static void free_private(void *raw_private)
   struct private *private = raw_private;
   TIFFClose(private->tiff);
   private->tiff = NULL;
+  free(private->path);
 
   free(private);
 }
 
+/* Decode the given rectangle, sampling every step'th pixel, one tile or
+ * strip at a time so peak memory is one decode unit plus the output. The
+ * RGBA rasters libtiff produces have their origin in the bottom-left
+ * corner, hence the row flip when copying out.
+ */
+static struct imv_bitmap *decode_rect(TIFF *tiff, int x, int y,
+    int width, int height, int step)
+{
+  const int out_w = (width + step - 1) / step;
+  const int out_h = (height + step - 1) / step;
+  uint32_t *out = calloc((size_t)out_w * out_h, 4);
+  if (!out) {
+    return NULL;
+  }
+
+  if (TIFFIsTiled(tiff)) {
+    uint32_t tw = 0, th = 0;
+    TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tw);
+    TIFFGetField(tiff, TIFFTAG_TILELENGTH, &th);
+    uint32_t *raster = malloc((size_t)tw * th * 4);
+    if (!raster) {
+      free(out);
+      return NULL;
+    }
+
+    for (int ty = (y / (int)th) * (int)th; ty < y + height; ty += (int)th) {
+      for (int tx = (x / (int)tw) * (int)tw; tx < x + width; tx += (int)tw) {
+        if (!TIFFReadRGBATile(tiff, tx, ty, raster)) {
+          continue;
+        }
+        /* partial edge tiles are decoded into the top of the raster, which
+         * the bottom-left origin indexing below already accounts for */
+        const int oy0 = ty > y ? (ty - y + step - 1) / step : 0;
+        for (int oy = oy0; oy < out_h; ++oy) {
+          const int sy = y + oy * step;
+          if (sy >= ty + (int)th) {
+            break;
+          }
+          const int ox0 = tx > x ? (tx - x + step - 1) / step : 0;
+          for (int ox = ox0; ox < out_w; ++ox) {
+            const int sx = x + ox * step;
+            if (sx >= tx + (int)tw) {
+              break;
+            }
+            out[(size_t)oy * out_w + ox] =
+                raster[(size_t)(th - 1 - (uint32_t)(sy - ty)) * tw + (uint32_t)(sx - tx)];
+          }
+        }
+      }
+    }
+    free(raster);
+  } else {
+    uint32_t img_w = 0, img_h = 0;
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &img_w);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &img_h);
+    uint32_t rows_per_strip = 0;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+    if (rows_per_strip == 0 || rows_per_strip > img_h) {
+      rows_per_strip = img_h;
+    }
+    uint32_t *raster = malloc((size_t)img_w * rows_per_strip * 4);
+    if (!raster) {
+      free(out);
+      return NULL;
+    }
+
+    const int start = (y / (int)rows_per_strip) * (int)rows_per_strip;
+    for (int sy_start = start; sy_start < y + height; sy_start += (int)rows_per_strip) {
+      int nrows = (int)img_h - sy_start;
+      if (nrows > (int)rows_per_strip) {
+        nrows = (int)rows_per_strip;
+      }
+      if (!TIFFReadRGBAStrip(tiff, sy_start, raster)) {
+        continue;
+      }
+      const int oy0 = sy_start > y ? (sy_start - y + step - 1) / step : 0;
+      for (int oy = oy0; oy < out_h; ++oy) {
+        const int sy = y + oy * step;
+        if (sy >= sy_start + nrows) {
+          break;
+        }
+        const uint32_t *row = raster + (size_t)(nrows - 1 - (sy - sy_start)) * img_w;
+        for (int ox = 0; ox < out_w; ++ox) {
+          out[(size_t)oy * out_w + ox] = row[x + ox * step];
+        }
+      }
+    }
+    free(raster);
+  }
+
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
+  bmp->width = out_w;
+  bmp->height = out_h;
+  bmp->format = IMV_ABGR;
+  bmp->data = (void*)out;
+  bmp->refs = 1;
+  return bmp;
+}
+
+static struct imv_bitmap *region_load(void *data, int x, int y,
+    int width, int height)
+{
+  struct region_handle *handle = data;
+
+  /* clamp the request to the image */
+  if (x < 0) {
+    width += x;
+    x = 0;
+  }
+  if (y < 0) {
+    height += y;
+    y = 0;
+  }
+  if (x + width > handle->width) {
+    width = handle->width - x;
+  }
+  if (y + height > handle->height) {
+    height = handle->height - y;
+  }
+  if (width <= 0 || height <= 0) {
+    return NULL;
+  }
+
+  return decode_rect(handle->tiff, x, y, width, height, 1);
+}
+
+static void region_free(void *data)
+{
+  struct region_handle *handle = data;
+  TIFFClose(handle->tiff);
+  free(handle);
+}
+
+static const struct imv_image_region_vtable region_vtable = {
+  .load_region = region_load,
+  .free = region_free,
+};
+
+/* Pick the pixel sampling step for a reduced decode: the largest step that
+ * still covers the target size, so we never upscale. 1 with no target set.
+ */
+static int sample_step(struct private *private)
+{
+  if (private->target_width <= 0 || private->target_height <= 0) {
+    return 1;
+  }
+  int step = private->width / private->target_width;
+  const int vstep = private->height / private->target_height;
+  if (vstep < step) {
+    step = vstep;
+  }
+  return step > 1 ? step : 1;
+}
+
 static void load_image(void *raw_private, struct imv_image **image, int *frametime)
 {
   *image = NULL;
@@ -79,6 +247,35 @@ static void load_image(void *raw_private, struct imv_image **image, int *frameti
 
   struct private *private = raw_private;
 
+  const int step = sample_step(private);
+  if (step > 1) {
+    /* Reduced decode, built strip/tile-at-a-time: peak memory is
+     * proportional to the target size, not the file. Region decodes fill
+     * the detail back in when the user zooms.
+     */
+    struct imv_bitmap *bmp = decode_rect(private->tiff, 0, 0,
+        private->width, private->height, step);
+    if (!bmp) {
+      return;
+    }
+    *image = imv_image_create_from_bitmap(bmp);
+
+    if (private->path) {
+      /* the image gets its own TIFF handle, living as long as it does */
+      struct region_handle *handle = malloc(sizeof *handle);
+      handle->tiff = TIFFOpen(private->path, "r");
+      handle->width = private->width;
+      handle->height = private->height;
+      if (handle->tiff) {
+        imv_image_set_region_provider(*image, &region_vtable, handle,
+            private->width, private->height);
+      } else {
+        free(handle);
+      }
+    }
+    return;
+  }
+
   /* libtiff suggests using their own allocation routines to support systems
    * with segmented memory. I have no desire to support that, so I'm just
    * going to use vanilla malloc/free. Systems where that isn't acceptable
@@ -93,22 +290,32 @@ static void load_image(void *raw_private, struct imv_image **image, int *frameti
     return;
   }
 
-  struct imv_bitmap *bmp = malloc(sizeof *bmp);
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
   bmp->width = private->width;
   bmp->height = private->height;
   bmp->format = IMV_ABGR;
   bmp->data = bitmap;
+  bmp->refs = 1;
   *image = imv_image_create_from_bitmap(bmp);
 }
 
+static void set_preferred_size(void *raw_private, int width, int height)
+{
+  struct private *private = raw_private;
+  private->target_width = width;
+  private->target_height = height;
+}
+
 static const struct imv_source_vtable vtable = {
   .load_first_frame = load_image,
+  .set_preferred_size = set_preferred_size,
   .free = free_private
 };
 
 static enum backend_result open_path(const char *path, struct imv_source **src)
 {
   struct private private;
+  memset(&private, 0, sizeof private);
 
   private.tiff = TIFFOpen(path, "r");
   if (!private.tiff) {
@@ -118,6 +325,7 @@ static enum backend_result open_path(const char *path, struct imv_source **src)
 
   TIFFGetField(private.tiff, TIFFTAG_IMAGEWIDTH, &private.width);
   TIFFGetField(private.tiff, TIFFTAG_IMAGELENGTH, &private.height);
+  private.path = strdup(path);
 
   struct private *new_private = malloc(sizeof private);
   memcpy(new_private, &private, sizeof private);
@@ -128,7 +336,7 @@ static enum backend_result open_path(const char *path, struct imv_source **src)
 
 static enum backend_result open_memory(void *data, size_t len, struct imv_source **src)
 {
-  struct private *private = malloc(sizeof *private);
+  struct private *private = calloc(1, sizeof *private);
   private->data = data;
   private->len = len;
   private->pos = 0;
@@ -0,0 +1,175 @@
+#include "backend.h"
+#include "bitmap.h"
+#include "image.h"
+#include "log.h"
+#include "source.h"
+#include "source_private.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <webp/demux.h>
+
+struct private {
+  int fd;
+  void *data;
+  size_t len;
+  /* decodes both still and animated webp; frames arrive fully composited */
+  WebPAnimDecoder *decoder;
+  WebPAnimInfo info;
+  /* frame timestamps are cumulative, so durations are the delta */
+  int prev_timestamp;
+};
+
+static void free_private(void *raw_private)
+{
+  if (!raw_private) {
+    return;
+  }
+  struct private *private = raw_private;
+  WebPAnimDecoderDelete(private->decoder);
+  if (private->fd >= 0) {
+    munmap(private->data, private->len);
+    close(private->fd);
+  }
+  free(private);
+}
+
+static void push_next_frame(struct private *private,
+    struct imv_image **image, int *frametime)
+{
+  uint8_t *buffer;
+  int timestamp;
+  if (!WebPAnimDecoderGetNext(private->decoder, &buffer, &timestamp)) {
+    imv_log(IMV_DEBUG, "libwebp: failed to decode a frame\n");
+    return;
+  }
+
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
+  bmp->width = private->info.canvas_width;
+  bmp->height = private->info.canvas_height;
+  bmp->format = IMV_ABGR;
+  size_t len = 4 * bmp->width * bmp->height;
+  bmp->data = malloc(len);
+  bmp->refs = 1;
+  memcpy(bmp->data, buffer, len);
+  *image = imv_image_create_from_bitmap(bmp);
+
+  if (private->info.frame_count > 1) {
+    *frametime = timestamp - private->prev_timestamp;
+  }
+  private->prev_timestamp = timestamp;
+}
+
+static void first_frame(void *raw_private, struct imv_image **image, int *frametime)
+{
+  *image = NULL;
+  *frametime = 0;
+
+  struct private *private = raw_private;
+  WebPAnimDecoderReset(private->decoder);
+  private->prev_timestamp = 0;
+
+  push_next_frame(private, image, frametime);
+}
+
+static void next_frame(void *raw_private, struct imv_image **image, int *frametime)
+{
+  *image = NULL;
+  *frametime = 0;
+
+  struct private *private = raw_private;
+  if (!WebPAnimDecoderHasMoreFrames(private->decoder)) {
+    /* loop the animation */
+    WebPAnimDecoderReset(private->decoder);
+    private->prev_timestamp = 0;
+  }
+
+  push_next_frame(private, image, frametime);
+}
+
+static const struct imv_source_vtable vtable = {
+  .load_first_frame = first_frame,
+  .load_next_frame = next_frame,
+  .free = free_private
+};
+
+/* Build a decoder over the given buffer, which must outlive it */
+static enum backend_result open_buffer(struct private *private,
+    struct imv_source **src)
+{
+  WebPAnimDecoderOptions options;
+  WebPAnimDecoderOptionsInit(&options);
+  options.color_mode = MODE_RGBA;
+  options.use_threads = 1;
+
+  const WebPData webp_data = {
+    .bytes = private->data,
+    .size = private->len,
+  };
+  private->decoder = WebPAnimDecoderNew(&webp_data, &options);
+  if (!private->decoder) {
+    imv_log(IMV_DEBUG, "libwebp: unsupported file\n");
+    return BACKEND_UNSUPPORTED;
+  }
+
+  if (!WebPAnimDecoderGetInfo(private->decoder, &private->info)) {
+    WebPAnimDecoderDelete(private->decoder);
+    return BACKEND_UNSUPPORTED;
+  }
+
+  struct private *new_private = malloc(sizeof *private);
+  memcpy(new_private, private, sizeof *private);
+
+  *src = imv_source_create(&vtable, new_private);
+  return BACKEND_SUCCESS;
+}
+
+static enum backend_result open_path(const char *path, struct imv_source **src)
+{
+  struct private private = { .fd = -1 };
+
+  private.fd = open(path, O_RDONLY);
+  if (private.fd < 0) {
+    return BACKEND_BAD_PATH;
+  }
+
+  off_t len = lseek(private.fd, 0, SEEK_END);
+  if (len < 0) {
+    close(private.fd);
+    return BACKEND_BAD_PATH;
+  }
+
+  private.len = len;
+
+  private.data = mmap(NULL, private.len, PROT_READ, MAP_PRIVATE, private.fd, 0);
+  if (private.data == MAP_FAILED || !private.data) {
+    close(private.fd);
+    return BACKEND_BAD_PATH;
+  }
+
+  enum backend_result result = open_buffer(&private, src);
+  if (result != BACKEND_SUCCESS) {
+    munmap(private.data, private.len);
+    close(private.fd);
+  }
+  return result;
+}
+
+static enum backend_result open_memory(void *data, size_t len, struct imv_source **src)
+{
+  struct private private = { .fd = -1, .data = data, .len = len };
+  return open_buffer(&private, src);
+}
+
+const struct imv_backend imv_backend_libwebp = {
+  .name = "libwebp",
+  .description = "WebP decoding library from Google",
+  .website = "https://developers.google.com/speed/webp",
+  .license = "BSD 3-Clause",
+  .open_path = &open_path,
+  .open_memory = &open_memory,
+};
@@ -0,0 +1,409 @@
+#include "backend.h"
+#include "bitmap.h"
+#include "image.h"
+#include "source.h"
+#include "source_private.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Loads the simple uncompressed interchange formats - farbfeld, binary
+ * netpbm (P6/P7) and QOI - without a decoding library. The file is mapped
+ * rather than read, and when the pixel layout in the file already matches
+ * a bitmap format - PAM's 8-bit RGB_ALPHA - the bitmap points straight
+ * into the mapping: opening even a huge frame is O(1), with the pages
+ * faulted in lazily as the texture upload first touches them.
+ */
+
+enum raw_format {
+  RAW_FARBFELD, /* 16-bit big-endian RGBA */
+  RAW_PPM,      /* P6, packed 8- or 16-bit RGB */
+  RAW_PAM,      /* P7, 8-bit RGB or RGBA */
+  RAW_QOI,
+};
+
+struct private {
+  int fd;
+  const unsigned char *data;
+  size_t len;
+  enum raw_format format;
+  int width;
+  int height;
+  int maxval; /* netpbm only */
+  int depth;  /* PAM channels */
+  size_t pixel_offset; /* where in the file the pixel data starts */
+};
+
+static void free_private(void *raw_private)
+{
+  if (!raw_private) {
+    return;
+  }
+  struct private *private = raw_private;
+  if (private->fd >= 0) {
+    munmap((void*)private->data, private->len);
+    close(private->fd);
+  }
+  free(private);
+}
+
+static uint32_t read_be32(const unsigned char *data)
+{
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16
+       | (uint32_t)data[2] << 8 | (uint32_t)data[3];
+}
+
+/* Read the next decimal token of a netpbm header, skipping whitespace and
+ * '#' comments. Returns -1 if the next token isn't a number. */
+static int pnm_int(const unsigned char *data, size_t len, size_t *pos)
+{
+  while (*pos < len) {
+    if (data[*pos] == '#') {
+      while (*pos < len && data[*pos] != '\n') {
+        ++*pos;
+      }
+    } else if (isspace(data[*pos])) {
+      ++*pos;
+    } else {
+      break;
+    }
+  }
+  if (*pos >= len || !isdigit(data[*pos])) {
+    return -1;
+  }
+  int value = 0;
+  while (*pos < len && isdigit(data[*pos])) {
+    value = value * 10 + (data[*pos] - '0');
+    ++*pos;
+  }
+  return value;
+}
+
+static bool parse_ppm(struct private *private)
+{
+  size_t pos = 2;
+  private->width = pnm_int(private->data, private->len, &pos);
+  private->height = pnm_int(private->data, private->len, &pos);
+  private->maxval = pnm_int(private->data, private->len, &pos);
+  if (private->width <= 0 || private->height <= 0
+      || private->maxval <= 0 || private->maxval > 65535
+      || pos >= private->len) {
+    return false;
+  }
+  /* a single whitespace byte separates the header from the pixels */
+  private->pixel_offset = pos + 1;
+  private->format = RAW_PPM;
+  return true;
+}
+
+static bool parse_pam(struct private *private)
+{
+  size_t pos = 2;
+  private->depth = 0;
+  private->maxval = 0;
+  while (pos < private->len) {
+    /* each header element is on its own line */
+    while (pos < private->len && isspace(private->data[pos])) {
+      ++pos;
+    }
+    const char *line = (const char*)private->data + pos;
+    const size_t left = private->len - pos;
+    if (left >= 7 && !memcmp(line, "ENDHDR\n", 7)) {
+      private->pixel_offset = pos + 7;
+      break;
+    } else if (left > 6 && !memcmp(line, "WIDTH ", 6)) {
+      pos += 6;
+      private->width = pnm_int(private->data, private->len, &pos);
+    } else if (left > 7 && !memcmp(line, "HEIGHT ", 7)) {
+      pos += 7;
+      private->height = pnm_int(private->data, private->len, &pos);
+    } else if (left > 6 && !memcmp(line, "DEPTH ", 6)) {
+      pos += 6;
+      private->depth = pnm_int(private->data, private->len, &pos);
+    } else if (left > 7 && !memcmp(line, "MAXVAL ", 7)) {
+      pos += 7;
+      private->maxval = pnm_int(private->data, private->len, &pos);
+    } else {
+      /* TUPLTYPE, or something unknown; skip the line. The depth and
+       * maxval checks below reject tuple types we can't display */
+      while (pos < private->len && private->data[pos] != '\n') {
+        ++pos;
+      }
+    }
+  }
+  if (pos >= private->len || private->width <= 0 || private->height <= 0
+      || private->maxval != 255
+      || (private->depth != 3 && private->depth != 4)) {
+    return false;
+  }
+  private->format = RAW_PAM;
+  return true;
+}
+
+static bool parse_farbfeld(struct private *private)
+{
+  if (private->len < 16) {
+    return false;
+  }
+  private->width = read_be32(private->data + 8);
+  private->height = read_be32(private->data + 12);
+  private->pixel_offset = 16;
+  private->format = RAW_FARBFELD;
+  return private->width > 0 && private->height > 0;
+}
+
+static bool parse_qoi(struct private *private)
+{
+  if (private->len < 14) {
+    return false;
+  }
+  private->width = read_be32(private->data + 4);
+  private->height = read_be32(private->data + 8);
+  private->pixel_offset = 14;
+  private->format = RAW_QOI;
+  return private->width > 0 && private->height > 0;
+}
+
+static bool decode_qoi(struct private *private, unsigned char *out)
+{
+  const unsigned char *data = private->data + private->pixel_offset;
+  const size_t len = private->len - private->pixel_offset;
+  const size_t num_pixels = (size_t)private->width * private->height;
+
+  unsigned char px[4] = { 0, 0, 0, 255 };
+  unsigned char index[64][4] = {{0}};
+  size_t pos = 0;
+  size_t run = 0;
+
+  for (size_t i = 0; i < num_pixels; ++i) {
+    if (run > 0) {
+      --run;
+    } else {
+      if (pos >= len) {
+        return false;
+      }
+      const unsigned char byte = data[pos++];
+      if (byte == 0xfe) { /* QOI_OP_RGB */
+        if (pos + 3 > len) {
+          return false;
+        }
+        memcpy(px, data + pos, 3);
+        pos += 3;
+      } else if (byte == 0xff) { /* QOI_OP_RGBA */
+        if (pos + 4 > len) {
+          return false;
+        }
+        memcpy(px, data + pos, 4);
+        pos += 4;
+      } else if (byte >> 6 == 0) { /* QOI_OP_INDEX */
+        memcpy(px, index[byte & 0x3f], 4);
+      } else if (byte >> 6 == 1) { /* QOI_OP_DIFF */
+        px[0] += ((byte >> 4) & 0x3) - 2;
+        px[1] += ((byte >> 2) & 0x3) - 2;
+        px[2] += (byte & 0x3) - 2;
+      } else if (byte >> 6 == 2) { /* QOI_OP_LUMA */
+        if (pos >= len) {
+          return false;
+        }
+        const unsigned char deltas = data[pos++];
+        const unsigned char dg = (byte & 0x3f) - 32;
+        px[0] += dg - 8 + ((deltas >> 4) & 0xf);
+        px[1] += dg;
+        px[2] += dg - 8 + (deltas & 0xf);
+      } else { /* QOI_OP_RUN */
+        run = byte & 0x3f;
+      }
+      memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64],
+          px, 4);
+    }
+    memcpy(out + 4 * i, px, 4);
+  }
+  return true;
+}
+
+static void load_image(void *raw_private, struct imv_image **image, int *frametime)
+{
+  *image = NULL;
+  *frametime = 0;
+
+  struct private *private = raw_private;
+  const size_t num_pixels = (size_t)private->width * private->height;
+  const unsigned char *pixels = private->data + private->pixel_offset;
+  const size_t available = private->len - private->pixel_offset;
+  struct imv_bitmap *bmp = NULL;
+
+  switch (private->format) {
+  case RAW_PAM:
+    if (private->depth == 4 && private->fd >= 0) {
+      if (available < 4 * num_pixels) {
+        return;
+      }
+      /* the file holds exactly the bytes an IMV_ABGR bitmap wants; point
+       * the bitmap into its own read-only mapping instead of copying */
+      void *map = mmap(NULL, private->len, PROT_READ, MAP_PRIVATE,
+          private->fd, 0);
+      if (map == MAP_FAILED) {
+        return;
+      }
+      bmp = calloc(1, sizeof *bmp);
+      bmp->width = private->width;
+      bmp->height = private->height;
+      bmp->format = IMV_ABGR;
+      bmp->data = (unsigned char*)map + private->pixel_offset;
+      bmp->map = map;
+      bmp->map_len = private->len;
+      bmp->refs = 1;
+    } else if (private->depth == 4) {
+      if (available < 4 * num_pixels) {
+        return;
+      }
+      bmp = imv_bitmap_create(private->width, private->height, IMV_ABGR);
+      memcpy(bmp->data, pixels, 4 * num_pixels);
+    } else {
+      if (available < 3 * num_pixels) {
+        return;
+      }
+      bmp = imv_bitmap_create(private->width, private->height, IMV_ABGR);
+      imv_bitmap_expand_rgb(bmp->data, pixels, num_pixels);
+    }
+    break;
+  case RAW_PPM:
+    if (private->maxval <= 255) {
+      if (available < 3 * num_pixels) {
+        return;
+      }
+      bmp = imv_bitmap_create(private->width, private->height, IMV_ABGR);
+      imv_bitmap_expand_rgb(bmp->data, pixels, num_pixels);
+    } else {
+      if (available < 6 * num_pixels) {
+        return;
+      }
+      /* 16-bit big-endian samples; the high byte is the top of the range */
+      bmp = imv_bitmap_create(private->width, private->height, IMV_ABGR);
+      for (size_t i = 0; i < num_pixels; ++i) {
+        bmp->data[4 * i + 0] = pixels[6 * i + 0];
+        bmp->data[4 * i + 1] = pixels[6 * i + 2];
+        bmp->data[4 * i + 2] = pixels[6 * i + 4];
+        bmp->data[4 * i + 3] = 0xff;
+      }
+    }
+    break;
+  case RAW_FARBFELD:
+    if (available < 8 * num_pixels) {
+      return;
+    }
+    bmp = imv_bitmap_create(private->width, private->height, IMV_ABGR);
+    for (size_t i = 0; i < num_pixels; ++i) {
+      bmp->data[4 * i + 0] = pixels[8 * i + 0];
+      bmp->data[4 * i + 1] = pixels[8 * i + 2];
+      bmp->data[4 * i + 2] = pixels[8 * i + 4];
+      bmp->data[4 * i + 3] = pixels[8 * i + 6];
+    }
+    break;
+  case RAW_QOI:
+    bmp = imv_bitmap_create(private->width, private->height, IMV_ABGR);
+    if (!decode_qoi(private, bmp->data)) {
+      imv_bitmap_unref(bmp);
+      return;
+    }
+    break;
+  }
+
+  *image = imv_image_create_from_bitmap(bmp);
+}
+
+static const struct imv_source_vtable vtable = {
+  .load_first_frame = load_image,
+  .free = free_private
+};
+
+static bool parse_header(struct private *private)
+{
+  if (private->len < 2) {
+    return false;
+  }
+  if (private->len >= 8 && !memcmp(private->data, "farbfeld", 8)) {
+    return parse_farbfeld(private);
+  }
+  if (private->len >= 4 && !memcmp(private->data, "qoif", 4)) {
+    return parse_qoi(private);
+  }
+  if (!memcmp(private->data, "P6", 2)) {
+    return parse_ppm(private);
+  }
+  if (!memcmp(private->data, "P7", 2)) {
+    return parse_pam(private);
+  }
+  return false;
+}
+
+static enum backend_result open_path(const char *path, struct imv_source **src)
+{
+  struct private private;
+
+  private.fd = open(path, O_RDONLY);
+  if (private.fd < 0) {
+    return BACKEND_BAD_PATH;
+  }
+
+  off_t len = lseek(private.fd, 0, SEEK_END);
+  if (len < 0) {
+    close(private.fd);
+    return BACKEND_BAD_PATH;
+  }
+
+  private.len = len;
+
+  private.data = mmap(NULL, private.len, PROT_READ, MAP_PRIVATE, private.fd, 0);
+  if (private.data == MAP_FAILED || !private.data) {
+    close(private.fd);
+    return BACKEND_BAD_PATH;
+  }
+
+  if (!parse_header(&private)) {
+    munmap((void*)private.data, private.len);
+    close(private.fd);
+    return BACKEND_UNSUPPORTED;
+  }
+
+  struct private *new_private = malloc(sizeof private);
+  memcpy(new_private, &private, sizeof private);
+
+  *src = imv_source_create(&vtable, new_private);
+  return BACKEND_SUCCESS;
+}
+
+static enum backend_result open_memory(void *data, size_t len, struct imv_source **src)
+{
+  struct private private;
+
+  private.fd = -1;
+  private.data = data;
+  private.len = len;
+
+  if (!parse_header(&private)) {
+    return BACKEND_UNSUPPORTED;
+  }
+
+  struct private *new_private = malloc(sizeof private);
+  memcpy(new_private, &private, sizeof private);
+
+  *src = imv_source_create(&vtable, new_private);
+  return BACKEND_SUCCESS;
+}
+
+const struct imv_backend imv_backend_raw = {
+  .name = "raw",
+  .description = "Built-in loader for uncompressed interchange formats: "
+                 "farbfeld, binary netpbm (P6/P7), and QOI.",
+  .website = "https://imv.io",
+  .license = "MIT",
+  .open_path = &open_path,
+  .open_memory = &open_memory,
+};
@@ -1,4 +1,5 @@
 #include "binds.h"
+#include "commands.h"
 #include "list.h"
 
 #include <stdbool.h>
@@ -6,7 +7,7 @@
 
 struct bind_node {
   char *key; /* input key to reach this node */
-  struct list *commands; /* commands to run for this node, or NULL if not leaf node */
+  struct list *commands; /* imv_bind_commands to run for this node, or NULL if not leaf node */
   struct list *suffixes; /* list of bind_node* suffixes, or NULL if leaf node */
 };
 
@@ -14,8 +15,28 @@ struct imv_binds {
   struct bind_node bind_tree;
   struct list *keys;
   bool aborting_sequence;
+  /* registry binds are resolved against, so each command is parsed once
+   * when bound instead of on every key press */
+  struct imv_commands *commands;
 };
 
+static struct imv_bind_command *create_bind_command(struct imv_binds *binds,
+    const char *command)
+{
+  struct imv_bind_command *cmd = malloc(sizeof *cmd);
+  cmd->text = strdup(command);
+  cmd->cache = binds->commands
+    ? imv_command_parse(binds->commands, command) : NULL;
+  return cmd;
+}
+
+static void free_bind_command(struct imv_bind_command *cmd)
+{
+  imv_command_cache_free(cmd->cache);
+  free(cmd->text);
+  free(cmd);
+}
+
 static int compare_node_key(const void* item, const void *key)
 {
   const struct bind_node *node = item;
@@ -30,6 +51,14 @@ static void init_bind_node(struct bind_node *bn)
   bn->suffixes = list_create();
 }
 
+static void destroy_commands(struct list *commands)
+{
+  for(size_t i = 0; i < commands->len; ++i) {
+    free_bind_command(commands->items[i]);
+  }
+  list_free(commands);
+}
+
 static void destroy_bind_node(struct bind_node *bn)
 {
   for(size_t i = 0; i < bn->suffixes->len; ++i) {
@@ -37,7 +66,7 @@ static void destroy_bind_node(struct bind_node *bn)
   }
   free(bn->key);
   if(bn->commands) {
-    list_deep_free(bn->commands);
+    destroy_commands(bn->commands);
   }
   list_deep_free(bn->suffixes);
 }
@@ -50,6 +79,11 @@ struct imv_binds *imv_binds_create(void)
   return binds;
 }
 
+void imv_binds_set_commands(struct imv_binds *binds, struct imv_commands *cmds)
+{
+  binds->commands = cmds;
+}
+
 void imv_binds_free(struct imv_binds *binds)
 {
   destroy_bind_node(&binds->bind_tree);
@@ -102,7 +136,7 @@ enum bind_result imv_binds_add(struct imv_binds *binds, const struct list *keys,
         break;
       } else {
         /* Otherwise we just need to append a new command to the existing bind. */
-        list_append(next_node->commands, strdup(command));
+        list_append(next_node->commands, create_bind_command(binds, command));
         result = BIND_SUCCESS;
         break;
       }
@@ -115,7 +149,7 @@ enum bind_result imv_binds_add(struct imv_binds *binds, const struct list *keys,
         result = BIND_CONFLICTS;
       } else {
         next_node->commands = list_create();
-        list_append(next_node->commands, strdup(command));
+        list_append(next_node->commands, create_bind_command(binds, command));
       }
     } else {
       /* Otherwise, move down the trie */
@@ -151,7 +185,7 @@ void imv_binds_clear_key(struct imv_binds *binds, const struct list *keys)
 
   /* Clear the commands for this node */
   if(node->commands) {
-    list_deep_free(node->commands);
+    destroy_commands(node->commands);
     node->commands = NULL;
   }
 }
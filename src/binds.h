@@ -4,8 +4,17 @@
 #include <unistd.h>
 
 struct imv_binds;
+struct imv_command_cache;
+struct imv_commands;
 struct list;
 
+/* One command attached to a bind, parsed when the bind was created so that
+ * key-repeat dispatch doesn't tokenize anything */
+struct imv_bind_command {
+  char *text; /* the raw command string */
+  struct imv_command_cache *cache; /* preparsed form, or NULL if parsing failed */
+};
+
 enum bind_result {
   BIND_SUCCESS,
   BIND_INVALID_KEYS,
@@ -19,6 +28,11 @@ struct imv_binds *imv_binds_create(void);
 /* Clean up an imv_binds instance */
 void imv_binds_free(struct imv_binds *binds);
 
+/* Provide the command registry that binds are resolved against. Binds
+ * added afterwards are preparsed; without one they fall back to parsing
+ * at dispatch time. */
+void imv_binds_set_commands(struct imv_binds *binds, struct imv_commands *cmds);
+
 /* Create a key binding */
 enum bind_result imv_binds_add(struct imv_binds *binds, const struct list *keys, const char *cmd);
 
@@ -34,7 +48,8 @@ const struct list *imv_bind_input_buffer(struct imv_binds *binds);
 /* Abort the current input key sequence */
 void imv_bind_clear_input(struct imv_binds *binds);
 
-/* Handle an input event, if a bind is triggered, return its command */
+/* Handle an input event; if a bind is triggered, return its list of
+ * imv_bind_commands */
 struct list *imv_bind_handle_event(struct imv_binds *binds, const char *event);
 
 /* Convert a string (such as from a config) to a key list */
@@ -1,22 +1,268 @@
 #include "bitmap.h"
 
+#ifdef IMV_DMABUF
+#include "dmabuf.h"
+#endif
+
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITMAP_X86_SIMD 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define BITMAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Pixel conversion kernels. Each has a portable scalar version; on x86 a
+ * SIMD variant is picked at runtime based on what the CPU supports, and on
+ * ARM the NEON variant is used when the compiler targets it. The function
+ * pointers start out at a resolver that fills them in on first use — the
+ * unsynchronised pointer store is benign, as every resolution writes the
+ * same value. */
+typedef void (*swizzle_fn)(unsigned char *dst, const unsigned char *src,
+    size_t pixels);
+
+static void swap_rb_scalar(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  for (size_t i = 0; i < pixels; ++i) {
+    const unsigned char lo = src[4 * i + 0];
+    const unsigned char hi = src[4 * i + 2];
+    dst[4 * i + 0] = hi;
+    dst[4 * i + 1] = src[4 * i + 1];
+    dst[4 * i + 2] = lo;
+    dst[4 * i + 3] = src[4 * i + 3];
+  }
+}
+
+static void expand_rgb_scalar(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  for (size_t i = 0; i < pixels; ++i) {
+    dst[4 * i + 0] = src[3 * i + 0];
+    dst[4 * i + 1] = src[3 * i + 1];
+    dst[4 * i + 2] = src[3 * i + 2];
+    dst[4 * i + 3] = 0xff;
+  }
+}
+
+#ifdef BITMAP_X86_SIMD
+
+__attribute__((target("ssse3")))
+static void swap_rb_ssse3(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  const __m128i shuffle = _mm_set_epi8(15, 12, 13, 14, 11, 8, 9, 10,
+                                       7, 4, 5, 6, 3, 0, 1, 2);
+  size_t i = 0;
+  for (; i + 4 <= pixels; i += 4) {
+    const __m128i px = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+    _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_shuffle_epi8(px, shuffle));
+  }
+  swap_rb_scalar(dst + 4 * i, src + 4 * i, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void swap_rb_avx2(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  const __m256i shuffle = _mm256_set_epi8(15, 12, 13, 14, 11, 8, 9, 10,
+                                          7, 4, 5, 6, 3, 0, 1, 2,
+                                          15, 12, 13, 14, 11, 8, 9, 10,
+                                          7, 4, 5, 6, 3, 0, 1, 2);
+  size_t i = 0;
+  for (; i + 8 <= pixels; i += 8) {
+    const __m256i px = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+    _mm256_storeu_si256((__m256i *)(dst + 4 * i),
+        _mm256_shuffle_epi8(px, shuffle));
+  }
+  swap_rb_scalar(dst + 4 * i, src + 4 * i, pixels - i);
+}
+
+__attribute__((target("ssse3")))
+static void expand_rgb_ssse3(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  /* spread the first 12 of 16 loaded bytes over 4 pixels, then set alpha */
+  const __m128i shuffle = _mm_set_epi8(-1, 11, 10, 9, -1, 8, 7, 6,
+                                       -1, 5, 4, 3, -1, 2, 1, 0);
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+  size_t i = 0;
+  /* the 16 byte load must stay within the source */
+  for (; i + 6 <= pixels; i += 4) {
+    const __m128i px = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+    _mm_storeu_si128((__m128i *)(dst + 4 * i),
+        _mm_or_si128(_mm_shuffle_epi8(px, shuffle), alpha));
+  }
+  expand_rgb_scalar(dst + 4 * i, src + 3 * i, pixels - i);
+}
+
+#endif
+
+#ifdef BITMAP_NEON
+
+static void swap_rb_neon(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    uint8x16x4_t px = vld4q_u8(src + 4 * i);
+    const uint8x16_t tmp = px.val[0];
+    px.val[0] = px.val[2];
+    px.val[2] = tmp;
+    vst4q_u8(dst + 4 * i, px);
+  }
+  swap_rb_scalar(dst + 4 * i, src + 4 * i, pixels - i);
+}
+
+static void expand_rgb_neon(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    const uint8x16x3_t rgb = vld3q_u8(src + 3 * i);
+    uint8x16x4_t px;
+    px.val[0] = rgb.val[0];
+    px.val[1] = rgb.val[1];
+    px.val[2] = rgb.val[2];
+    px.val[3] = vdupq_n_u8(0xff);
+    vst4q_u8(dst + 4 * i, px);
+  }
+  expand_rgb_scalar(dst + 4 * i, src + 3 * i, pixels - i);
+}
+
+#endif
+
+static void swap_rb_resolve(unsigned char *dst, const unsigned char *src,
+    size_t pixels);
+static void expand_rgb_resolve(unsigned char *dst, const unsigned char *src,
+    size_t pixels);
+
+static swizzle_fn swap_rb_impl = &swap_rb_resolve;
+static swizzle_fn expand_rgb_impl = &expand_rgb_resolve;
+
+static void resolve_kernels(void)
+{
+#if defined(BITMAP_X86_SIMD)
+  if (__builtin_cpu_supports("avx2")) {
+    swap_rb_impl = &swap_rb_avx2;
+    expand_rgb_impl = &expand_rgb_ssse3;
+  } else if (__builtin_cpu_supports("ssse3")) {
+    swap_rb_impl = &swap_rb_ssse3;
+    expand_rgb_impl = &expand_rgb_ssse3;
+  } else {
+    swap_rb_impl = &swap_rb_scalar;
+    expand_rgb_impl = &expand_rgb_scalar;
+  }
+#elif defined(BITMAP_NEON)
+  swap_rb_impl = &swap_rb_neon;
+  expand_rgb_impl = &expand_rgb_neon;
+#else
+  swap_rb_impl = &swap_rb_scalar;
+  expand_rgb_impl = &expand_rgb_scalar;
+#endif
+}
+
+static void swap_rb_resolve(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  resolve_kernels();
+  swap_rb_impl(dst, src, pixels);
+}
+
+static void expand_rgb_resolve(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  resolve_kernels();
+  expand_rgb_impl(dst, src, pixels);
+}
+
+void imv_bitmap_swap_rb(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  swap_rb_impl(dst, src, pixels);
+}
+
+void imv_bitmap_expand_rgb(unsigned char *dst, const unsigned char *src,
+    size_t pixels)
+{
+  expand_rgb_impl(dst, src, pixels);
+}
+
+void imv_bitmap_convert(struct imv_bitmap *bmp, enum imv_pixelformat format)
+{
+  if (bmp->format == format) {
+    return;
+  }
+  swap_rb_impl(bmp->data, bmp->data, (size_t)bmp->width * bmp->height);
+  bmp->format = format;
+}
+
+struct imv_bitmap *imv_bitmap_create(int width, int height,
+    enum imv_pixelformat format)
+{
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
+  bmp->width = width;
+  bmp->height = height;
+  bmp->format = format;
+  bmp->refs = 1;
+
+#ifdef IMV_DMABUF
+  /* the dmabuf allocator only hands out ABGR8888 buffers */
+  if (format == IMV_ABGR) {
+    bmp->dmabuf = imv_dmabuf_create(width, height);
+    if (bmp->dmabuf) {
+      bmp->data = imv_dmabuf_get_map(bmp->dmabuf);
+      return bmp;
+    }
+  }
+#endif
+
+  bmp->data = malloc((size_t)4 * width * height);
+  return bmp;
+}
 
 struct imv_bitmap *imv_bitmap_clone(struct imv_bitmap *bmp)
 {
-  struct imv_bitmap *copy = malloc(sizeof *copy);
+  struct imv_bitmap *copy = calloc(1, sizeof *copy);
   const size_t num_bytes = 4 * bmp->width * bmp->height;
   copy->width = bmp->width;
   copy->height = bmp->height;
   copy->format = bmp->format;
   copy->data = malloc(num_bytes);
+  copy->refs = 1;
   memcpy(copy->data, bmp->data, num_bytes);
   return copy;
 }
 
-void imv_bitmap_free(struct imv_bitmap *bmp)
+struct imv_bitmap *imv_bitmap_ref(struct imv_bitmap *bmp)
+{
+  __atomic_add_fetch(&bmp->refs, 1, __ATOMIC_RELAXED);
+  return bmp;
+}
+
+void imv_bitmap_unref(struct imv_bitmap *bmp)
 {
-  free(bmp->data);
-  free(bmp);
+  if (__atomic_sub_fetch(&bmp->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(bmp->profile);
+#ifdef IMV_DMABUF
+    if (bmp->dmabuf) {
+      /* data is the buffer's mapping; freeing the buffer releases it */
+      imv_dmabuf_free(bmp->dmabuf);
+      free(bmp);
+      return;
+    }
+#endif
+    if (bmp->map) {
+      /* data points into a shared cache mapping rather than the heap */
+      munmap(bmp->map, bmp->map_len);
+      free(bmp);
+      return;
+    }
+    free(bmp->data);
+    free(bmp);
+  }
 }
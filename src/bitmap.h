@@ -1,22 +1,70 @@
 #ifndef IMV_BITMAP_H
 #define IMV_BITMAP_H
 
+#include <stddef.h>
+
 enum imv_pixelformat {
   IMV_ARGB,
   IMV_ABGR,
 };
 
+struct imv_dmabuf;
+
 struct imv_bitmap {
   int width;
   int height;
   enum imv_pixelformat format;
   unsigned char *data;
+  /* when non-NULL, data is the CPU mapping of this dmabuf-backed buffer,
+   * which the canvas can import as a texture without copying the pixels.
+   * Only imv_bitmap_create makes these; zero it when building a bitmap by
+   * hand */
+  struct imv_dmabuf *dmabuf;
+  /* when non-NULL, data points into this read-only shared-memory mapping
+   * of map_len bytes, placed there by the shared decode cache; the mapping
+   * is released with the bitmap. Zero it when building a bitmap by hand */
+  void *map;
+  size_t map_len;
+  /* the image's embedded ICC profile, if the decoder found one; owned by
+   * the bitmap and freed with it. NULL means assume sRGB */
+  unsigned char *profile;
+  size_t profile_len;
+  /* reference count, owned by imv_bitmap_ref/imv_bitmap_unref. Code
+   * creating a bitmap must initialise this to 1. */
+  int refs;
 };
 
+/* Allocate an uninitialised width x height bitmap for a decoder to fill.
+ * When dmabuf support is built in and a render node cooperates, the pixels
+ * land in a dmabuf-backed buffer the canvas can display without a CPU-side
+ * copy; otherwise in plain memory. */
+struct imv_bitmap *imv_bitmap_create(int width, int height,
+    enum imv_pixelformat format);
+
 /* Copy an imv_bitmap */
 struct imv_bitmap *imv_bitmap_clone(struct imv_bitmap *bmp);
 
-/* Clean up a bitmap */
-void imv_bitmap_free(struct imv_bitmap *bmp);
+/* Swap the red and blue channels of 32-bit pixels, converting between the
+ * IMV_ARGB and IMV_ABGR byte orders. dst may equal src for an in-place
+ * conversion, but the buffers must not otherwise overlap. Uses SIMD when
+ * the CPU supports it. */
+void imv_bitmap_swap_rb(unsigned char *dst, const unsigned char *src,
+    size_t pixels);
+
+/* Expand packed 24-bit pixels to 32-bit ones with an opaque alpha channel,
+ * preserving the channel order. The buffers must not overlap. Uses SIMD
+ * when the CPU supports it. */
+void imv_bitmap_expand_rgb(unsigned char *dst, const unsigned char *src,
+    size_t pixels);
+
+/* Convert a bitmap between IMV_ARGB and IMV_ABGR in place */
+void imv_bitmap_convert(struct imv_bitmap *bmp, enum imv_pixelformat format);
+
+/* Take a new reference to a bitmap, returning it. Thread-safe. */
+struct imv_bitmap *imv_bitmap_ref(struct imv_bitmap *bmp);
+
+/* Release a reference to a bitmap, freeing it when the last reference is
+ * released. Thread-safe. */
+void imv_bitmap_unref(struct imv_bitmap *bmp);
 
 #endif
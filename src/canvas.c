@@ -3,18 +3,81 @@
 #include "image.h"
 #include "log.h"
 
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <assert.h>
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #ifdef IMV_BACKEND_LIBRSVG
 #include <librsvg/rsvg.h>
 #endif
 
+#ifdef IMV_DMABUF
+#include "dmabuf.h"
+#endif
+
+#ifdef IMV_ICC
+#include <lcms2.h>
+#endif
+
+/* Colour management bakes the image-to-display ICC transform into a 3D
+ * lookup texture once per image, on a worker thread; applying it at draw
+ * time is then a single extra texture fetch per pixel in the cms shader.
+ * 33 grid points per axis is the conventional cube size: fine enough for
+ * smooth gradients, small enough (~100KB) to build in milliseconds. */
+#define ICC_LUT_SIZE 33
+
+/* Bitmaps too large for a single texture are split into fixed-size tiles,
+ * uploaded lazily as they become visible and evicted again under a VRAM
+ * budget so a small crop of a gigapixel scan only costs what's onscreen */
+#define TILE_SIZE 1024
+#define TILE_VRAM_BUDGET ((size_t)256 * 1024 * 1024)
+
+struct tile {
+  GLuint texture; /* 0 until the tile has been uploaded */
+  int x, y;       /* position of the tile within the bitmap, in pixels */
+  int width, height;
+  uint64_t last_used; /* value of draw_count when last drawn */
+};
+
+/* Textures for the gallery's thumbnails, cached per bitmap and recycled
+ * least-recently-drawn first */
+#define THUMB_CACHE_ENTRIES 128
+
+struct thumb_tex {
+  const struct imv_bitmap *bitmap; /* NULL while the slot is empty */
+  GLuint texture;
+  int width, height;
+  uint64_t last_used;
+};
+
+/* Laid-out lines of text, cached so strings that don't change between frames
+ * (the overlay, the window title) skip Pango's layout pass on redraw */
+#define TEXT_CACHE_ENTRIES 8
+
+struct text_line {
+  PangoLayout *layout; /* NULL while the slot is empty */
+  char text[1024];
+  uint64_t last_used;
+};
+
+struct program {
+  GLuint id; /* 0 if the program isn't available */
+  GLint u_rect;
+  GLint u_viewport;
+  GLint u_texsize;
+  GLint u_texel;
+};
+
 struct imv_canvas {
   cairo_surface_t *surface;
   cairo_t *cairo;
@@ -22,15 +85,483 @@ struct imv_canvas {
   GLuint texture;
   int width;
   int height;
+  /* dimensions of the backing surface allocation; grows to the largest
+   * size seen and never shrinks, so an interactive resize doesn't
+   * reallocate a multi-megabyte surface per event */
+  struct {
+    int width;
+    int height;
+  } pool;
   struct {
     struct imv_bitmap *bitmap;
     GLuint texture;
+    /* double-buffered pixel buffer objects used to stream bitmap uploads,
+     * so the driver can DMA one while we fill the other */
+    GLuint pbo[2];
+    int pbo_index;
+    bool pbo_checked;
+    bool pbo_supported;
+    /* 2D copy of cache.bitmap with a generated mip chain, only built when
+     * the mipmap downscaling method is in use */
+    GLuint mip_texture;
+    struct imv_bitmap *mip_bitmap;
   } cache;
+  /* zero-copy texture for dmabuf-backed bitmaps, imported through the
+   * window's EGL display. import is NULL when the window system can't */
+  struct {
+    imv_canvas_dmabuf_import_fn import;
+    void *import_data;
+    GLuint texture;
+    /* which buffer the texture was imported from; set even when the
+     * import failed, so a failing buffer isn't retried every frame */
+    const struct imv_dmabuf *source;
+  } dmabuf;
+  struct {
+    struct tile *tiles;
+    int num_tiles;
+    uint64_t draw_count;
+    size_t vram_used;
+    /* set instead of cache.bitmap when the tiles span the full-resolution
+     * image behind a region provider, not a decoded bitmap */
+    const struct imv_image *image;
+  } tiled;
+  struct {
+    struct thumb_tex entries[THUMB_CACHE_ENTRIES];
+    uint64_t use_count;
+  } thumb_cache;
+  struct {
+    struct text_line entries[TEXT_CACHE_ENTRIES];
+    uint64_t use_count;
+  } text_cache;
+  /* tiny repeating tile for the chequered background, drawn straight from
+   * GL rather than rasterized into the canvas every frame */
+  struct {
+    GLuint texture;
+  } checkers;
+#ifdef IMV_BACKEND_LIBRSVG
+  /* the last SVG rasterization, reused for every draw until the scale
+   * changes, so panning costs the same as panning a bitmap */
+  struct {
+    RsvgHandle *svg;
+    double scale;
+    struct imv_bitmap *bitmap;
+    /* a scale change mid-zoom doesn't re-rasterize immediately; the stale
+     * raster is rescaled and the real render deferred until things settle */
+    bool pending;
+    double pending_scale;
+    double pending_since_ms;
+  } svg_cache;
+#endif
+  /* dirty-rectangle tracking for the cairo surface, so a small overlay
+   * change uploads a few rows instead of the whole canvas every frame.
+   * Rectangles are half-open; x0 == x1 means empty. */
+  /* time spent uploading the most recent image's texture(s), for the
+   * performance HUD */
+  double last_upload_ms;
+  struct {
+    /* area changed since the last upload to the GL texture */
+    int x0, y0, x1, y1;
+    /* area painted since the last clear, i.e. the current surface content */
+    int px0, py0, px1, py1;
+    bool full;          /* treat the whole surface as changed */
+    bool texture_valid; /* the texture holds the previously drawn surface */
+  } damage;
+  struct {
+    enum canvas_renderer requested;
+    bool tried;
+    bool active;
+    GLuint vbo;
+    struct program base;    /* rectangle texture, plain sampling */
+    struct program mip;     /* 2D texture sampled through its mip chain */
+    struct program lanczos; /* rectangle texture, lanczos2 minification */
+    struct program cms;     /* rectangle texture through the icc 3D LUT */
+    bool mip_tried;
+    bool lanczos_tried;
+    bool cms_tried;
+  } shader;
+  /* colour management state; the LUT for the current image's embedded
+   * profile, and the worker building the next one */
+  struct {
+    const struct imv_bitmap *bitmap; /* whose profile lut_texture holds */
+    GLuint lut_texture;
+    bool lut_valid; /* false when bitmap's profile failed to parse */
+    pthread_t thread;
+    bool thread_running;
+    char *display_profile; /* target profile path; NULL means sRGB */
+    /* worker results; mutex guards samples_ready, the rest is handed
+     * over once it's set */
+    pthread_mutex_t mutex;
+    bool samples_ready;
+    unsigned char *samples; /* ICC_LUT_SIZE^3 RGB triples, NULL on failure */
+    const struct imv_bitmap *samples_bitmap;
+  } icc;
+};
+
+/* The shader renderer draws the same unit quad for everything: the vertex
+ * shader positions it from u_rect (in window pixels) and scales texture
+ * coordinates by u_texsize, since rectangle textures are sampled in texels.
+ */
+static const char *vertex_source =
+  "#version 120\n"
+  "attribute vec2 a_vertex;\n"
+  "uniform vec4 u_rect;\n"
+  "uniform vec2 u_viewport;\n"
+  "uniform vec2 u_texsize;\n"
+  "varying vec2 v_texcoord;\n"
+  "void main() {\n"
+  "  vec2 pixel = u_rect.xy + a_vertex * u_rect.zw;\n"
+  "  gl_Position = vec4(pixel.x / u_viewport.x * 2.0 - 1.0,\n"
+  "                     1.0 - pixel.y / u_viewport.y * 2.0, 0.0, 1.0);\n"
+  "  v_texcoord = a_vertex * u_texsize;\n"
+  "}\n";
+
+static const char *fragment_source =
+  "#version 120\n"
+  "#extension GL_ARB_texture_rectangle : require\n"
+  "uniform sampler2DRect u_texture;\n"
+  "varying vec2 v_texcoord;\n"
+  "void main() {\n"
+  "  gl_FragColor = texture2DRect(u_texture, v_texcoord);\n"
+  "}\n";
+
+/* Used with a mipmapped 2D texture and u_texsize of 1x1, so v_texcoord is
+ * normalised and the driver picks mip levels from the derivatives */
+static const char *fragment_2d_source =
+  "#version 120\n"
+  "uniform sampler2D u_texture;\n"
+  "varying vec2 v_texcoord;\n"
+  "void main() {\n"
+  "  gl_FragColor = texture2D(u_texture, v_texcoord);\n"
+  "}\n";
+
+/* 4x4-tap lanczos2 filter with taps spaced one destination pixel apart
+ * (u_texel source texels), windowed in destination space */
+static const char *fragment_lanczos_source =
+  "#version 120\n"
+  "#extension GL_ARB_texture_rectangle : require\n"
+  "uniform sampler2DRect u_texture;\n"
+  "uniform vec2 u_texel;\n"
+  "varying vec2 v_texcoord;\n"
+  "float lanczos2(float x) {\n"
+  "  x = abs(x);\n"
+  "  if (x < 0.0001) return 1.0;\n"
+  "  if (x >= 2.0) return 0.0;\n"
+  "  float px = 3.14159265 * x;\n"
+  "  return 2.0 * sin(px) * sin(px * 0.5) / (px * px);\n"
+  "}\n"
+  "void main() {\n"
+  "  vec4 sum = vec4(0.0);\n"
+  "  float total = 0.0;\n"
+  "  for (int y = 0; y < 4; ++y) {\n"
+  "    for (int x = 0; x < 4; ++x) {\n"
+  "      vec2 offset = vec2(float(x), float(y)) - 1.5;\n"
+  "      float weight = lanczos2(offset.x) * lanczos2(offset.y);\n"
+  "      sum += weight * texture2DRect(u_texture, v_texcoord + offset * u_texel);\n"
+  "      total += weight;\n"
+  "    }\n"
+  "  }\n"
+  "  gl_FragColor = sum / total;\n"
+  "}\n";
+
+#ifdef IMV_ICC
+/* Plain sampling, then the colour transform: one fetch from the 3D LUT,
+ * with coordinates squeezed so 0 and 1 land on the centres of the first
+ * and last grid points (scale (N-1)/N, offset 0.5/N for N=33) */
+static const char *fragment_cms_source =
+  "#version 120\n"
+  "#extension GL_ARB_texture_rectangle : require\n"
+  "uniform sampler2DRect u_texture;\n"
+  "uniform sampler3D u_lut;\n"
+  "varying vec2 v_texcoord;\n"
+  "void main() {\n"
+  "  vec4 color = texture2DRect(u_texture, v_texcoord);\n"
+  "  color.rgb = texture3D(u_lut, color.rgb * 0.969697 + 0.0151515).rgb;\n"
+  "  gl_FragColor = color;\n"
+  "}\n";
+#endif
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+
+  GLint ok = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char info[1024];
+    glGetShaderInfoLog(shader, sizeof info, NULL, info);
+    imv_log(IMV_WARNING, "canvas: shader failed to compile: %s\n", info);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+static bool build_program(const char *frag_source, struct program *out)
+{
+  GLuint vert = compile_shader(GL_VERTEX_SHADER, vertex_source);
+  if (!vert) {
+    return false;
+  }
+  GLuint frag = compile_shader(GL_FRAGMENT_SHADER, frag_source);
+  if (!frag) {
+    glDeleteShader(vert);
+    return false;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vert);
+  glAttachShader(program, frag);
+  glBindAttribLocation(program, 0, "a_vertex");
+  glLinkProgram(program);
+  glDeleteShader(vert);
+  glDeleteShader(frag);
+
+  GLint ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    char info[1024];
+    glGetProgramInfoLog(program, sizeof info, NULL, info);
+    imv_log(IMV_WARNING, "canvas: shader program failed to link: %s\n", info);
+    glDeleteProgram(program);
+    return false;
+  }
+
+  out->id = program;
+  out->u_rect = glGetUniformLocation(program, "u_rect");
+  out->u_viewport = glGetUniformLocation(program, "u_viewport");
+  out->u_texsize = glGetUniformLocation(program, "u_texsize");
+  out->u_texel = glGetUniformLocation(program, "u_texel");
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "u_texture"), 0);
+  /* a no-op (location -1) for programs without a LUT */
+  glUniform1i(glGetUniformLocation(program, "u_lut"), 1);
+  glUseProgram(0);
+  return true;
+}
+
+static bool shader_init(struct imv_canvas *canvas)
+{
+  if (!build_program(fragment_source, &canvas->shader.base)) {
+    return false;
+  }
+
+  static const GLfloat quad[8] = {
+    0.0f, 0.0f,
+    1.0f, 0.0f,
+    1.0f, 1.0f,
+    0.0f, 1.0f,
+  };
+  glGenBuffers(1, &canvas->shader.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, canvas->shader.vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof quad, quad, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return true;
+}
+
+static bool use_shader(struct imv_canvas *canvas)
+{
+  if (canvas->shader.requested == RENDERER_LEGACY) {
+    return false;
+  }
+  if (!canvas->shader.tried) {
+    canvas->shader.tried = true;
+    canvas->shader.active = shader_init(canvas);
+    if (!canvas->shader.active) {
+      imv_log(IMV_DEBUG, "canvas: falling back to legacy renderer\n");
+    }
+  }
+  return canvas->shader.active;
+}
+
+/* Draw the given texture as a quad covering x,y->x+width,y+height in window
+ * pixels, using the given shader program. texel_x/texel_y feed u_texel for
+ * programs that have it (the lanczos filter's tap spacing). */
+static void shader_draw_quad(struct imv_canvas *canvas,
+                             const struct program *prog,
+                             GLenum target, GLuint texture,
+                             float x, float y, float width, float height,
+                             float tex_width, float tex_height,
+                             float texel_x, float texel_y)
+{
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glUseProgram(prog->id);
+  glUniform4f(prog->u_rect, x, y, width, height);
+  glUniform2f(prog->u_viewport, viewport[2], viewport[3]);
+  glUniform2f(prog->u_texsize, tex_width, tex_height);
+  if (prog->u_texel >= 0) {
+    glUniform2f(prog->u_texel, texel_x, texel_y);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(target, texture);
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glBindBuffer(GL_ARRAY_BUFFER, canvas->shader.vbo);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  glDisableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glDisable(GL_BLEND);
+  glBindTexture(target, 0);
+  glUseProgram(0);
+}
+
+static void destroy_tiles(struct imv_canvas *canvas);
+
+#ifdef IMV_ICC
+
+struct icc_build {
+  struct imv_canvas *canvas;
+  const struct imv_bitmap *key;
+  unsigned char *profile;
+  size_t profile_len;
+  char *display_profile;
 };
 
+/* Bake the image-to-display transform into a grid of RGB samples. Runs on
+ * its own thread; a 50MP image decodes and draws unmanaged while this
+ * works, and the corrected colours swap in a frame later. */
+static void *icc_build_thread(void *raw)
+{
+  struct icc_build *build = raw;
+  unsigned char *samples = NULL;
+
+  cmsHPROFILE src = cmsOpenProfileFromMem(build->profile, build->profile_len);
+  cmsHPROFILE dst = build->display_profile
+    ? cmsOpenProfileFromFile(build->display_profile, "r")
+    : cmsCreate_sRGBProfile();
+  if (!dst && build->display_profile) {
+    imv_log(IMV_WARNING, "icc: unable to open display profile %s\n",
+        build->display_profile);
+  }
+
+  cmsHTRANSFORM transform = NULL;
+  if (src && dst) {
+    transform = cmsCreateTransform(src, TYPE_RGB_8, dst, TYPE_RGB_8,
+        INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_BLACKPOINTCOMPENSATION);
+  }
+
+  if (transform) {
+    /* an identity grid, red fastest to match the LUT texture layout */
+    const size_t num_samples = ICC_LUT_SIZE * ICC_LUT_SIZE * ICC_LUT_SIZE;
+    samples = malloc(num_samples * 3);
+    unsigned char *out = samples;
+    for (int b = 0; b < ICC_LUT_SIZE; ++b) {
+      for (int g = 0; g < ICC_LUT_SIZE; ++g) {
+        for (int r = 0; r < ICC_LUT_SIZE; ++r) {
+          out[0] = r * 255 / (ICC_LUT_SIZE - 1);
+          out[1] = g * 255 / (ICC_LUT_SIZE - 1);
+          out[2] = b * 255 / (ICC_LUT_SIZE - 1);
+          out += 3;
+        }
+      }
+    }
+    cmsDoTransform(transform, samples, samples, num_samples);
+    cmsDeleteTransform(transform);
+  }
+
+  if (src) {
+    cmsCloseProfile(src);
+  }
+  if (dst) {
+    cmsCloseProfile(dst);
+  }
+
+  struct imv_canvas *canvas = build->canvas;
+  pthread_mutex_lock(&canvas->icc.mutex);
+  free(canvas->icc.samples);
+  canvas->icc.samples = samples;
+  canvas->icc.samples_bitmap = build->key;
+  canvas->icc.samples_ready = true;
+  pthread_mutex_unlock(&canvas->icc.mutex);
+
+  free(build->profile);
+  free(build->display_profile);
+  free(build);
+  return NULL;
+}
+
+/* The LUT texture for the given bitmap's embedded profile, or 0 while it's
+ * still building (the image draws unmanaged until then), failed to build,
+ * or the bitmap has no profile. Kicks off builds as needed. */
+static GLuint icc_lut(struct imv_canvas *canvas, const struct imv_bitmap *bitmap)
+{
+  if (!bitmap->profile) {
+    return 0;
+  }
+  if (canvas->icc.bitmap == bitmap) {
+    return canvas->icc.lut_valid ? canvas->icc.lut_texture : 0;
+  }
+
+  pthread_mutex_lock(&canvas->icc.mutex);
+  const bool ready = canvas->icc.samples_ready;
+  pthread_mutex_unlock(&canvas->icc.mutex);
+
+  if (ready) {
+    pthread_join(canvas->icc.thread, NULL);
+    canvas->icc.thread_running = false;
+    canvas->icc.samples_ready = false;
+    canvas->icc.bitmap = canvas->icc.samples_bitmap;
+    canvas->icc.lut_valid = false;
+    if (canvas->icc.samples) {
+      if (!canvas->icc.lut_texture) {
+        glGenTextures(1, &canvas->icc.lut_texture);
+      }
+      glBindTexture(GL_TEXTURE_3D, canvas->icc.lut_texture);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+      glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB8,
+          ICC_LUT_SIZE, ICC_LUT_SIZE, ICC_LUT_SIZE,
+          0, GL_RGB, GL_UNSIGNED_BYTE, canvas->icc.samples);
+      glBindTexture(GL_TEXTURE_3D, 0);
+      free(canvas->icc.samples);
+      canvas->icc.samples = NULL;
+      canvas->icc.lut_valid = true;
+    }
+    if (canvas->icc.bitmap == bitmap) {
+      return canvas->icc.lut_valid ? canvas->icc.lut_texture : 0;
+    }
+  }
+
+  if (!canvas->icc.thread_running) {
+    struct icc_build *build = calloc(1, sizeof *build);
+    build->canvas = canvas;
+    build->key = bitmap;
+    build->profile = malloc(bitmap->profile_len);
+    memcpy(build->profile, bitmap->profile, bitmap->profile_len);
+    build->profile_len = bitmap->profile_len;
+    if (canvas->icc.display_profile) {
+      build->display_profile = strdup(canvas->icc.display_profile);
+    }
+    if (pthread_create(&canvas->icc.thread, NULL, &icc_build_thread, build) == 0) {
+      canvas->icc.thread_running = true;
+    } else {
+      free(build->profile);
+      free(build->display_profile);
+      free(build);
+    }
+  }
+  return 0;
+}
+
+#endif /* IMV_ICC */
+
 struct imv_canvas *imv_canvas_create(int width, int height)
 {
   struct imv_canvas *canvas = calloc(1, sizeof *canvas);
+  pthread_mutex_init(&canvas->icc.mutex, NULL);
   canvas->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
                                                width, height);
   assert(canvas->surface);
@@ -45,15 +576,75 @@ struct imv_canvas *imv_canvas_create(int width, int height)
 
   canvas->width = width;
   canvas->height = height;
+  canvas->pool.width = width;
+  canvas->pool.height = height;
 
   return canvas;
 }
 
+static double canvas_time_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec * 1e-6;
+}
+
+double imv_canvas_get_upload_ms(const struct imv_canvas *canvas)
+{
+  return canvas->last_upload_ms;
+}
+
+/* Grow the rectangle at x0..y1 to cover the one at ax0..ay1 */
+static void rect_union(int *x0, int *y0, int *x1, int *y1,
+    int ax0, int ay0, int ax1, int ay1)
+{
+  if (ax0 >= ax1 || ay0 >= ay1) {
+    return;
+  }
+  if (*x0 >= *x1 || *y0 >= *y1) {
+    *x0 = ax0;
+    *y0 = ay0;
+    *x1 = ax1;
+    *y1 = ay1;
+    return;
+  }
+  if (ax0 < *x0) *x0 = ax0;
+  if (ay0 < *y0) *y0 = ay0;
+  if (ax1 > *x1) *x1 = ax1;
+  if (ay1 > *y1) *y1 = ay1;
+}
+
+/* Record that the given area of the cairo surface has been painted */
+static void damage_add(struct imv_canvas *canvas, int x, int y, int width, int height)
+{
+  int x1 = x + width;
+  int y1 = y + height;
+  if (x < 0) x = 0;
+  if (y < 0) y = 0;
+  if (x1 > canvas->width) x1 = canvas->width;
+  if (y1 > canvas->height) y1 = canvas->height;
+  rect_union(&canvas->damage.x0, &canvas->damage.y0,
+      &canvas->damage.x1, &canvas->damage.y1, x, y, x1, y1);
+  rect_union(&canvas->damage.px0, &canvas->damage.py0,
+      &canvas->damage.px1, &canvas->damage.py1, x, y, x1, y1);
+}
+
+static void invalidate_text_cache(struct imv_canvas *canvas)
+{
+  for (int i = 0; i < TEXT_CACHE_ENTRIES; ++i) {
+    if (canvas->text_cache.entries[i].layout) {
+      g_object_unref(canvas->text_cache.entries[i].layout);
+      canvas->text_cache.entries[i].layout = NULL;
+    }
+  }
+}
+
 void imv_canvas_free(struct imv_canvas *canvas)
 {
   if (!canvas) {
     return;
   }
+  invalidate_text_cache(canvas);
   pango_font_description_free(canvas->font);
   canvas->font = NULL;
   cairo_destroy(canvas->cairo);
@@ -64,26 +655,158 @@ void imv_canvas_free(struct imv_canvas *canvas)
   if (canvas->cache.texture) {
     glDeleteTextures(1, &canvas->cache.texture);
   }
+  if (canvas->cache.pbo[0]) {
+    glDeleteBuffers(2, canvas->cache.pbo);
+  }
+  if (canvas->shader.base.id) {
+    glDeleteProgram(canvas->shader.base.id);
+    glDeleteBuffers(1, &canvas->shader.vbo);
+  }
+  if (canvas->shader.mip.id) {
+    glDeleteProgram(canvas->shader.mip.id);
+  }
+  if (canvas->shader.lanczos.id) {
+    glDeleteProgram(canvas->shader.lanczos.id);
+  }
+  if (canvas->shader.cms.id) {
+    glDeleteProgram(canvas->shader.cms.id);
+  }
+  if (canvas->icc.thread_running) {
+    pthread_join(canvas->icc.thread, NULL);
+  }
+  if (canvas->icc.lut_texture) {
+    glDeleteTextures(1, &canvas->icc.lut_texture);
+  }
+  free(canvas->icc.samples);
+  free(canvas->icc.display_profile);
+  pthread_mutex_destroy(&canvas->icc.mutex);
+  if (canvas->cache.mip_texture) {
+    glDeleteTextures(1, &canvas->cache.mip_texture);
+  }
+  if (canvas->dmabuf.texture) {
+    glDeleteTextures(1, &canvas->dmabuf.texture);
+  }
+  for (int i = 0; i < THUMB_CACHE_ENTRIES; ++i) {
+    if (canvas->thumb_cache.entries[i].texture) {
+      glDeleteTextures(1, &canvas->thumb_cache.entries[i].texture);
+    }
+  }
+  if (canvas->checkers.texture) {
+    glDeleteTextures(1, &canvas->checkers.texture);
+  }
+  destroy_tiles(canvas);
+#ifdef IMV_BACKEND_LIBRSVG
+  if (canvas->svg_cache.bitmap) {
+    imv_bitmap_unref(canvas->svg_cache.bitmap);
+  }
+#endif
   free(canvas);
 }
 
+void imv_canvas_drop_caches(struct imv_canvas *canvas)
+{
+  if (canvas->cache.texture) {
+    glDeleteTextures(1, &canvas->cache.texture);
+    canvas->cache.texture = 0;
+  }
+  canvas->cache.bitmap = NULL;
+  if (canvas->cache.mip_texture) {
+    glDeleteTextures(1, &canvas->cache.mip_texture);
+    canvas->cache.mip_texture = 0;
+  }
+  canvas->cache.mip_bitmap = NULL;
+  if (canvas->dmabuf.texture) {
+    glDeleteTextures(1, &canvas->dmabuf.texture);
+    canvas->dmabuf.texture = 0;
+  }
+  canvas->dmabuf.source = NULL;
+  destroy_tiles(canvas);
+  for (int i = 0; i < THUMB_CACHE_ENTRIES; ++i) {
+    struct thumb_tex *entry = &canvas->thumb_cache.entries[i];
+    if (entry->texture) {
+      glDeleteTextures(1, &entry->texture);
+    }
+    memset(entry, 0, sizeof *entry);
+  }
+#ifdef IMV_BACKEND_LIBRSVG
+  if (canvas->svg_cache.bitmap) {
+    imv_bitmap_unref(canvas->svg_cache.bitmap);
+    canvas->svg_cache.bitmap = NULL;
+    canvas->svg_cache.svg = NULL;
+    canvas->svg_cache.pending = false;
+  }
+#endif
+  /* shrink the canvas texture to nothing; the next draw re-uploads it */
+  glBindTexture(GL_TEXTURE_RECTANGLE, canvas->texture);
+  glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, 0, 0,
+               0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+  glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+  canvas->damage.texture_valid = false;
+  canvas->damage.full = true;
+}
+
+void imv_canvas_set_renderer(struct imv_canvas *canvas, enum canvas_renderer renderer)
+{
+  canvas->shader.requested = renderer;
+}
+
+void imv_canvas_set_dmabuf_importer(struct imv_canvas *canvas,
+    imv_canvas_dmabuf_import_fn import, void *data)
+{
+  canvas->dmabuf.import = import;
+  canvas->dmabuf.import_data = data;
+}
+
+void imv_canvas_set_display_profile(struct imv_canvas *canvas, const char *path)
+{
+  free(canvas->icc.display_profile);
+  canvas->icc.display_profile = path ? strdup(path) : NULL;
+}
+
 void imv_canvas_resize(struct imv_canvas *canvas, int width, int height)
 {
-  cairo_destroy(canvas->cairo);
-  cairo_surface_destroy(canvas->surface);
+  if (width > canvas->pool.width || height > canvas->pool.height) {
+    if (width > canvas->pool.width) {
+      canvas->pool.width = width;
+    }
+    if (height > canvas->pool.height) {
+      canvas->pool.height = height;
+    }
+    cairo_destroy(canvas->cairo);
+    cairo_surface_destroy(canvas->surface);
+    canvas->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                 canvas->pool.width,
+                                                 canvas->pool.height);
+    assert(canvas->surface);
+    canvas->cairo = cairo_create(canvas->surface);
+    assert(canvas->cairo);
+  }
 
   canvas->width = width;
   canvas->height = height;
 
-  canvas->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-                                               canvas->width, canvas->height);
-  assert(canvas->surface);
-  canvas->cairo = cairo_create(canvas->surface);
-  assert(canvas->cairo);
+  /* confine painting to the logical size; the rest of the pooled
+   * allocation is never drawn to or uploaded */
+  cairo_reset_clip(canvas->cairo);
+  cairo_rectangle(canvas->cairo, 0, 0, width, height);
+  cairo_clip(canvas->cairo);
+
+  canvas->damage.full = true;
+  canvas->damage.texture_valid = false;
+  canvas->damage.px0 = canvas->damage.px1 = 0;
+  canvas->damage.py0 = canvas->damage.py1 = 0;
 }
 
 void imv_canvas_clear(struct imv_canvas *canvas)
 {
+  /* whatever was painted before is now erased, so it's changed too */
+  rect_union(&canvas->damage.x0, &canvas->damage.y0,
+      &canvas->damage.x1, &canvas->damage.y1,
+      canvas->damage.px0, canvas->damage.py0,
+      canvas->damage.px1, canvas->damage.py1);
+  canvas->damage.px0 = canvas->damage.px1 = 0;
+  canvas->damage.py0 = canvas->damage.py1 = 0;
+
   cairo_save(canvas->cairo);
   cairo_set_source_rgba(canvas->cairo, 0, 0, 0, 0);
   cairo_set_operator(canvas->cairo, CAIRO_OPERATOR_SOURCE);
@@ -100,16 +823,19 @@ void imv_canvas_fill_rectangle(struct imv_canvas *canvas, int x, int y, int widt
 {
   cairo_rectangle(canvas->cairo, x, y, width, height);
   cairo_fill(canvas->cairo);
+  damage_add(canvas, x, y, width, height);
 }
 
 void imv_canvas_fill(struct imv_canvas *canvas)
 {
   cairo_rectangle(canvas->cairo, 0, 0, canvas->width, canvas->height);
   cairo_fill(canvas->cairo);
+  damage_add(canvas, 0, 0, canvas->width, canvas->height);
 }
 
 void imv_canvas_fill_checkers(struct imv_canvas *canvas, int size)
 {
+  damage_add(canvas, 0, 0, canvas->width, canvas->height);
   for (int x = 0; x < canvas->width; x += size) {
     for (int y = 0; y < canvas->height; y += size) {
       float color = ((x/size + y/size) % 2 == 0) ? 0.25 : 0.75;
@@ -120,11 +846,76 @@ void imv_canvas_fill_checkers(struct imv_canvas *canvas, int size)
   }
 }
 
+void imv_canvas_draw_checkers(struct imv_canvas *canvas, int size)
+{
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  if (!canvas->checkers.texture) {
+    /* one 2x2 repeating tile; texture coordinates scale it up to
+     * size-pixel checks */
+    static const unsigned char greys[4] = { 64, 191, 191, 64 };
+    unsigned char pixels[4 * 4];
+    for (int i = 0; i < 4; ++i) {
+      pixels[4 * i + 0] = greys[i];
+      pixels[4 * i + 1] = greys[i];
+      pixels[4 * i + 2] = greys[i];
+      pixels[4 * i + 3] = 0xff;
+    }
+    glGenTextures(1, &canvas->checkers.texture);
+    glBindTexture(GL_TEXTURE_2D, canvas->checkers.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA,
+        GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  /* texture coordinates count repeats of the 2x2 tile */
+  const float repeat_x = (float)viewport[2] / (size * 2);
+  const float repeat_y = (float)viewport[3] / (size * 2);
+
+  if (use_shader(canvas)) {
+    if (!canvas->shader.mip_tried) {
+      canvas->shader.mip_tried = true;
+      build_program(fragment_2d_source, &canvas->shader.mip);
+    }
+    if (canvas->shader.mip.id) {
+      shader_draw_quad(canvas, &canvas->shader.mip,
+          GL_TEXTURE_2D, canvas->checkers.texture,
+          0, 0, viewport[2], viewport[3],
+          repeat_x, repeat_y, 0, 0);
+      return;
+    }
+  }
+
+  glPushMatrix();
+  glOrtho(0.0, 1.0, 1.0, 0.0, 0.0, 10.0);
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, canvas->checkers.texture);
+
+  glBegin(GL_TRIANGLE_FAN);
+  glTexCoord2f(0,        0);        glVertex2i(0, 0);
+  glTexCoord2f(repeat_x, 0);        glVertex2i(1, 0);
+  glTexCoord2f(repeat_x, repeat_y); glVertex2i(1, 1);
+  glTexCoord2f(0,        repeat_y); glVertex2i(0, 1);
+  glEnd();
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDisable(GL_TEXTURE_2D);
+  glPopMatrix();
+}
+
 void imv_canvas_font(struct imv_canvas *canvas, const char *name, int size)
 {
   pango_font_description_set_family(canvas->font, name);
   pango_font_description_set_weight(canvas->font, PANGO_WEIGHT_NORMAL);
   pango_font_description_set_absolute_size(canvas->font, size * PANGO_SCALE);
+  /* cached layouts hold the old font */
+  invalidate_text_cache(canvas);
 }
 
 int imv_canvas_printf(struct imv_canvas *canvas, int x, int y, const char *fmt, ...)
@@ -133,40 +924,125 @@ int imv_canvas_printf(struct imv_canvas *canvas, int x, int y, const char *fmt,
   va_list args;
   va_start(args, fmt);
   vsnprintf(line, sizeof line, fmt, args);
+  va_end(args);
+
+  struct text_line *entry = NULL;
+  for (int i = 0; i < TEXT_CACHE_ENTRIES; ++i) {
+    struct text_line *candidate = &canvas->text_cache.entries[i];
+    if (candidate->layout && !strcmp(candidate->text, line)) {
+      entry = candidate;
+      break;
+    }
+  }
 
-  PangoLayout *layout = pango_cairo_create_layout(canvas->cairo);
-  pango_layout_set_font_description(layout, canvas->font);
-  pango_layout_set_text(layout, line, -1);
+  if (!entry) {
+    /* lay the line out once, recycling the least recently drawn slot */
+    for (int i = 0; i < TEXT_CACHE_ENTRIES; ++i) {
+      struct text_line *candidate = &canvas->text_cache.entries[i];
+      if (!candidate->layout) {
+        entry = candidate;
+        break;
+      }
+      if (!entry || candidate->last_used < entry->last_used) {
+        entry = candidate;
+      }
+    }
+    if (!entry->layout) {
+      entry->layout = pango_cairo_create_layout(canvas->cairo);
+    }
+    pango_layout_set_font_description(entry->layout, canvas->font);
+    pango_layout_set_text(entry->layout, line, -1);
+    snprintf(entry->text, sizeof entry->text, "%s", line);
+  }
+  entry->last_used = ++canvas->text_cache.use_count;
 
   cairo_move_to(canvas->cairo, x, y);
-  pango_cairo_show_layout(canvas->cairo, layout);
+  /* the cairo context changes when the canvas is resized */
+  pango_cairo_update_layout(canvas->cairo, entry->layout);
+  pango_cairo_show_layout(canvas->cairo, entry->layout);
 
   PangoRectangle extents;
-  pango_layout_get_pixel_extents(layout, NULL, &extents);
+  pango_layout_get_pixel_extents(entry->layout, NULL, &extents);
 
-  g_object_unref(layout);
+  damage_add(canvas, x + extents.x, y + extents.y, extents.width, extents.height);
 
-  va_end(args);
   return extents.width;
 }
 
+/* Upload the parts of the cairo surface that changed since the last draw,
+ * leaving the canvas texture bound */
+static void upload_canvas_texture(struct imv_canvas *canvas)
+{
+  void *data = cairo_image_surface_get_data(canvas->surface);
+
+  glBindTexture(GL_TEXTURE_RECTANGLE, canvas->texture);
+  /* the surface may be wider than the canvas when the pooled allocation
+   * outgrew it */
+  glPixelStorei(GL_UNPACK_ROW_LENGTH,
+      cairo_image_surface_get_stride(canvas->surface) / 4);
+
+  if (canvas->damage.texture_valid && !canvas->damage.full) {
+    const int x = canvas->damage.x0;
+    const int y = canvas->damage.y0;
+    const int width = canvas->damage.x1 - x;
+    const int height = canvas->damage.y1 - y;
+    if (width > 0 && height > 0) {
+      glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+      glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, y, width, height,
+                      GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data);
+      glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    }
+  } else {
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, canvas->width, canvas->height,
+                 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data);
+    canvas->damage.texture_valid = true;
+    canvas->damage.full = false;
+  }
+
+  canvas->damage.x0 = canvas->damage.x1 = 0;
+  canvas->damage.y0 = canvas->damage.y1 = 0;
+}
+
+bool imv_canvas_get_damage(struct imv_canvas *canvas,
+    int *x, int *y, int *width, int *height)
+{
+  if (!canvas->damage.texture_valid || canvas->damage.full) {
+    return false;
+  }
+  *x = canvas->damage.x0;
+  *y = canvas->damage.y0;
+  *width = canvas->damage.x1 - canvas->damage.x0;
+  *height = canvas->damage.y1 - canvas->damage.y0;
+  if (*width < 0 || *height < 0) {
+    *width = 0;
+    *height = 0;
+  }
+  return true;
+}
+
 void imv_canvas_draw(struct imv_canvas *canvas)
 {
   GLint viewport[4];
   glGetIntegerv(GL_VIEWPORT, viewport);
+
+  if (use_shader(canvas)) {
+    upload_canvas_texture(canvas);
+    shader_draw_quad(canvas, &canvas->shader.base,
+        GL_TEXTURE_RECTANGLE, canvas->texture,
+        0, 0, viewport[2], viewport[3],
+        canvas->width, canvas->height, 0, 0);
+    return;
+  }
+
   glPushMatrix();
   glOrtho(0.0, 1.0, 1.0, 0.0, 0.0, 10.0);
 
-  void *data = cairo_image_surface_get_data(canvas->surface);
-
   glEnable(GL_TEXTURE_RECTANGLE);
-  glBindTexture(GL_TEXTURE_RECTANGLE, canvas->texture);
-
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, canvas->width);
-  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-  glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, canvas->width, canvas->height,
-               0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data);
+  upload_canvas_texture(canvas);
 
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -184,6 +1060,10 @@ void imv_canvas_draw(struct imv_canvas *canvas)
 }
 
 struct imv_bitmap *imv_image_get_bitmap(const struct imv_image *image);
+int imv_image_full_width(const struct imv_image *image);
+int imv_image_full_height(const struct imv_image *image);
+struct imv_bitmap *imv_image_load_region(const struct imv_image *image,
+    int x, int y, int width, int height);
 
 static int convert_pixelformat(enum imv_pixelformat fmt)
 {
@@ -200,37 +1080,562 @@ static int convert_pixelformat(enum imv_pixelformat fmt)
   }
 }
 
-static void draw_bitmap(struct imv_canvas *canvas,
-                        struct imv_bitmap *bitmap,
-                        int bx, int by, double scale,
-                        enum upscaling_method upscaling_method)
+static bool pbo_supported(struct imv_canvas *canvas)
 {
-  GLint viewport[4];
-  glGetIntegerv(GL_VIEWPORT, viewport);
-
-  glPushMatrix();
-  glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
-
-  if (!canvas->cache.texture) {
-    glGenTextures(1, &canvas->cache.texture);
+  if (!canvas->cache.pbo_checked) {
+    canvas->cache.pbo_checked = true;
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    if (exts && strstr(exts, "GL_ARB_pixel_buffer_object")) {
+      glGenBuffers(2, canvas->cache.pbo);
+      canvas->cache.pbo_supported = true;
+    }
   }
+  return canvas->cache.pbo_supported;
+}
 
-  const int format = convert_pixelformat(bitmap->format);
-
-  glBindTexture(GL_TEXTURE_RECTANGLE, canvas->cache.texture);
+/* Upload a bitmap to the currently bound texture. Where pixel buffer
+ * objects are available the pixels are staged through a mapped PBO so the
+ * driver can transfer them asynchronously instead of stalling the render
+ * thread inside glTexImage2D.
+ */
+static void upload_bitmap(struct imv_canvas *canvas,
+                          struct imv_bitmap *bitmap, int format)
+{
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap->width);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
 
-  if (canvas->cache.bitmap != bitmap) {
-    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  const size_t len = 4 * (size_t)bitmap->width * (size_t)bitmap->height;
+
+  if (pbo_supported(canvas)) {
+    canvas->cache.pbo_index ^= 1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER,
+        canvas->cache.pbo[canvas->cache.pbo_index]);
+    /* orphan the previous contents so we never wait on an in-flight DMA */
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, len, NULL, GL_STREAM_DRAW);
+    void *mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (mapped) {
+      memcpy(mapped, bitmap->data, len);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8,
+          bitmap->width, bitmap->height,
+          0, format, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8,
+      bitmap->width, bitmap->height,
+      0, format, GL_UNSIGNED_INT_8_8_8_8_REV, bitmap->data);
+}
+
+static void destroy_tiles(struct imv_canvas *canvas)
+{
+  for (int i = 0; i < canvas->tiled.num_tiles; ++i) {
+    if (canvas->tiled.tiles[i].texture) {
+      glDeleteTextures(1, &canvas->tiled.tiles[i].texture);
+    }
+  }
+  free(canvas->tiled.tiles);
+  canvas->tiled.tiles = NULL;
+  canvas->tiled.num_tiles = 0;
+  canvas->tiled.vram_used = 0;
+  canvas->tiled.image = NULL;
+}
+
+static void create_tiles(struct imv_canvas *canvas, int width, int height)
+{
+  const int cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+  const int rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+  canvas->tiled.num_tiles = cols * rows;
+  canvas->tiled.tiles = calloc(canvas->tiled.num_tiles,
+      sizeof *canvas->tiled.tiles);
+  for (int row = 0; row < rows; ++row) {
+    for (int col = 0; col < cols; ++col) {
+      struct tile *tile = &canvas->tiled.tiles[row * cols + col];
+      tile->x = col * TILE_SIZE;
+      tile->y = row * TILE_SIZE;
+      tile->width = width - tile->x;
+      if (tile->width > TILE_SIZE) {
+        tile->width = TILE_SIZE;
+      }
+      tile->height = height - tile->y;
+      if (tile->height > TILE_SIZE) {
+        tile->height = TILE_SIZE;
+      }
+    }
+  }
+}
+
+static void upload_tile(struct imv_canvas *canvas, struct tile *tile,
+                        struct imv_bitmap *bitmap, int format)
+{
+  glGenTextures(1, &tile->texture);
+  glBindTexture(GL_TEXTURE_RECTANGLE, tile->texture);
+  glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap->width);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, tile->y);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile->x);
+  glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, tile->width, tile->height,
+      0, format, GL_UNSIGNED_INT_8_8_8_8_REV, bitmap->data);
+  canvas->tiled.vram_used += 4 * (size_t)tile->width * (size_t)tile->height;
+}
+
+/* Delete the textures of the least recently drawn tiles until the tile set
+ * fits the VRAM budget again. Tiles drawn this frame are never evicted. */
+static void evict_tiles(struct imv_canvas *canvas)
+{
+  while (canvas->tiled.vram_used > TILE_VRAM_BUDGET) {
+    struct tile *victim = NULL;
+    for (int i = 0; i < canvas->tiled.num_tiles; ++i) {
+      struct tile *tile = &canvas->tiled.tiles[i];
+      if (!tile->texture || tile->last_used == canvas->tiled.draw_count) {
+        continue;
+      }
+      if (!victim || tile->last_used < victim->last_used) {
+        victim = tile;
+      }
+    }
+    if (!victim) {
+      break;
+    }
+    glDeleteTextures(1, &victim->texture);
+    victim->texture = 0;
+    canvas->tiled.vram_used -= 4 * (size_t)victim->width * (size_t)victim->height;
+  }
+}
+
+static void draw_bitmap_tiled(struct imv_canvas *canvas,
+                              struct imv_bitmap *bitmap,
+                              int bx, int by, double scale,
+                              enum upscaling_method upscaling_method)
+{
+  const int format = convert_pixelformat(bitmap->format);
+  const bool shader = use_shader(canvas);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  if (canvas->cache.bitmap != bitmap || canvas->tiled.image) {
+    destroy_tiles(canvas);
+    create_tiles(canvas, bitmap->width, bitmap->height);
+  }
+  canvas->cache.bitmap = bitmap;
+  canvas->tiled.draw_count++;
+  double uploaded_ms = 0;
+
+  GLint mag_filter;
+  if (upscaling_method == UPSCALING_LINEAR) {
+    mag_filter = GL_LINEAR;
+  } else if (upscaling_method == UPSCALING_NEAREST_NEIGHBOUR) {
+    mag_filter = GL_NEAREST;
+  } else {
+    imv_log(IMV_ERROR, "Unknown upscaling method: %d\n", upscaling_method);
+    abort();
+  }
+
+  if (!shader) {
+    glPushMatrix();
+    glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
+    glEnable(GL_TEXTURE_RECTANGLE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+
+  for (int i = 0; i < canvas->tiled.num_tiles; ++i) {
+    struct tile *tile = &canvas->tiled.tiles[i];
+    const double left = bx + tile->x * scale;
+    const double top = by + tile->y * scale;
+    const double right = left + tile->width * scale;
+    const double bottom = top + tile->height * scale;
+
+    /* only touch tiles that intersect the viewport */
+    if (right < 0 || bottom < 0
+        || left >= viewport[2] || top >= viewport[3]) {
+      continue;
+    }
+
+    if (!tile->texture) {
+      const double upload_start = canvas_time_ms();
+      upload_tile(canvas, tile, bitmap, format);
+      uploaded_ms += canvas_time_ms() - upload_start;
+    }
+    tile->last_used = canvas->tiled.draw_count;
+
+    glBindTexture(GL_TEXTURE_RECTANGLE, tile->texture);
+    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, mag_filter);
+
+    if (shader) {
+      shader_draw_quad(canvas, &canvas->shader.base,
+          GL_TEXTURE_RECTANGLE, tile->texture, left, top,
+          tile->width * scale, tile->height * scale,
+          tile->width, tile->height, 0, 0);
+    } else {
+      glBegin(GL_TRIANGLE_FAN);
+      glTexCoord2i(0,           0);            glVertex2d(left, top);
+      glTexCoord2i(tile->width, 0);            glVertex2d(right, top);
+      glTexCoord2i(tile->width, tile->height); glVertex2d(right, bottom);
+      glTexCoord2i(0,           tile->height); glVertex2d(left, bottom);
+      glEnd();
+    }
+  }
+
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+
+  if (!shader) {
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+    glDisable(GL_TEXTURE_RECTANGLE);
+    glPopMatrix();
+  }
+
+  if (uploaded_ms > 0) {
+    canvas->last_upload_ms = uploaded_ms;
+  }
+
+  evict_tiles(canvas);
+}
+
+static void upload_region_tile(struct imv_canvas *canvas, struct tile *tile,
+                               const struct imv_image *image)
+{
+  struct imv_bitmap *bmp = imv_image_load_region(image,
+      tile->x, tile->y, tile->width, tile->height);
+  if (!bmp) {
+    return;
+  }
+  glGenTextures(1, &tile->texture);
+  glBindTexture(GL_TEXTURE_RECTANGLE, tile->texture);
+  glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, bmp->width);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, bmp->width, bmp->height,
+      0, convert_pixelformat(bmp->format), GL_UNSIGNED_INT_8_8_8_8_REV,
+      bmp->data);
+  canvas->tiled.vram_used += 4 * (size_t)tile->width * (size_t)tile->height;
+  imv_bitmap_unref(bmp);
+}
+
+/* Overlay full-resolution regions on the reduced backdrop bitmap. The
+ * tiles span the image's full resolution; a tile's pixels are requested
+ * from the image's region provider the first time it's on screen, uploaded
+ * and freed again, so resident memory stays proportional to the viewport
+ * while VRAM is bounded by the usual tile budget. */
+static void draw_region_tiles(struct imv_canvas *canvas,
+                              const struct imv_image *image,
+                              int bx, int by, double scale,
+                              enum upscaling_method upscaling_method)
+{
+  const bool shader = use_shader(canvas);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  const int full_width = imv_image_full_width(image);
+  const int full_height = imv_image_full_height(image);
+  const struct imv_bitmap *backdrop = imv_image_get_bitmap(image);
+  /* screen pixels per full-resolution pixel */
+  const double full_scale = scale * (double)backdrop->width / full_width;
+
+  if (canvas->tiled.image != image) {
+    destroy_tiles(canvas);
+    create_tiles(canvas, full_width, full_height);
+    canvas->tiled.image = image;
+  }
+  canvas->tiled.draw_count++;
+  double uploaded_ms = 0;
+
+  GLint mag_filter;
+  if (upscaling_method == UPSCALING_LINEAR) {
+    mag_filter = GL_LINEAR;
+  } else if (upscaling_method == UPSCALING_NEAREST_NEIGHBOUR) {
+    mag_filter = GL_NEAREST;
+  } else {
+    imv_log(IMV_ERROR, "Unknown upscaling method: %d\n", upscaling_method);
+    abort();
+  }
+
+  if (!shader) {
+    glPushMatrix();
+    glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
+    glEnable(GL_TEXTURE_RECTANGLE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+
+  for (int i = 0; i < canvas->tiled.num_tiles; ++i) {
+    struct tile *tile = &canvas->tiled.tiles[i];
+    const double left = bx + tile->x * full_scale;
+    const double top = by + tile->y * full_scale;
+    const double right = left + tile->width * full_scale;
+    const double bottom = top + tile->height * full_scale;
+
+    /* only touch tiles that intersect the viewport */
+    if (right < 0 || bottom < 0
+        || left >= viewport[2] || top >= viewport[3]) {
+      continue;
+    }
+
+    if (!tile->texture) {
+      const double upload_start = canvas_time_ms();
+      upload_region_tile(canvas, tile, image);
+      uploaded_ms += canvas_time_ms() - upload_start;
+      if (!tile->texture) {
+        /* decode failed; the backdrop shows through */
+        continue;
+      }
+    }
+    tile->last_used = canvas->tiled.draw_count;
+
+    glBindTexture(GL_TEXTURE_RECTANGLE, tile->texture);
+    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, mag_filter);
+
+    if (shader) {
+      shader_draw_quad(canvas, &canvas->shader.base,
+          GL_TEXTURE_RECTANGLE, tile->texture, left, top,
+          tile->width * full_scale, tile->height * full_scale,
+          tile->width, tile->height, 0, 0);
+    } else {
+      glBegin(GL_TRIANGLE_FAN);
+      glTexCoord2i(0,           0);            glVertex2d(left, top);
+      glTexCoord2i(tile->width, 0);            glVertex2d(right, top);
+      glTexCoord2i(tile->width, tile->height); glVertex2d(right, bottom);
+      glTexCoord2i(0,           tile->height); glVertex2d(left, bottom);
+      glEnd();
+    }
+  }
+
+  if (!shader) {
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+    glDisable(GL_TEXTURE_RECTANGLE);
+    glPopMatrix();
+  }
+
+  if (uploaded_ms > 0) {
+    canvas->last_upload_ms = uploaded_ms;
+  }
+
+  evict_tiles(canvas);
+}
+
+/* Draw the bitmap through a mipmapped GL_TEXTURE_2D copy, built (and its
+ * mip chain generated) once per bitmap at upload */
+static void draw_bitmap_mipmap(struct imv_canvas *canvas,
+                               struct imv_bitmap *bitmap,
+                               int bx, int by, double scale)
+{
+  const int format = convert_pixelformat(bitmap->format);
+  const bool shader = use_shader(canvas);
+
+  if (!canvas->cache.mip_texture) {
+    glGenTextures(1, &canvas->cache.mip_texture);
+  }
+  glBindTexture(GL_TEXTURE_2D, canvas->cache.mip_texture);
+
+  if (canvas->cache.mip_bitmap != bitmap) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap->width);
     glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
     glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, bitmap->width, bitmap->height,
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, bitmap->width, bitmap->height,
         0, format, GL_UNSIGNED_INT_8_8_8_8_REV, bitmap->data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    canvas->cache.mip_bitmap = bitmap;
   }
-  canvas->cache.bitmap = bitmap;
 
-  glEnable(GL_TEXTURE_RECTANGLE);
+  const double width = bitmap->width * scale;
+  const double height = bitmap->height * scale;
+
+  if (shader) {
+    if (!canvas->shader.mip_tried) {
+      canvas->shader.mip_tried = true;
+      build_program(fragment_2d_source, &canvas->shader.mip);
+    }
+    if (canvas->shader.mip.id) {
+      shader_draw_quad(canvas, &canvas->shader.mip,
+          GL_TEXTURE_2D, canvas->cache.mip_texture,
+          bx, by, width, height, 1, 1, 0, 0);
+      return;
+    }
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glPushMatrix();
+  glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
+
+  glEnable(GL_TEXTURE_2D);
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glBegin(GL_TRIANGLE_FAN);
+  glTexCoord2f(0, 0); glVertex2d(bx, by);
+  glTexCoord2f(1, 0); glVertex2d(bx + width, by);
+  glTexCoord2f(1, 1); glVertex2d(bx + width, by + height);
+  glTexCoord2f(0, 1); glVertex2d(bx, by + height);
+  glEnd();
+
+  glDisable(GL_BLEND);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDisable(GL_TEXTURE_2D);
+  glPopMatrix();
+}
+
+#ifdef IMV_DMABUF
+/* Draw a dmabuf-backed bitmap through a texture imported from the buffer
+ * itself, so the pixels are never copied. Returns false when the import
+ * isn't possible, leaving the caller to upload them instead. */
+static bool draw_bitmap_dmabuf(struct imv_canvas *canvas,
+                               struct imv_bitmap *bitmap,
+                               int bx, int by, double scale,
+                               enum upscaling_method upscaling_method)
+{
+  if (!canvas->dmabuf.import || bitmap->format != IMV_ABGR) {
+    return false;
+  }
+
+  if (canvas->dmabuf.source != bitmap->dmabuf) {
+    if (canvas->dmabuf.texture) {
+      glDeleteTextures(1, &canvas->dmabuf.texture);
+    }
+    const double import_start = canvas_time_ms();
+    canvas->dmabuf.texture = canvas->dmabuf.import(canvas->dmabuf.import_data,
+        imv_dmabuf_get_fd(bitmap->dmabuf), bitmap->width, bitmap->height,
+        imv_dmabuf_get_stride(bitmap->dmabuf));
+    canvas->dmabuf.source = bitmap->dmabuf;
+    if (canvas->dmabuf.texture) {
+      canvas->last_upload_ms = canvas_time_ms() - import_start;
+    }
+  }
+  if (!canvas->dmabuf.texture) {
+    return false;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, canvas->dmabuf.texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+      upscaling_method == UPSCALING_NEAREST_NEIGHBOUR ? GL_NEAREST : GL_LINEAR);
+
+  const double width = bitmap->width * scale;
+  const double height = bitmap->height * scale;
+
+  /* normalised coordinates on a plain 2D texture, like the mipmap path */
+  if (use_shader(canvas)) {
+    if (!canvas->shader.mip_tried) {
+      canvas->shader.mip_tried = true;
+      build_program(fragment_2d_source, &canvas->shader.mip);
+    }
+    if (canvas->shader.mip.id) {
+      shader_draw_quad(canvas, &canvas->shader.mip,
+          GL_TEXTURE_2D, canvas->dmabuf.texture,
+          bx, by, width, height, 1, 1, 0, 0);
+      return true;
+    }
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glPushMatrix();
+  glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
+
+  glEnable(GL_TEXTURE_2D);
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glBegin(GL_TRIANGLE_FAN);
+  glTexCoord2f(0, 0); glVertex2d(bx, by);
+  glTexCoord2f(1, 0); glVertex2d(bx + width, by);
+  glTexCoord2f(1, 1); glVertex2d(bx + width, by + height);
+  glTexCoord2f(0, 1); glVertex2d(bx, by + height);
+  glEnd();
+
+  glDisable(GL_BLEND);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDisable(GL_TEXTURE_2D);
+  glPopMatrix();
+  return true;
+}
+#endif
+
+static void draw_bitmap(struct imv_canvas *canvas,
+                        struct imv_bitmap *bitmap,
+                        int bx, int by, double scale,
+                        enum upscaling_method upscaling_method,
+                        enum downscaling_method downscaling_method)
+{
+  GLint max_texture_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  if (bitmap->width > max_texture_size || bitmap->height > max_texture_size) {
+    draw_bitmap_tiled(canvas, bitmap, bx, by, scale, upscaling_method);
+    return;
+  }
+
+  if (canvas->cache.bitmap != bitmap && canvas->tiled.tiles) {
+    destroy_tiles(canvas);
+  }
+
+  if (scale < 1.0 && downscaling_method == DOWNSCALING_MIPMAP) {
+    /* mipmap generation needs a texture we own a copy of, so dmabuf-backed
+     * bitmaps take the upload path here too */
+    draw_bitmap_mipmap(canvas, bitmap, bx, by, scale);
+    return;
+  }
+
+#ifdef IMV_DMABUF
+  /* lanczos minification samples a rectangle texture, so it also keeps the
+   * upload path rather than lose the filter */
+  if (bitmap->dmabuf
+      && !(scale < 1.0 && downscaling_method == DOWNSCALING_LANCZOS)
+#ifdef IMV_ICC
+      /* colour-managed bitmaps need the shader path below to apply the LUT */
+      && !bitmap->profile
+#endif
+      && draw_bitmap_dmabuf(canvas, bitmap, bx, by, scale, upscaling_method)) {
+    return;
+  }
+#endif
+
+  const bool shader = use_shader(canvas);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  if (!shader) {
+    glPushMatrix();
+    glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
+  }
+
+  if (!canvas->cache.texture) {
+    glGenTextures(1, &canvas->cache.texture);
+  }
+
+  const int format = convert_pixelformat(bitmap->format);
+
+  glBindTexture(GL_TEXTURE_RECTANGLE, canvas->cache.texture);
+
+  if (canvas->cache.bitmap != bitmap) {
+    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    const double upload_start = canvas_time_ms();
+    upload_bitmap(canvas, bitmap, format);
+    canvas->last_upload_ms = canvas_time_ms() - upload_start;
+  }
+  canvas->cache.bitmap = bitmap;
 
   if (upscaling_method == UPSCALING_LINEAR) {
     glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -241,6 +1646,46 @@ static void draw_bitmap(struct imv_canvas *canvas,
     abort();
   }
 
+  if (shader) {
+    const struct program *prog = &canvas->shader.base;
+    float texel = 0;
+    if (scale < 1.0 && downscaling_method == DOWNSCALING_LANCZOS) {
+      if (!canvas->shader.lanczos_tried) {
+        canvas->shader.lanczos_tried = true;
+        build_program(fragment_lanczos_source, &canvas->shader.lanczos);
+      }
+      /* the legacy renderer has no lanczos path; linear is the fallback */
+      if (canvas->shader.lanczos.id) {
+        prog = &canvas->shader.lanczos;
+        texel = 1.0 / scale;
+      }
+    }
+#ifdef IMV_ICC
+    const GLuint lut = icc_lut(canvas, bitmap);
+    if (lut) {
+      if (!canvas->shader.cms_tried) {
+        canvas->shader.cms_tried = true;
+        build_program(fragment_cms_source, &canvas->shader.cms);
+      }
+      /* correct colour wins over the lanczos filter when both apply */
+      if (canvas->shader.cms.id) {
+        prog = &canvas->shader.cms;
+        texel = 0;
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_3D, lut);
+        glActiveTexture(GL_TEXTURE0);
+      }
+    }
+#endif
+    shader_draw_quad(canvas, prog,
+        GL_TEXTURE_RECTANGLE, canvas->cache.texture,
+        bx, by, bitmap->width * scale, bitmap->height * scale,
+        bitmap->width, bitmap->height, texel, texel);
+    return;
+  }
+
+  glEnable(GL_TEXTURE_RECTANGLE);
+
   const int left = bx;
   const int top = by;
   const int right = left + bitmap->width * scale;
@@ -265,28 +1710,249 @@ static void draw_bitmap(struct imv_canvas *canvas,
 
 #ifdef IMV_BACKEND_LIBRSVG
 RsvgHandle *imv_image_get_svg(const struct imv_image *image);
+
+/* How long a zoomed scale has to hold before the SVG is re-rasterized */
+#define SVG_RERENDER_DELAY_MS 150.0
+
+/* Rasters above this many pixels aren't cached; such extreme zooms fall
+ * back to rendering the visible area directly each frame */
+#define SVG_CACHE_MAX_PIXELS ((size_t)32 * 1024 * 1024)
+
+/* Render the document at the given scale onto the canvas each frame; the
+ * pre-cache behaviour, kept for rasters too large to keep around */
+static void draw_svg_direct(struct imv_canvas *canvas, RsvgHandle *svg,
+                            int x, int y, double scale)
+{
+  imv_canvas_clear(canvas);
+  cairo_translate(canvas->cairo, x, y);
+  cairo_scale(canvas->cairo, scale, scale);
+  rsvg_handle_render_cairo(svg, canvas->cairo);
+  cairo_identity_matrix(canvas->cairo);
+  /* rsvg painted directly on the surface behind our tracking */
+  damage_add(canvas, 0, 0, canvas->width, canvas->height);
+  imv_canvas_draw(canvas);
+}
+
+/* Rasterize the document at the given scale into a bitmap */
+static struct imv_bitmap *rasterize_svg(RsvgHandle *svg,
+    int width, int height, double scale)
+{
+  const int w = (int)(width * scale + 0.5);
+  const int h = (int)(height * scale + 0.5);
+  if (w < 1 || h < 1) {
+    return NULL;
+  }
+
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+  cairo_t *cr = cairo_create(surface);
+  cairo_scale(cr, scale, scale);
+  rsvg_handle_render_cairo(svg, cr);
+  cairo_destroy(cr);
+  cairo_surface_flush(surface);
+
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
+  bmp->width = w;
+  bmp->height = h;
+  bmp->format = IMV_ARGB;
+  bmp->data = malloc((size_t)w * h * 4);
+  bmp->refs = 1;
+
+  const unsigned char *src = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  for (int row = 0; row < h; ++row) {
+    memcpy(bmp->data + (size_t)row * w * 4, src + (size_t)row * stride, w * 4);
+  }
+  cairo_surface_destroy(surface);
+  return bmp;
+}
+
+static void draw_svg(struct imv_canvas *canvas, RsvgHandle *svg,
+                     struct imv_image *image, int x, int y, double scale)
+{
+  struct imv_bitmap *cached = canvas->svg_cache.bitmap;
+
+  if (canvas->svg_cache.svg == svg && cached
+      && canvas->svg_cache.scale == scale) {
+    /* pans and repaints reuse the raster untouched */
+    canvas->svg_cache.pending = false;
+    draw_bitmap(canvas, cached, x, y, 1.0,
+        UPSCALING_LINEAR, DOWNSCALING_LINEAR);
+    return;
+  }
+
+  if (canvas->svg_cache.svg == svg && cached) {
+    /* mid-zoom: show the stale raster rescaled and defer the expensive
+     * re-rasterization until the scale has settled */
+    const double now = canvas_time_ms();
+    if (!canvas->svg_cache.pending
+        || canvas->svg_cache.pending_scale != scale) {
+      canvas->svg_cache.pending = true;
+      canvas->svg_cache.pending_scale = scale;
+      canvas->svg_cache.pending_since_ms = now;
+    }
+    if (now - canvas->svg_cache.pending_since_ms < SVG_RERENDER_DELAY_MS) {
+      draw_bitmap(canvas, cached, x, y, scale / canvas->svg_cache.scale,
+          UPSCALING_LINEAR, DOWNSCALING_LINEAR);
+      return;
+    }
+  }
+
+  const int width = imv_image_width(image);
+  const int height = imv_image_height(image);
+  const double pixels = (double)width * scale * height * scale;
+  if (pixels > (double)SVG_CACHE_MAX_PIXELS) {
+    canvas->svg_cache.pending = false;
+    draw_svg_direct(canvas, svg, x, y, scale);
+    return;
+  }
+
+  struct imv_bitmap *bmp = rasterize_svg(svg, width, height, scale);
+  if (!bmp) {
+    canvas->svg_cache.pending = false;
+    draw_svg_direct(canvas, svg, x, y, scale);
+    return;
+  }
+
+  if (cached) {
+    imv_bitmap_unref(cached);
+  }
+  canvas->svg_cache.svg = svg;
+  canvas->svg_cache.scale = scale;
+  canvas->svg_cache.bitmap = bmp;
+  canvas->svg_cache.pending = false;
+
+  draw_bitmap(canvas, bmp, x, y, 1.0, UPSCALING_LINEAR, DOWNSCALING_LINEAR);
+}
+#endif
+
+/* Whether a deferred SVG re-rasterization wants another draw, and in how
+ * many seconds it's due */
+bool imv_canvas_needs_rerender(const struct imv_canvas *canvas, double *delay)
+{
+  if (canvas->icc.thread_running) {
+    /* poll for the finished LUT so the corrected colours swap in promptly */
+    *delay = 0.005;
+    return true;
+  }
+#ifdef IMV_BACKEND_LIBRSVG
+  if (canvas->svg_cache.pending) {
+    const double elapsed = canvas_time_ms() - canvas->svg_cache.pending_since_ms;
+    *delay = (SVG_RERENDER_DELAY_MS - elapsed) / 1000.0;
+    if (*delay < 0) {
+      *delay = 0;
+    }
+    return true;
+  }
+#else
+  (void)canvas;
+  (void)delay;
 #endif
+  return false;
+}
 
 void imv_canvas_draw_image(struct imv_canvas *canvas, struct imv_image *image,
                            int x, int y, double scale,
-                           enum upscaling_method upscaling_method)
+                           enum upscaling_method upscaling_method,
+                           enum downscaling_method downscaling_method)
 {
   struct imv_bitmap *bitmap = imv_image_get_bitmap(image);
   if (bitmap) {
-    draw_bitmap(canvas, bitmap, x, y, scale, upscaling_method);
+    draw_bitmap(canvas, bitmap, x, y, scale, upscaling_method,
+        downscaling_method);
+    if (imv_image_has_regions(image) && scale > 1.0) {
+      /* the reduced decode is being shown past 1:1; it just became the
+       * backdrop, now lay decoded-to-order full-resolution tiles over
+       * whatever of it is on screen */
+      draw_region_tiles(canvas, image, x, y, scale, upscaling_method);
+    }
     return;
   }
 
 #ifdef IMV_BACKEND_LIBRSVG
   RsvgHandle *svg = imv_image_get_svg(image);
   if (svg) {
-    imv_canvas_clear(canvas);
-    cairo_translate(canvas->cairo, x, y);
-    cairo_scale(canvas->cairo, scale, scale);
-    rsvg_handle_render_cairo(svg, canvas->cairo);
-    cairo_identity_matrix(canvas->cairo);
-    imv_canvas_draw(canvas);
+    draw_svg(canvas, svg, image, x, y, scale);
     return;
   }
 #endif
 }
+
+void imv_canvas_draw_bitmap(struct imv_canvas *canvas, struct imv_bitmap *bitmap,
+                            int x, int y, int width, int height)
+{
+  struct thumb_tex *entry = NULL;
+  for (int i = 0; i < THUMB_CACHE_ENTRIES; ++i) {
+    if (canvas->thumb_cache.entries[i].bitmap == bitmap) {
+      entry = &canvas->thumb_cache.entries[i];
+      break;
+    }
+  }
+
+  if (!entry) {
+    /* claim an empty slot, or recycle the least recently drawn one */
+    for (int i = 0; i < THUMB_CACHE_ENTRIES; ++i) {
+      struct thumb_tex *candidate = &canvas->thumb_cache.entries[i];
+      if (!candidate->bitmap) {
+        entry = candidate;
+        break;
+      }
+      if (!entry || candidate->last_used < entry->last_used) {
+        entry = candidate;
+      }
+    }
+    if (!entry->texture) {
+      glGenTextures(1, &entry->texture);
+    }
+    entry->bitmap = bitmap;
+    entry->width = bitmap->width;
+    entry->height = bitmap->height;
+
+    glBindTexture(GL_TEXTURE_RECTANGLE, entry->texture);
+    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap->width);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8,
+        bitmap->width, bitmap->height,
+        0, convert_pixelformat(bitmap->format),
+        GL_UNSIGNED_INT_8_8_8_8_REV, bitmap->data);
+  } else {
+    glBindTexture(GL_TEXTURE_RECTANGLE, entry->texture);
+  }
+  entry->last_used = ++canvas->thumb_cache.use_count;
+
+  if (use_shader(canvas)) {
+    shader_draw_quad(canvas, &canvas->shader.base,
+        GL_TEXTURE_RECTANGLE, entry->texture,
+        x, y, width, height,
+        entry->width, entry->height, 0, 0);
+    return;
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glPushMatrix();
+  glOrtho(0.0, viewport[2], viewport[3], 0.0, 0.0, 10.0);
+
+  glEnable(GL_TEXTURE_RECTANGLE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glBegin(GL_TRIANGLE_FAN);
+  glTexCoord2i(0,            0);             glVertex2i(x, y);
+  glTexCoord2i(entry->width, 0);             glVertex2i(x + width, y);
+  glTexCoord2i(entry->width, entry->height); glVertex2i(x + width, y + height);
+  glTexCoord2i(0,            entry->height); glVertex2i(x, y + height);
+  glEnd();
+
+  glDisable(GL_BLEND);
+  glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+  glDisable(GL_TEXTURE_RECTANGLE);
+  glPopMatrix();
+}
@@ -1,6 +1,9 @@
 #ifndef IMV_CANVAS_H
 #define IMV_CANVAS_H
 
+#include <stdbool.h>
+
+struct imv_bitmap;
 struct imv_canvas;
 struct imv_image;
 
@@ -10,15 +13,58 @@ enum upscaling_method {
   UPSCALING_METHOD_COUNT,
 };
 
+enum downscaling_method {
+  DOWNSCALING_LINEAR,
+  DOWNSCALING_MIPMAP,
+  DOWNSCALING_LANCZOS,
+  DOWNSCALING_METHOD_COUNT,
+};
+
+enum canvas_renderer {
+  RENDERER_AUTO,
+  RENDERER_LEGACY,
+  RENDERER_SHADER,
+  RENDERER_COUNT,
+};
+
 /* Create a canvas instance */
 struct imv_canvas *imv_canvas_create(int width, int height);
 
+/* Select which GL path the canvas renders with. RENDERER_SHADER draws with
+ * a vertex buffer and a shader program instead of the fixed pipeline, which
+ * is considerably faster on drivers that emulate the legacy path.
+ * RENDERER_AUTO uses the shader path where the driver supports it. Falls
+ * back to the legacy path if the shaders fail to build. */
+void imv_canvas_set_renderer(struct imv_canvas *canvas, enum canvas_renderer renderer);
+
+/* Callback giving the canvas a way to import a dmabuf as a GL texture
+ * (see imv_window_import_dmabuf). Returns the texture name, owned by the
+ * canvas, or 0 when the import isn't possible. */
+typedef unsigned int (*imv_canvas_dmabuf_import_fn)(void *data, int fd,
+    int width, int height, int stride);
+
+/* Wire up the importer used to display dmabuf-backed bitmaps without a
+ * CPU-side pixel copy. Without one, or when it declines, such bitmaps are
+ * uploaded the ordinary way. */
+void imv_canvas_set_dmabuf_importer(struct imv_canvas *canvas,
+    imv_canvas_dmabuf_import_fn import, void *data);
+
+/* Set the ICC profile colour-managed images are transformed to, given as a
+ * path to a profile file. NULL (the default) targets sRGB. Only takes
+ * effect when built with colour management support. */
+void imv_canvas_set_display_profile(struct imv_canvas *canvas, const char *path);
+
 /* Clean up a canvas */
 void imv_canvas_free(struct imv_canvas *canvas);
 
 /* Set the buffer size of the canvas */
 void imv_canvas_resize(struct imv_canvas *canvas, int width, int height);
 
+/* Release the canvas's GPU caches - image textures, tiles, thumbnail and
+ * SVG rasterizations. They're rebuilt on demand by the next draw; call
+ * while the window is hidden to give the memory back */
+void imv_canvas_drop_caches(struct imv_canvas *canvas);
+
 /* Blank the canvas to be empty and transparent */
 void imv_canvas_clear(struct imv_canvas *canvas);
 
@@ -34,18 +80,45 @@ void imv_canvas_fill(struct imv_canvas *canvas);
 /* Fill the whole canvas with a chequerboard pattern */
 void imv_canvas_fill_checkers(struct imv_canvas *canvas, int size);
 
+/* Draw a chequerboard pattern over the whole window, straight from GL,
+ * without touching the canvas */
+void imv_canvas_draw_checkers(struct imv_canvas *canvas, int size);
+
 /* Select the font to draw text with */
 void imv_canvas_font(struct imv_canvas *canvas, const char *name, int size);
 
 /* Draw some text on the canvas, returns the width used in pixels */
 int imv_canvas_printf(struct imv_canvas *canvas, int x, int y, const char *fmt, ...);
 
+/* Time in milliseconds spent on the most recent image texture upload.
+ * Cached frames don't re-upload, so this reflects the last frame that did. */
+double imv_canvas_get_upload_ms(const struct imv_canvas *canvas);
+
+/* Report the area of the canvas that changed since the previous draw, for
+ * use as a compositor damage hint. Returns false when the whole canvas
+ * should be treated as changed. Call before imv_canvas_draw, which resets
+ * the tracking. */
+bool imv_canvas_get_damage(struct imv_canvas *canvas,
+    int *x, int *y, int *width, int *height);
+
+/* Whether the canvas deferred work that wants another draw soon (an SVG
+ * re-rasterization debounced during a zoom). delay is set to the number
+ * of seconds until the draw is due; 0 means draw now. */
+bool imv_canvas_needs_rerender(const struct imv_canvas *canvas, double *delay);
+
 /* Blit the canvas to the current OpenGL framebuffer */
 void imv_canvas_draw(struct imv_canvas *canvas);
 
 /* Blit the given image to the current OpenGL framebuffer */
 void imv_canvas_draw_image(struct imv_canvas *canvas, struct imv_image *image,
                            int x, int y, double scale,
-                           enum upscaling_method upscaling_method);
+                           enum upscaling_method upscaling_method,
+                           enum downscaling_method downscaling_method);
+
+/* Blit the given bitmap scaled to the given rectangle. Textures are cached
+ * per bitmap across frames (this is the gallery's thumbnail path); the
+ * caller must keep a bitmap alive for as long as the canvas may draw it. */
+void imv_canvas_draw_bitmap(struct imv_canvas *canvas, struct imv_bitmap *bitmap,
+                            int x, int y, int width, int height);
 
 #endif
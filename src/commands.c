@@ -2,37 +2,80 @@
 #include "list.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
-struct imv_commands {
-  struct list *command_list;
-};
+/* Commands are registered once at startup, so the table doesn't grow; 64
+ * buckets keeps the chains at one or two entries */
+#define COMMAND_BUCKETS 64
 
 struct command {
   char* command;
   void (*handler)(struct list *args, const char *argstr, void *data);
   char* alias;
+  struct command *next; /* chain within a hash bucket */
+};
+
+struct imv_commands {
+  struct command *buckets[COMMAND_BUCKETS];
 };
 
+/* A command tokenized and resolved to its handler ahead of time */
+struct imv_command_cache {
+  void (*handler)(struct list *args, const char *argstr, void *data);
+  struct list *args;
+  char *argstr;
+};
+
+static uint64_t hash_str(const char *str)
+{
+  uint64_t hash = UINT64_C(14695981039346656037); /* FNV-1a */
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= UINT64_C(1099511628211);
+  }
+  return hash;
+}
+
+static struct command *find_command(struct imv_commands *cmds, const char *name)
+{
+  struct command *cmd = cmds->buckets[hash_str(name) % COMMAND_BUCKETS];
+  for(; cmd; cmd = cmd->next) {
+    if(!strcmp(cmd->command, name)) {
+      return cmd;
+    }
+  }
+  return NULL;
+}
+
+static void add_command(struct imv_commands *cmds, struct command *cmd)
+{
+  struct command **slot = &cmds->buckets[hash_str(cmd->command) % COMMAND_BUCKETS];
+  cmd->next = *slot;
+  *slot = cmd;
+}
+
 struct imv_commands *imv_commands_create(void)
 {
-  struct imv_commands *cmds = malloc(sizeof *cmds);
-  cmds->command_list = list_create();
+  struct imv_commands *cmds = calloc(1, sizeof *cmds);
   return cmds;
 }
 
 void imv_commands_free(struct imv_commands *cmds)
 {
-  for(size_t i = 0; i < cmds->command_list->len; ++i) {
-    struct command *cmd = cmds->command_list->items[i];
-    free(cmd->command);
-    if(cmd->alias) {
-      free(cmd->alias);
+  for(size_t i = 0; i < COMMAND_BUCKETS; ++i) {
+    struct command *cmd = cmds->buckets[i];
+    while(cmd) {
+      struct command *next = cmd->next;
+      free(cmd->command);
+      if(cmd->alias) {
+        free(cmd->alias);
+      }
+      free(cmd);
+      cmd = next;
     }
-    free(cmd);
   }
-  list_free(cmds->command_list);
   free(cmds);
 }
 
@@ -42,7 +85,7 @@ void imv_command_register(struct imv_commands *cmds, const char *command, void (
   cmd->command = strdup(command);
   cmd->handler = handler;
   cmd->alias = NULL;
-  list_append(cmds->command_list, cmd);
+  add_command(cmds, cmd);
 }
 
 void imv_command_alias(struct imv_commands *cmds, const char *command, const char *alias)
@@ -51,7 +94,7 @@ void imv_command_alias(struct imv_commands *cmds, const char *command, const cha
   cmd->command = strdup(command);
   cmd->handler = NULL;
   cmd->alias = strdup(alias);
-  list_append(cmds->command_list, cmd);
+  add_command(cmds, cmd);
 }
 
 int imv_command_exec(struct imv_commands *cmds, const char *command, void *data)
@@ -60,24 +103,21 @@ int imv_command_exec(struct imv_commands *cmds, const char *command, void *data)
   int ret = 1;
 
   if(args->len > 0) {
-    for(size_t i = 0; i < cmds->command_list->len; ++i) {
-      struct command *cmd = cmds->command_list->items[i];
-      if(!strcmp(cmd->command, args->items[0])) {
-        if(cmd->handler) {
-          /* argstr = all args as a single string */
-          const char *argstr = command + strlen(cmd->command) + 1;
-          cmd->handler(args, argstr, data);
-          ret = 0;
-        } else if(cmd->alias) {
-          char *new_args = list_to_string(args, " ", 1);
-          size_t cmd_len = strlen(cmd->alias) + 1 + strlen(new_args) + 1;
-          char *new_cmd = malloc(cmd_len);
-          snprintf(new_cmd, cmd_len, "%s %s", cmd->alias, new_args);
-          ret = imv_command_exec(cmds, new_cmd, data);
-          free(new_args);
-          free(new_cmd);
-        }
-        break;
+    struct command *cmd = find_command(cmds, args->items[0]);
+    if(cmd) {
+      if(cmd->handler) {
+        /* argstr = all args as a single string */
+        const char *argstr = command + strlen(cmd->command) + 1;
+        cmd->handler(args, argstr, data);
+        ret = 0;
+      } else if(cmd->alias) {
+        char *new_args = list_to_string(args, " ", 1);
+        size_t cmd_len = strlen(cmd->alias) + 1 + strlen(new_args) + 1;
+        char *new_cmd = malloc(cmd_len);
+        snprintf(new_cmd, cmd_len, "%s %s", cmd->alias, new_args);
+        ret = imv_command_exec(cmds, new_cmd, data);
+        free(new_args);
+        free(new_cmd);
       }
     }
   }
@@ -86,6 +126,56 @@ int imv_command_exec(struct imv_commands *cmds, const char *command, void *data)
   return ret;
 }
 
+struct imv_command_cache *imv_command_parse(struct imv_commands *cmds, const char *command)
+{
+  struct list *args = list_from_string(command, ' ');
+  if(args->len == 0) {
+    list_deep_free(args);
+    return NULL;
+  }
+
+  struct command *cmd = find_command(cmds, args->items[0]);
+  if(!cmd) {
+    list_deep_free(args);
+    return NULL;
+  }
+
+  if(cmd->alias) {
+    /* resolve the alias now, so execution doesn't have to */
+    char *new_args = list_to_string(args, " ", 1);
+    size_t cmd_len = strlen(cmd->alias) + 1 + strlen(new_args) + 1;
+    char *new_cmd = malloc(cmd_len);
+    snprintf(new_cmd, cmd_len, "%s %s", cmd->alias, new_args);
+    struct imv_command_cache *cache = imv_command_parse(cmds, new_cmd);
+    free(new_args);
+    free(new_cmd);
+    list_deep_free(args);
+    return cache;
+  }
+
+  struct imv_command_cache *cache = malloc(sizeof *cache);
+  cache->handler = cmd->handler;
+  cache->args = args;
+  const char *space = strchr(command, ' ');
+  cache->argstr = strdup(space ? space + 1 : "");
+  return cache;
+}
+
+void imv_command_cache_free(struct imv_command_cache *cache)
+{
+  if(!cache) {
+    return;
+  }
+  list_deep_free(cache->args);
+  free(cache->argstr);
+  free(cache);
+}
+
+void imv_command_exec_cached(struct imv_command_cache *cache, void *data)
+{
+  cache->handler(cache->args, cache->argstr, data);
+}
+
 int imv_command_exec_list(struct imv_commands *cmds, struct list *commands, void *data)
 {
   int ret = 0;
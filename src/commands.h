@@ -3,6 +3,7 @@
 
 struct list;
 struct imv_commands;
+struct imv_command_cache;
 
 /* Create an imv_commands instance */
 struct imv_commands *imv_commands_create(void);
@@ -27,6 +28,18 @@ int imv_command_exec(struct imv_commands *cmds, const char *command, void *data)
 /* Execute a list of commands */
 int imv_command_exec_list(struct imv_commands *cmds, struct list *commands, void *data);
 
+/* Tokenize a command and resolve its handler (and any alias) once, so that
+ * executing it repeatedly does no parsing or lookup. Returns NULL if the
+ * command isn't registered.
+ */
+struct imv_command_cache *imv_command_parse(struct imv_commands *cmds, const char *command);
+
+/* Clean up a preparsed command */
+void imv_command_cache_free(struct imv_command_cache *cache);
+
+/* Execute a preparsed command */
+void imv_command_exec_cached(struct imv_command_cache *cache, void *data);
+
 #endif
 
 /* vim:set ts=2 sts=2 sw=2 et: */
@@ -0,0 +1,121 @@
+#include "dmabuf.h"
+
+#include "log.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gbm.h>
+
+struct imv_dmabuf {
+  struct gbm_bo *bo;
+  void *map;      /* persistent CPU mapping of the pixels */
+  void *map_data; /* gbm's cookie for unmapping */
+  int fd;         /* the exported dmabuf */
+  uint32_t stride;
+};
+
+/* One GBM device shared by every buffer, opened on the first allocation.
+ * Loader threads allocate concurrently, hence the once guard.
+ */
+static struct gbm_device *gbm_device;
+static int gbm_device_fd = -1;
+static pthread_once_t gbm_once = PTHREAD_ONCE_INIT;
+
+static void open_device(void)
+{
+  /* any render node will do; buffers only need to be importable by the
+   * compositor's GPU, which on a single-GPU machine is the same one */
+  for (int i = 128; i < 136; ++i) {
+    char path[32];
+    snprintf(path, sizeof path, "/dev/dri/renderD%d", i);
+    const int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    gbm_device = gbm_create_device(fd);
+    if (gbm_device) {
+      gbm_device_fd = fd;
+      return;
+    }
+    close(fd);
+  }
+  imv_log(IMV_DEBUG, "dmabuf: no usable render node, using plain memory\n");
+}
+
+struct imv_dmabuf *imv_dmabuf_create(int width, int height)
+{
+  pthread_once(&gbm_once, &open_device);
+  if (!gbm_device) {
+    return NULL;
+  }
+
+  struct gbm_bo *bo = gbm_bo_create(gbm_device, width, height,
+      GBM_FORMAT_ABGR8888, GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+  if (!bo) {
+    return NULL;
+  }
+
+  uint32_t stride = 0;
+  void *map_data = NULL;
+  void *map = gbm_bo_map(bo, 0, 0, width, height,
+      GBM_BO_TRANSFER_READ_WRITE, &stride, &map_data);
+  if (!map) {
+    gbm_bo_destroy(bo);
+    return NULL;
+  }
+
+  /* decoders and the bitmap helpers all assume packed rows; a device that
+   * insists on padding the stride doesn't get used */
+  if (stride != (uint32_t)width * 4) {
+    gbm_bo_unmap(bo, map_data);
+    gbm_bo_destroy(bo);
+    return NULL;
+  }
+
+  const int fd = gbm_bo_get_fd(bo);
+  if (fd < 0) {
+    gbm_bo_unmap(bo, map_data);
+    gbm_bo_destroy(bo);
+    return NULL;
+  }
+
+  struct imv_dmabuf *buf = calloc(1, sizeof *buf);
+  buf->bo = bo;
+  buf->map = map;
+  buf->map_data = map_data;
+  buf->fd = fd;
+  buf->stride = stride;
+  return buf;
+}
+
+void imv_dmabuf_free(struct imv_dmabuf *buf)
+{
+  if (!buf) {
+    return;
+  }
+  close(buf->fd);
+  gbm_bo_unmap(buf->bo, buf->map_data);
+  gbm_bo_destroy(buf->bo);
+  free(buf);
+}
+
+void *imv_dmabuf_get_map(struct imv_dmabuf *buf)
+{
+  return buf->map;
+}
+
+int imv_dmabuf_get_fd(const struct imv_dmabuf *buf)
+{
+  return buf->fd;
+}
+
+int imv_dmabuf_get_stride(const struct imv_dmabuf *buf)
+{
+  return (int)buf->stride;
+}
+
+/* vim:set ts=2 sts=2 sw=2 et: */
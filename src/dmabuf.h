@@ -0,0 +1,28 @@
+#ifndef IMV_DMABUF_H
+#define IMV_DMABUF_H
+
+/* imv_dmabuf wraps a linear GBM buffer with a persistent CPU mapping and
+ * an exported dmabuf fd. Decoders write pixels straight into the mapping,
+ * and the canvas imports the fd as an EGLImage-backed texture, so a frame
+ * never crosses through an intermediate copy on its way to the screen.
+ * Buffers are always 32-bit IMV_ABGR with packed rows.
+ */
+struct imv_dmabuf;
+
+/* Allocate a width x height buffer, or NULL if no render node is usable
+ * or the device couldn't give us packed rows */
+struct imv_dmabuf *imv_dmabuf_create(int width, int height);
+
+/* Clean up a buffer. Its mapping and fd become invalid */
+void imv_dmabuf_free(struct imv_dmabuf *buf);
+
+/* The buffer's CPU mapping, valid until imv_dmabuf_free */
+void *imv_dmabuf_get_map(struct imv_dmabuf *buf);
+
+/* The exported dmabuf fd, owned by the buffer */
+int imv_dmabuf_get_fd(const struct imv_dmabuf *buf);
+
+/* Bytes per row of the buffer */
+int imv_dmabuf_get_stride(const struct imv_dmabuf *buf);
+
+#endif
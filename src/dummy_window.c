@@ -71,17 +71,50 @@ void imv_window_get_mouse_position(struct imv_window *window, double *x, double
   (void)y;
 }
 
+void imv_window_set_damage(struct imv_window *window, int x, int y,
+    int width, int height)
+{
+  (void)window;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+}
+
 void imv_window_present(struct imv_window *window)
 {
   (void)window;
 }
 
+bool imv_window_frame_ready(struct imv_window *window)
+{
+  (void)window;
+  return true;
+}
+
+unsigned int imv_window_import_dmabuf(struct imv_window *window, int fd,
+    int width, int height, int stride)
+{
+  (void)window;
+  (void)fd;
+  (void)width;
+  (void)height;
+  (void)stride;
+  return 0;
+}
+
 void imv_window_wait_for_event(struct imv_window *window, double timeout)
 {
   (void)window;
   (void)timeout;
 }
 
+void imv_window_add_event_fd(struct imv_window *window, int fd)
+{
+  (void)window;
+  (void)fd;
+}
+
 void imv_window_push_event(struct imv_window *window, struct imv_event *e)
 {
   (void)window;
@@ -0,0 +1,198 @@
+#include "event_ring.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Must be a power of two. The consumer drains the ring every main loop
+ * iteration, so this only needs to absorb one iteration's worth of events.
+ */
+#define EVENT_RING_SIZE 256
+
+/* Scroll deltas coalesced on overflow are accumulated in 1/65536ths so
+ * they can be summed with an atomic integer add
+ */
+#define SCROLL_FIXED_ONE 65536.0
+
+/* Each slot carries a sequence number (Vyukov's bounded queue): a slot is
+ * free for the producer claiming position pos when seq == pos, and ready
+ * for the consumer when seq == pos + 1
+ */
+struct slot {
+  size_t seq;
+  struct imv_event event;
+};
+
+struct event_ring {
+  struct slot slots[EVENT_RING_SIZE];
+  /* head and tail are kept on their own cache lines so producers and the
+   * consumer don't invalidate each other's */
+  size_t head __attribute__((aligned(64))); /* next position to claim */
+  size_t tail __attribute__((aligned(64))); /* next position to consume */
+  /* whether the consumer has already been told to wake up */
+  int armed __attribute__((aligned(64)));
+  /* overflow coalescing state */
+  int64_t scroll_dx; /* in 1/65536ths */
+  int64_t scroll_dy;
+  uint64_t resize_size; /* width << 32 | height, 0 when empty */
+  uint64_t resize_buffer_size;
+};
+
+struct event_ring *event_ring_create(void)
+{
+  struct event_ring *ring = calloc(1, sizeof *ring);
+  for (size_t i = 0; i < EVENT_RING_SIZE; ++i) {
+    ring->slots[i].seq = i;
+  }
+  return ring;
+}
+
+void event_ring_free(struct event_ring *ring)
+{
+  free(ring);
+}
+
+static bool try_push(struct event_ring *ring, const struct imv_event *event)
+{
+  size_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  while (1) {
+    struct slot *slot = &ring->slots[pos & (EVENT_RING_SIZE - 1)];
+    const size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      /* slot is free; race other producers to claim it */
+      if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->event = *event;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+      /* lost the race; pos was reloaded by the compare-exchange */
+    } else if (diff < 0) {
+      /* the slot a lap behind us is still unconsumed: ring is full */
+      return false;
+    } else {
+      /* another producer claimed pos; move up */
+      pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static bool try_pop(struct event_ring *ring, struct imv_event *out)
+{
+  struct slot *slot = &ring->slots[ring->tail & (EVENT_RING_SIZE - 1)];
+  const size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  if ((intptr_t)seq - (intptr_t)(ring->tail + 1) < 0) {
+    return false;
+  }
+  *out = slot->event;
+  /* mark the slot free for the producer a lap from now */
+  __atomic_store_n(&slot->seq, ring->tail + EVENT_RING_SIZE, __ATOMIC_RELEASE);
+  ++ring->tail;
+  return true;
+}
+
+/* Fold an event the full ring has no room for into the coalescing state.
+ * Only continuous events whose repeats can be merged qualify; anything
+ * else (keypresses, commands) must not be dropped.
+ */
+static bool coalesce(struct event_ring *ring, const struct imv_event *event)
+{
+  if (event->type == IMV_EVENT_MOUSE_SCROLL) {
+    __atomic_fetch_add(&ring->scroll_dx,
+        (int64_t)(event->data.mouse_scroll.dx * SCROLL_FIXED_ONE),
+        __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ring->scroll_dy,
+        (int64_t)(event->data.mouse_scroll.dy * SCROLL_FIXED_ONE),
+        __ATOMIC_RELAXED);
+    return true;
+  }
+
+  if (event->type == IMV_EVENT_RESIZE) {
+    /* only the latest size matters. The buffer size is written first so
+     * that a consumer that sees the size also sees a buffer size at least
+     * as new */
+    __atomic_store_n(&ring->resize_buffer_size,
+        (uint64_t)(uint32_t)event->data.resize.buffer_width << 32
+          | (uint32_t)event->data.resize.buffer_height,
+        __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->resize_size,
+        (uint64_t)(uint32_t)event->data.resize.width << 32
+          | (uint32_t)event->data.resize.height,
+        __ATOMIC_RELEASE);
+    return true;
+  }
+
+  return false;
+}
+
+/* Synthesize a single event from the coalescing state, if any is pending */
+static bool take_coalesced(struct event_ring *ring, struct imv_event *out)
+{
+  const uint64_t size = __atomic_exchange_n(&ring->resize_size, 0,
+      __ATOMIC_ACQUIRE);
+  if (size) {
+    const uint64_t buffer_size = __atomic_load_n(&ring->resize_buffer_size,
+        __ATOMIC_ACQUIRE);
+    *out = (struct imv_event) {
+      .type = IMV_EVENT_RESIZE,
+      .data = {
+        .resize = {
+          .width = (int)(size >> 32),
+          .height = (int)(uint32_t)size,
+          .buffer_width = (int)(buffer_size >> 32),
+          .buffer_height = (int)(uint32_t)buffer_size,
+        }
+      }
+    };
+    return true;
+  }
+
+  const int64_t dx = __atomic_exchange_n(&ring->scroll_dx, 0, __ATOMIC_RELAXED);
+  const int64_t dy = __atomic_exchange_n(&ring->scroll_dy, 0, __ATOMIC_RELAXED);
+  if (dx || dy) {
+    *out = (struct imv_event) {
+      .type = IMV_EVENT_MOUSE_SCROLL,
+      .data = {
+        .mouse_scroll = {
+          .dx = dx / SCROLL_FIXED_ONE,
+          .dy = dy / SCROLL_FIXED_ONE,
+        }
+      }
+    };
+    return true;
+  }
+
+  return false;
+}
+
+bool event_ring_push(struct event_ring *ring, const struct imv_event *event)
+{
+  while (!try_push(ring, event)) {
+    if (coalesce(ring, event)) {
+      break;
+    }
+    /* the consumer drains the ring every iteration; wait for it */
+    sched_yield();
+  }
+
+  /* first push since the consumer last slept gets to ring the doorbell */
+  return __atomic_exchange_n(&ring->armed, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+bool event_ring_pop(struct event_ring *ring, struct imv_event *out)
+{
+  if (try_pop(ring, out)) {
+    return true;
+  }
+  if (take_coalesced(ring, out)) {
+    return true;
+  }
+
+  /* Let the next push ring the doorbell again, then re-check: a push that
+   * slipped in before we disarmed didn't ring it */
+  __atomic_store_n(&ring->armed, 0, __ATOMIC_SEQ_CST);
+  return try_pop(ring, out) || take_coalesced(ring, out);
+}
+
+/* vim:set ts=2 sts=2 sw=2 et: */
@@ -0,0 +1,33 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdbool.h>
+
+#include "window.h"
+
+/* Bounded lock-free multi-producer single-consumer queue of imv_events,
+ * shared by the window backends. Producers are the input callbacks, the
+ * loader threads and the ipc thread; the consumer is the main loop's event
+ * pump. When the ring is full, repeated scroll and resize events are
+ * coalesced instead of queued; other events wait for space.
+ */
+struct event_ring;
+
+/* Create an event ring */
+struct event_ring *event_ring_create(void);
+
+/* Clean up an event ring. Any events still queued are not cleaned up */
+void event_ring_free(struct event_ring *ring);
+
+/* Enqueue a copy of the given event. Safe to call from any thread. Returns
+ * true if the consumer needs waking, i.e. exactly once per batch of pushes
+ * between pops, so the caller's wakeup doorbell is rung once, not per event
+ */
+bool event_ring_push(struct event_ring *ring, const struct imv_event *event);
+
+/* Dequeue an event into out, returning false if the ring is empty. Must
+ * only be called from the consumer thread
+ */
+bool event_ring_pop(struct event_ring *ring, struct imv_event *out);
+
+#endif
@@ -8,6 +8,12 @@ struct imv_image {
   int width;
   int height;
   struct imv_bitmap *bitmap;
+  /* optional full-resolution region decoder; bitmap is then a reduced
+   * decode of a full_width x full_height image */
+  const struct imv_image_region_vtable *region_vt;
+  void *region_data;
+  int full_width;
+  int full_height;
   #ifdef IMV_BACKEND_LIBRSVG
   RsvgHandle *svg;
   #endif
@@ -36,14 +42,33 @@ struct imv_image *imv_image_create_from_svg(RsvgHandle *handle)
 }
 #endif
 
+void imv_image_set_region_provider(struct imv_image *image,
+    const struct imv_image_region_vtable *vt, void *data,
+    int full_width, int full_height)
+{
+  image->region_vt = vt;
+  image->region_data = data;
+  image->full_width = full_width;
+  image->full_height = full_height;
+}
+
+bool imv_image_has_regions(const struct imv_image *image)
+{
+  return image && image->region_vt;
+}
+
 void imv_image_free(struct imv_image *image)
 {
   if (!image) {
     return;
   }
 
+  if (image->region_vt && image->region_vt->free) {
+    image->region_vt->free(image->region_data);
+  }
+
   if (image->bitmap) {
-    imv_bitmap_free(image->bitmap);
+    imv_bitmap_unref(image->bitmap);
   }
 
 #ifdef IMV_BACKEND_LIBRSVG
@@ -72,6 +97,22 @@ struct imv_bitmap *imv_image_get_bitmap(const struct imv_image *image)
   return image->bitmap;
 }
 
+int imv_image_full_width(const struct imv_image *image)
+{
+  return image->full_width;
+}
+
+int imv_image_full_height(const struct imv_image *image)
+{
+  return image->full_height;
+}
+
+struct imv_bitmap *imv_image_load_region(const struct imv_image *image,
+    int x, int y, int width, int height)
+{
+  return image->region_vt->load_region(image->region_data, x, y, width, height);
+}
+
 #ifdef IMV_BACKEND_LIBRSVG
 RsvgHandle *imv_image_get_svg(const struct imv_image *image)
 {
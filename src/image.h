@@ -3,14 +3,38 @@
 
 #include "bitmap.h"
 
+#include <stdbool.h>
+
 #ifdef IMV_BACKEND_LIBRSVG
 #include <librsvg/rsvg.h>
 #endif
 
 struct imv_image;
 
+/* Implemented by backends that can decode an arbitrary rectangle of the
+ * image at full resolution, without materialising the whole thing */
+struct imv_image_region_vtable {
+  /* Decode the given rectangle into a new bitmap, or NULL on failure */
+  struct imv_bitmap *(*load_region)(void *data, int x, int y, int width, int height);
+
+  /* Clean up the provider's data */
+  void (*free)(void *data);
+};
+
 struct imv_image *imv_image_create_from_bitmap(struct imv_bitmap *bmp);
 
+/* Attach a region decoder to an image whose bitmap is a reduced-resolution
+ * decode. full_width/full_height are the image's true dimensions. The
+ * provider is owned by the image and freed along with it. When zoomed in
+ * past the reduced bitmap's detail, the canvas renders by decoding only
+ * the regions on screen instead of asking for a full-size re-decode. */
+void imv_image_set_region_provider(struct imv_image *image,
+    const struct imv_image_region_vtable *vt, void *data,
+    int full_width, int full_height);
+
+/* Whether the image carries a region decoder */
+bool imv_image_has_regions(const struct imv_image *image);
+
 #ifdef IMV_BACKEND_LIBRSVG
 struct imv_image *imv_image_create_from_svg(RsvgHandle *handle);
 #endif
@@ -1,13 +1,22 @@
+/* for dirent.d_type */
+#define _DEFAULT_SOURCE
+
 #include "imv.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 #include <wordexp.h>
@@ -23,8 +32,13 @@
 #include "list.h"
 #include "log.h"
 #include "navigator.h"
+#include "session_index.h"
+#include "shm_cache.h"
 #include "source.h"
+#include "thumbs.h"
+#include "trace.h"
 #include "viewport.h"
+#include "watcher.h"
 #include "window.h"
 
 /* Some systems like GNU/Hurd don't define PATH_MAX */
@@ -49,6 +63,8 @@ enum internal_event_type {
   NEW_IMAGE,
   BAD_IMAGE,
   NEW_PATH,
+  SCAN_DONE,
+  NEW_MEMORY,
   COMMAND
 };
 
@@ -56,19 +72,70 @@ struct internal_event {
   enum internal_event_type type;
   union {
     struct {
+      struct imv_source *source;
       struct imv_image *image;
       int frametime;
-      bool is_new_image;
+      bool partial;
     } new_image;
+    struct {
+      struct imv_source *source;
+    } bad_image;
     struct {
       char *path;
     } new_path;
     struct {
+      void *data;
+      size_t len;
+    } new_memory;
+    struct {
+      /* one or more newline-separated commands, run as one transaction */
       char *text;
+      /* socket to acknowledge on once they've run, or -1 */
+      int ack_fd;
     } command;
   } data;
 };
 
+/* Thumbnails in the gallery's contact sheet are decoded to fit this size */
+#define GALLERY_THUMB_SIZE 256
+
+/* Selection changes closer together than this, landing while a decode is
+ * still in flight, mean a held navigation key */
+#define SCRUB_WINDOW 0.2
+/* While a navigation key is held, decode one image in this many; the rest
+ * flash past as titles only */
+#define SCRUB_STRIDE 3
+/* A held key has been released once navigation is quiet this long */
+#define SCRUB_SETTLE 0.25
+/* Size of one gallery cell, including its padding */
+#define GALLERY_CELL_SIZE 160
+#define GALLERY_CELL_PADDING 10
+
+/* A small preview of one navigator entry, shown in the gallery */
+struct gallery_thumb {
+  char *path;
+  struct imv_source *source; /* in-flight decode, NULL once finished */
+  struct imv_bitmap *bitmap; /* NULL until decoded */
+  bool failed;
+  double last_drawn; /* when this thumb was last on screen */
+};
+
+/* A navigator entry decoded (or decoding) ahead of it being selected */
+struct prefetch_item {
+  char *path;
+  struct imv_source *source;
+  struct imv_image *image;
+  int frametime;
+  /* whether image is a partially-decoded preview, with more to follow */
+  bool image_partial;
+  /* whether the source accepted a reduced-resolution decode hint */
+  bool scaled;
+  /* requested via the prefetch command; survives navigation rather than
+   * being evicted when it falls outside the decode-ahead range */
+  bool pinned;
+  double last_used; /* when this entry was decoded, for budget eviction */
+};
+
 struct imv {
   /* set to true to trigger clean exit */
   bool quit;
@@ -76,6 +143,20 @@ struct imv {
   /* indicates a new image is being loaded */
   bool loading;
 
+  /* a held navigation key: selection changes arriving faster than decodes
+   * finish. While scrubbing, only every SCRUB_STRIDE'th image is decoded,
+   * at reduced size, and a full decode of wherever the user stops is
+   * snapped once the key goes quiet. */
+  struct {
+    bool active;
+    double last_nav; /* when the selection last changed */
+    int skipped;     /* images passed over since the last decode */
+  } scrub;
+
+  /* the current source decoded at a reduced resolution, and can be asked
+   * to re-decode at full resolution if the user zooms in far enough */
+  bool current_source_scaled;
+
   /* initial fullscreen state */
   bool start_fullscreen;
 
@@ -89,10 +170,33 @@ struct imv {
   /* method for scaling up images: interpolate or nearest neighbour */
   enum upscaling_method upscaling_method;
 
+  /* method for scaling down images: linear, mipmap or lanczos */
+  enum downscaling_method downscaling_method;
+
+  /* which GL path the canvas renders with */
+  enum canvas_renderer canvas_renderer;
+
   /* dirty state flags */
   bool need_redraw;
   bool need_rescale;
 
+  /* the window can't be seen at all; rendering and animation pause until
+   * it reappears */
+  bool hidden;
+
+  /* the release_hidden option: drop decoded images and GPU caches while
+   * hidden, reloading them on expose */
+  bool release_hidden;
+
+  /* the most recent resize event; an interactive resize delivers dozens
+   * per second, so only the latest geometry is applied, at most once per
+   * rendered frame */
+  struct {
+    bool pending;
+    int width, height;
+    int buffer_width, buffer_height;
+  } resize;
+
   /* traverse sub-directories for more images */
   bool recursive_load;
 
@@ -105,6 +209,26 @@ struct imv {
   /* read paths from stdin, as opposed to image data */
   bool paths_from_stdin;
 
+  /* the stdin path reader runs until its writing end closes; joined at
+   * shutdown so it can't push events to a freed window */
+  pthread_t stdin_reader;
+  bool stdin_reader_running;
+
+  /* directories given at startup, scanned in the background once the
+   * window is open so a large tree doesn't delay the first image */
+  struct list *pending_scans;
+
+  /* starting_path wasn't found at startup; retry as scanned paths arrive */
+  bool starting_path_pending;
+
+  /* the session_index option: persist the path list between runs over the
+   * same directories, restoring it instantly at startup */
+  bool use_session_index;
+
+  /* the restored path list being reconciled by the background scan, or
+   * NULL when the option is off or no directories were given */
+  struct imv_session_index *session_index;
+
   /* scale up / down images to match window, or actual size */
   enum scaling_mode scaling_mode;
 
@@ -125,6 +249,17 @@ struct imv {
     double elapsed;
   } slideshow;
 
+  /* timerfds merged into the window's poll set, so animation frames and
+   * slideshow advances fire with timer precision and an idle viewer
+   * showing a static image doesn't wake at all */
+  struct {
+    int animation_fd;
+    int slideshow_fd;
+    /* the armed deadlines in cur_time() terms, 0 when disarmed */
+    double animation_due;
+    double slideshow_due;
+  } timers;
+
   struct {
     /* for animated images, the getTime() time to display the next frame */
     double due;
@@ -138,6 +273,18 @@ struct imv {
 
   struct imv_image *current_image;
 
+  /* decode-ahead cache of the navigator entries adjacent to the current one */
+  struct {
+    /* how many entries each side of the current one to decode in advance */
+    int depth;
+    /* list of prefetch_items, one per entry being decoded ahead */
+    struct list *items;
+  } prefetch;
+
+  /* decoded frames shared with other running instances, or NULL when the
+   * shared_cache option is off */
+  struct imv_shm_cache *shm_cache;
+
   /* overlay font */
   struct {
     char *name;
@@ -154,6 +301,26 @@ struct imv {
   char *title_text;
   char *overlay_text;
 
+  /* cached expansions of title_text and overlay_text. Generating them sets a
+   * dozen environment variables and runs wordexp, so it's only redone when
+   * one of the inputs below changes, never on the per-frame render path. */
+  struct {
+    bool valid;
+    char title[1024];
+    char overlay[1024];
+    /* snapshot of the state the text was generated from */
+    char path[1024];
+    size_t index;
+    size_t file_count;
+    bool loading;
+    int width, height;
+    int scale;
+    enum scaling_mode scaling_mode;
+    double slideshow_duration;
+    double slideshow_elapsed;
+    size_t memory_mb;
+  } env_text;
+
   /* imv subsystems */
   struct imv_binds *binds;
   struct imv_navigator *navigator;
@@ -166,10 +333,63 @@ struct imv {
   struct imv_viewport *view;
   struct imv_canvas *canvas;
   struct imv_window *window;
+  struct imv_watcher *watcher;
+
+  /* persistent freedesktop thumbnail cache, NULL when unsupported */
+  struct imv_thumbs *thumbs;
+  /* in-flight decode of a cached thumbnail preview, if any */
+  struct imv_source *thumb_source;
+
+  /* gallery (contact sheet) mode */
+  struct {
+    bool active;
+    int columns; /* computed during rendering, used for row navigation */
+    int scroll;  /* first visible row */
+    struct list *thumbs; /* gallery_thumb entries, decoded on demand */
+    double last_render; /* thumbs drawn at this time are on screen */
+  } gallery;
+
+  /* cap on decoded bitmap memory; caches are evicted
+   * least-recently-displayed first when the total exceeds it */
+  struct {
+    size_t budget; /* bytes, 0 for unlimited */
+  } memory;
 
-  /* if reading an image from stdin, this is the buffer for it */
+  /* path to the display's ICC profile, for colour management; NULL for
+   * sRGB */
+  char *display_profile;
+
+  /* hot-path timing, surfaced as imv_*_ms env text variables and via the
+   * live HUD toggled by the 'perf' command */
+  struct {
+    bool hud;
+    double open_ms;    /* last backend open_path call */
+    double load_ms;    /* kicking off the last decode to its arrival */
+    double load_start; /* when the in-flight decode was requested */
+    double event_ms;   /* consuming the last NEW_IMAGE event */
+    double frame_ms;   /* rendering the previous frame */
+  } perf;
+
+  /* what the previous frame drew beneath the canvas overlay, to tell
+   * whether a redraw changed only the overlay; if so, just the canvas'
+   * dirty rectangle is sent to the compositor as damage */
+  struct {
+    bool valid;
+    bool dirty; /* force the next frame to count as fully changed */
+    struct imv_image *image;
+    int x, y;
+    double scale;
+    enum upscaling_method upscaling_method;
+    enum downscaling_method downscaling_method;
+    enum background_type bg_type;
+    struct { unsigned char r, g, b; } bg_color;
+  } last_scene;
+
+  /* if reading an image from stdin, this is the buffer for it; it's an
+   * mmap mapping instead when the image arrived as an fd over ipc */
   void *stdin_image_data;
   size_t stdin_image_data_len;
+  bool stdin_image_data_mapped;
 };
 
 static void command_quit(struct list *args, const char *argstr, void *data);
@@ -189,15 +409,35 @@ static void command_next_frame(struct list *args, const char *argstr, void *data
 static void command_toggle_playing(struct list *args, const char *argstr, void *data);
 static void command_set_scaling_mode(struct list *args, const char *argstr, void *data);
 static void command_set_upscaling_method(struct list *args, const char *argstr, void *data);
+static void command_set_downscaling_method(struct list *args, const char *argstr, void *data);
 static void command_set_slideshow_duration(struct list *args, const char *argstr, void *data);
 static void command_set_background(struct list *args, const char *argstr, void *data);
 static void command_bind(struct list *args, const char *argstr, void *data);
+static void command_gallery(struct list *args, const char *argstr, void *data);
+static void command_perf(struct list *args, const char *argstr, void *data);
+static void command_prefetch(struct list *args, const char *argstr, void *data);
+static void command_drop_cache(struct list *args, const char *argstr, void *data);
+static void command_sort(struct list *args, const char *argstr, void *data);
 
 static bool setup_window(struct imv *imv);
 static void consume_internal_event(struct imv *imv, struct internal_event *event);
+static enum backend_result open_source(struct imv *imv, const char *path,
+    struct imv_source **src);
+static void source_callback(struct imv_source_message *msg);
+static void handle_new_image(struct imv *imv, struct imv_image *image,
+    int frametime, bool partial);
+static struct prefetch_item *prefetch_take(struct imv *imv, const char *path);
+static struct prefetch_item *prefetch_find_source(struct imv *imv,
+    struct imv_source *source);
+static void prefetch_item_free(struct prefetch_item *item);
+static void prefetch_update(struct imv *imv);
+static void prefetch_start(struct imv *imv, const char *path, bool pinned);
+static size_t decoded_memory_usage(struct imv *imv);
+static void enforce_memory_budget(struct imv *imv);
 static void render_window(struct imv *imv);
 static void update_env_vars(struct imv *imv);
 static size_t generate_env_text(struct imv *imv, char *buf, size_t len, const char *format);
+static void update_env_text(struct imv *imv);
 static size_t read_from_stdin(void **buffer);
 
 /* Finds the next split between commands in a string (';'). Provides a pointer
@@ -317,33 +557,55 @@ static double cur_time(void)
   return ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
 }
 
-static void source_callback(struct imv_source_message *msg)
+/* (Re)arm a timerfd to fire at the given cur_time() deadline, or disarm it
+ * when due is 0. No-op while the armed deadline is unchanged, so a steady
+ * timer doesn't cost a syscall per loop iteration.
+ */
+static void arm_timer(int fd, double *armed, double due)
 {
-  struct imv *imv = msg->user_data;
-  if (msg->source != imv->current_source) {
-    /* We received a message from an old source, tidy up contents
-     * as required, but ignore it.
-     */
-    if (msg->image) {
-      imv_image_free(msg->image);
-    }
+  const double drift = due - *armed;
+  if (drift < 0.0005 && drift > -0.0005) {
     return;
   }
 
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof spec);
+  if (due != 0.0) {
+    spec.it_value.tv_sec = (time_t)due;
+    spec.it_value.tv_nsec = (long)((due - (double)spec.it_value.tv_sec) * 1e9);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+      /* an all-zero value would disarm; fire immediately instead */
+      spec.it_value.tv_nsec = 1;
+    }
+  }
+  timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL);
+  *armed = due;
+}
+
+/* Consume a fired timer so it doesn't stay readable and spin the poll */
+static void drain_timer(int fd)
+{
+  uint64_t expirations;
+  read(fd, &expirations, sizeof expirations);
+}
+
+static void source_callback(struct imv_source_message *msg)
+{
+  struct imv *imv = msg->user_data;
+
+  /* Sort out whether this source is current, prefetched, or stale on the
+   * main thread, where we can safely inspect our own state.
+   */
   struct internal_event *event = calloc(1, sizeof *event);
   if (msg->image) {
     event->type = NEW_IMAGE;
+    event->data.new_image.source = msg->source;
     event->data.new_image.image = msg->image;
     event->data.new_image.frametime = msg->frametime;
-
-    /* Keep track of the last source to send us an image in order to detect
-     * when we're getting a new image, as opposed to a new frame from the
-     * same image.
-     */
-    event->data.new_image.is_new_image = msg->source != imv->last_source;
-    imv->last_source = msg->source;
+    event->data.new_image.partial = msg->partial;
   } else {
     event->type = BAD_IMAGE;
+    event->data.bad_image.source = msg->source;
   }
 
   struct imv_event e = {
@@ -356,13 +618,73 @@ static void source_callback(struct imv_source_message *msg)
   imv_window_push_event(imv->window, &e);
 }
 
-static void command_callback(const char *text, void *data)
+/* Defined in image.c, non-public */
+struct imv_bitmap *imv_image_get_bitmap(const struct imv_image *image);
+
+static void drop_thumb_source(struct imv *imv)
+{
+  if (imv->thumb_source) {
+    imv_source_async_free(imv->thumb_source);
+    imv->thumb_source = NULL;
+  }
+}
+
+static void release_stdin_image_data(struct imv *imv)
+{
+  if (!imv->stdin_image_data) {
+    return;
+  }
+  if (imv->stdin_image_data_mapped) {
+    munmap(imv->stdin_image_data, imv->stdin_image_data_len);
+  } else {
+    free(imv->stdin_image_data);
+  }
+  imv->stdin_image_data = NULL;
+  imv->stdin_image_data_len = 0;
+  imv->stdin_image_data_mapped = false;
+}
+
+static void ipc_fd_callback(const char *command, int fd, void *data)
 {
+  (void)command;
   struct imv *imv = data;
 
+  struct stat info;
+  if (fstat(fd, &info) == -1 || info.st_size == 0) {
+    imv_log(IMV_ERROR, "Unable to read memory passed over ipc\n");
+    close(fd);
+    return;
+  }
+
+  /* Map the client's memory rather than copying it; backends decode
+   * directly out of the mapping via open_memory */
+  void *mem = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    imv_log(IMV_ERROR, "Unable to map memory passed over ipc\n");
+    return;
+  }
+
+  struct internal_event *event = calloc(1, sizeof *event);
+  event->type = NEW_MEMORY;
+  event->data.new_memory.data = mem;
+  event->data.new_memory.len = info.st_size;
+
+  struct imv_event e = {
+    .type = IMV_EVENT_CUSTOM,
+    .data = {
+      .custom = event
+    }
+  };
+  imv_window_push_event(imv->window, &e);
+}
+
+static void queue_commands(struct imv *imv, const char *text, int ack_fd)
+{
   struct internal_event *event = calloc(1, sizeof *event);
   event->type = COMMAND;
   event->data.command.text = strdup(text);
+  event->data.command.ack_fd = ack_fd;
 
   struct imv_event e = {
     .type = IMV_EVENT_CUSTOM,
@@ -373,6 +695,16 @@ static void command_callback(const char *text, void *data)
   imv_window_push_event(imv->window, &e);
 }
 
+static void command_callback(const char *text, void *data)
+{
+  queue_commands(data, text, -1);
+}
+
+static void ipc_command_callback(const char *text, int ack_fd, void *data)
+{
+  queue_commands(data, text, ack_fd);
+}
+
 static void key_handler(struct imv *imv, const struct imv_event *event)
 {
   if (imv_console_is_active(imv->console)) {
@@ -397,7 +729,15 @@ static void key_handler(struct imv *imv, const struct imv_event *event)
 
     struct list *cmds = imv_bind_handle_event(imv->binds, event->data.keyboard.description);
     if (cmds) {
-      imv_command_exec_list(imv->commands, cmds, imv);
+      for (size_t i = 0; i < cmds->len; ++i) {
+        struct imv_bind_command *cmd = cmds->items[i];
+        if (cmd->cache) {
+          imv_command_exec_cached(cmd->cache, imv);
+        } else {
+          /* bound before the command was registered, parse it now */
+          imv_command_exec(imv->commands, cmd->text, imv);
+        }
+      }
     }
   }
 
@@ -405,23 +745,77 @@ static void key_handler(struct imv *imv, const struct imv_event *event)
 }
 
 
+static void handle_visibility(struct imv *imv, bool visible)
+{
+  if (visible == !imv->hidden) {
+    return;
+  }
+  imv->hidden = !visible;
+
+  if (!visible) {
+    if (!imv->release_hidden) {
+      return;
+    }
+    /* Drop everything rebuildable: decode-ahead entries (pinned ones were
+     * asked for explicitly and stay), idle gallery thumbnails, the GPU
+     * caches, and the decoded image itself. Its source stays open, so the
+     * expose reload costs one decode, not a fresh open. */
+    for (size_t i = imv->prefetch.items->len; i > 0; --i) {
+      struct prefetch_item *item = imv->prefetch.items->items[i - 1];
+      if (!item->pinned) {
+        prefetch_item_free(item);
+        list_remove(imv->prefetch.items, i - 1);
+      }
+    }
+    for (size_t i = imv->gallery.thumbs->len; i > 0; --i) {
+      struct gallery_thumb *thumb = imv->gallery.thumbs->items[i - 1];
+      if (thumb->source) {
+        /* still decoding; leave it for its result to land in */
+        continue;
+      }
+      if (thumb->bitmap) {
+        imv_bitmap_unref(thumb->bitmap);
+      }
+      free(thumb->path);
+      free(thumb);
+      list_remove(imv->gallery.thumbs, i - 1);
+    }
+    imv_canvas_drop_caches(imv->canvas);
+    /* an animation keeps its frame; its state can't be rebuilt by a
+     * first-frame reload */
+    if (imv->current_image && imv->current_source
+        && imv->next_frame.due == 0.0 && !imv->loading) {
+      imv_image_free(imv->current_image);
+      imv->current_image = NULL;
+    }
+  } else {
+    imv->need_redraw = true;
+    imv->last_scene.dirty = true;
+    if (imv->release_hidden) {
+      if (imv->current_source && !imv->current_image && !imv->loading) {
+        imv_source_async_load_first_frame(imv->current_source);
+        imv->loading = true;
+      }
+      prefetch_update(imv);
+    }
+  }
+}
+
 static void event_handler(void *data, const struct imv_event *e)
 {
   struct imv *imv = data;
+  imv_trace_begin("consume_event");
   switch (e->type) {
     case IMV_EVENT_CLOSE:
       imv->quit = true;
       break;
     case IMV_EVENT_RESIZE:
-      {
-        const int ww = e->data.resize.width;
-        const int wh = e->data.resize.height;
-        const int bw = e->data.resize.buffer_width;
-        const int bh = e->data.resize.buffer_height;
-        imv_viewport_update(imv->view, ww, wh, bw, bh, imv->current_image, imv->scaling_mode);
-        imv_canvas_resize(imv->canvas, bw, bh);
-        break;
-      }
+      imv->resize.pending = true;
+      imv->resize.width = e->data.resize.width;
+      imv->resize.height = e->data.resize.height;
+      imv->resize.buffer_width = e->data.resize.buffer_width;
+      imv->resize.buffer_height = e->data.resize.buffer_height;
+      break;
     case IMV_EVENT_KEYBOARD:
       key_handler(imv, e);
       break;
@@ -439,13 +833,16 @@ static void event_handler(void *data, const struct imv_event *e)
             x, y, -e->data.mouse_scroll.dy);
       }
       break;
+    case IMV_EVENT_VISIBILITY:
+      handle_visibility(imv, e->data.visibility.visible);
+      break;
     case IMV_EVENT_CUSTOM:
       consume_internal_event(imv, e->data.custom);
       break;
     default:
       break;
   }
-
+  imv_trace_end("consume_event");
 }
 
 static void log_to_stderr(enum imv_log_level level, const char *text, void *data)
@@ -461,6 +858,9 @@ struct imv *imv_create(void)
   /* Attach log to stderr */
   imv_log_add_log_callback(&log_to_stderr, NULL);
 
+  /* Start recording trace spans if $IMV_TRACE asks for them */
+  imv_trace_init();
+
   struct imv *imv = calloc(1, sizeof *imv);
   imv->initial_width = 1280;
   imv->initial_height = 720;
@@ -468,16 +868,28 @@ struct imv *imv_create(void)
   imv->need_rescale = true;
   imv->scaling_mode = SCALING_FULL;
   imv->loop_input = true;
+  imv->memory.budget = (size_t)512 * 1024 * 1024;
+  imv->timers.animation_fd =
+    timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  imv->timers.slideshow_fd =
+    timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
   imv->font.name = strdup("Monospace");
   imv->font.size = 24;
   imv->binds = imv_binds_create();
   imv->navigator = imv_navigator_create();
+  imv->watcher = imv_watcher_create();
+  imv->thumbs = imv_thumbs_create();
+  imv->prefetch.items = list_create();
+  imv->pending_scans = list_create();
+  imv->gallery.thumbs = list_create();
   imv->backends = list_create();
   imv->commands = imv_commands_create();
+  imv_binds_set_commands(imv->binds, imv->commands);
   imv->console = imv_console_create();
   imv_console_set_command_callback(imv->console, &command_callback, imv);
   imv->ipc = imv_ipc_create();
-  imv_ipc_set_command_callback(imv->ipc, &command_callback, imv);
+  imv_ipc_set_command_callback(imv->ipc, &ipc_command_callback, imv);
+  imv_ipc_set_fd_callback(imv->ipc, &ipc_fd_callback, imv);
   imv->title_text = strdup(
       "imv - [${imv_current_index}/${imv_file_count}]"
       " [${imv_width}x${imv_height}] [${imv_scale}%]"
@@ -507,9 +919,15 @@ struct imv *imv_create(void)
   imv_command_register(imv->commands, "toggle_playing", &command_toggle_playing);
   imv_command_register(imv->commands, "scaling", &command_set_scaling_mode);
   imv_command_register(imv->commands, "upscaling", &command_set_upscaling_method);
+  imv_command_register(imv->commands, "downscaling", &command_set_downscaling_method);
   imv_command_register(imv->commands, "slideshow", &command_set_slideshow_duration);
   imv_command_register(imv->commands, "background", &command_set_background);
   imv_command_register(imv->commands, "bind", &command_bind);
+  imv_command_register(imv->commands, "gallery", &command_gallery);
+  imv_command_register(imv->commands, "perf", &command_perf);
+  imv_command_register(imv->commands, "prefetch", &command_prefetch);
+  imv_command_register(imv->commands, "drop-cache", &command_drop_cache);
+  imv_command_register(imv->commands, "sort", &command_sort);
 
   imv_command_alias(imv->commands, "q", "quit");
   imv_command_alias(imv->commands, "n", "next");
@@ -555,20 +973,54 @@ struct imv *imv_create(void)
   add_bind(imv, "<space>", "toggle_playing");
   add_bind(imv, "t", "slideshow +1");
   add_bind(imv, "<Shift+T>", "slideshow -1");
+  add_bind(imv, "<Return>", "gallery");
 
   return imv;
 }
 
 void imv_free(struct imv *imv)
 {
+  close(imv->timers.animation_fd);
+  close(imv->timers.slideshow_fd);
   free(imv->font.name);
   free(imv->title_text);
   free(imv->overlay_text);
+  free(imv->display_profile);
   imv_binds_free(imv->binds);
   imv_navigator_free(imv->navigator);
+  imv_watcher_free(imv->watcher);
+  if (imv->thumb_source) {
+    imv_source_free(imv->thumb_source);
+  }
+  imv_thumbs_free(imv->thumbs);
   if (imv->current_source) {
     imv_source_free(imv->current_source);
   }
+  for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+    struct prefetch_item *item = imv->prefetch.items->items[i];
+    imv_source_free(item->source);
+    if (item->image) {
+      imv_image_free(item->image);
+    }
+    free(item->path);
+    free(item);
+  }
+  list_free(imv->prefetch.items);
+  imv_shm_cache_free(imv->shm_cache);
+  for (size_t i = 0; i < imv->gallery.thumbs->len; ++i) {
+    struct gallery_thumb *thumb = imv->gallery.thumbs->items[i];
+    if (thumb->source) {
+      imv_source_free(thumb->source);
+    }
+    if (thumb->bitmap) {
+      imv_bitmap_unref(thumb->bitmap);
+    }
+    free(thumb->path);
+    free(thumb);
+  }
+  list_free(imv->gallery.thumbs);
+  list_deep_free(imv->pending_scans);
+  imv_session_index_free(imv->session_index);
   imv_commands_free(imv->commands);
   imv_console_free(imv->console);
   imv_ipc_free(imv->ipc);
@@ -580,8 +1032,12 @@ void imv_free(struct imv *imv)
   if (imv->next_frame.image) {
     imv_image_free(imv->next_frame.image);
   }
-  if (imv->stdin_image_data) {
-    free(imv->stdin_image_data);
+  release_stdin_image_data(imv);
+  if (imv->stdin_reader_running) {
+    /* the reader blocks in fgets until the writing end closes; cancel it
+     * rather than leave it racing against the window teardown below */
+    pthread_cancel(imv->stdin_reader);
+    pthread_join(imv->stdin_reader, NULL);
   }
   if (imv->window) {
     imv_window_free(imv->window);
@@ -591,6 +1047,8 @@ void imv_free(struct imv *imv)
 
   list_free(imv->startup_commands);
 
+  imv_trace_finish();
+
   free(imv);
 }
 
@@ -667,6 +1125,46 @@ static bool parse_upscaling_method(struct imv *imv, const char *method)
   return false;
 }
 
+static bool parse_downscaling_method(struct imv *imv, const char *method)
+{
+  if (!strcmp(method, "linear")) {
+    imv->downscaling_method = DOWNSCALING_LINEAR;
+    return true;
+  }
+
+  if (!strcmp(method, "mipmap")) {
+    imv->downscaling_method = DOWNSCALING_MIPMAP;
+    return true;
+  }
+
+  if (!strcmp(method, "lanczos")) {
+    imv->downscaling_method = DOWNSCALING_LANCZOS;
+    return true;
+  }
+
+  return false;
+}
+
+static bool parse_renderer(struct imv *imv, const char *renderer)
+{
+  if (!strcmp(renderer, "auto")) {
+    imv->canvas_renderer = RENDERER_AUTO;
+    return true;
+  }
+
+  if (!strcmp(renderer, "legacy")) {
+    imv->canvas_renderer = RENDERER_LEGACY;
+    return true;
+  }
+
+  if (!strcmp(renderer, "shader")) {
+    imv->canvas_renderer = RENDERER_SHADER;
+    return true;
+  }
+
+  return false;
+}
+
 static bool parse_initial_pan(struct imv *imv, const char *pan_params)
 {
   char *next_val;
@@ -686,11 +1184,25 @@ static void *load_paths_from_stdin(void *data)
   imv_log(IMV_INFO, "Reading paths from stdin...");
 
   char buf[PATH_MAX];
+  bool discarding = false;
   while (fgets(buf, sizeof(buf), stdin) != NULL) {
     size_t len = strlen(buf);
-    if (buf[len-1] == '\n') {
+    const bool complete = len > 0 && buf[len-1] == '\n';
+    if (complete) {
       buf[--len] = 0;
     }
+    if (discarding) {
+      /* remainder of an overlong line; keep dropping until its newline */
+      discarding = !complete;
+      continue;
+    }
+    if (!complete && len + 1 == sizeof buf) {
+      /* no valid path is this long; drop the whole line rather than
+       * treat each buffer-sized chunk of it as a separate path */
+      imv_log(IMV_WARNING, "Ignoring overlong line read from stdin\n");
+      discarding = true;
+      continue;
+    }
     if (len > 0) {
       struct internal_event *event = calloc(1, sizeof *event);
       event->type = NEW_PATH;
@@ -708,6 +1220,196 @@ static void *load_paths_from_stdin(void *data)
   return NULL;
 }
 
+static void push_new_path(struct imv *imv, const char *path)
+{
+  struct internal_event *event = calloc(1, sizeof *event);
+  event->type = NEW_PATH;
+  event->data.new_path.path = strdup(path);
+
+  struct imv_event e = {
+    .type = IMV_EVENT_CUSTOM,
+    .data = {
+      .custom = event
+    }
+  };
+  imv_window_push_event(imv->window, &e);
+}
+
+/* Decide whether an entry is a directory without a stat() syscall where the
+ * filesystem fills in d_type, falling back to stat() where it doesn't */
+static bool entry_is_dir(const char *path, const struct dirent *entry)
+{
+#ifndef DT_DIR
+  (void)entry;
+#else
+  if (entry->d_type == DT_DIR) {
+    return true;
+  }
+  if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+    return false;
+  }
+#endif
+  struct stat path_info;
+  if (stat(path, &path_info)) {
+    return false;
+  }
+  return S_ISDIR(path_info.st_mode);
+}
+
+/* Walk the subtree rooted at path, appending every file found to results
+ * in traversal order */
+static void scan_tree(struct imv *imv, const char *path, struct list *results)
+{
+  char path_buf[PATH_MAX+1];
+  DIR *d = opendir(path);
+  if (!d) {
+    return;
+  }
+  struct dirent *dir;
+  while ((dir = readdir(d)) != NULL) {
+    if (strcmp(dir->d_name, "..") == 0 || strcmp(dir->d_name, ".") == 0) {
+      continue;
+    }
+    snprintf(path_buf, sizeof path_buf, "%s/%s", path, dir->d_name);
+    if (entry_is_dir(path_buf, dir)) {
+      if (imv->recursive_load) {
+        scan_tree(imv, path_buf, results);
+      }
+    } else {
+      list_append(results, strdup(path_buf));
+    }
+  }
+  closedir(d);
+}
+
+#define SCAN_WORKERS 4
+
+/* One job per first-level entry of a directory given at startup: a file
+ * entry's result is just itself, a directory entry's result is its whole
+ * subtree. Workers claim jobs in order; the merge emits each job's results
+ * in job order, so the stream matches a sequential traversal. */
+struct scan_job {
+  char *path;
+  bool is_dir;
+  struct list *results;
+  bool done;
+};
+
+struct scan_state {
+  struct imv *imv;
+  struct list *jobs;
+  size_t next_job;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+static void *scan_worker(void *data)
+{
+  struct scan_state *state = data;
+
+  while (true) {
+    pthread_mutex_lock(&state->mutex);
+    if (state->next_job >= state->jobs->len) {
+      pthread_mutex_unlock(&state->mutex);
+      break;
+    }
+    struct scan_job *job = state->jobs->items[state->next_job++];
+    pthread_mutex_unlock(&state->mutex);
+
+    if (job->is_dir) {
+      scan_tree(state->imv, job->path, job->results);
+    } else {
+      list_append(job->results, strdup(job->path));
+    }
+
+    pthread_mutex_lock(&state->mutex);
+    job->done = true;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+  }
+  return NULL;
+}
+
+/* Walks the directories given at startup across a small worker pool,
+ * streaming each file found back to the main thread as a NEW_PATH event,
+ * so the navigator fills in while the first image is already on screen */
+static void *scan_paths_thread(void *data)
+{
+  struct imv *imv = data;
+  struct scan_state state = {
+    .imv = imv,
+    .jobs = list_create(),
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+  };
+
+  char path_buf[PATH_MAX+1];
+  for (size_t i = 0; i < imv->pending_scans->len; ++i) {
+    const char *root = imv->pending_scans->items[i];
+    DIR *d = opendir(root);
+    if (!d) {
+      continue;
+    }
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL) {
+      if (strcmp(dir->d_name, "..") == 0 || strcmp(dir->d_name, ".") == 0) {
+        continue;
+      }
+      snprintf(path_buf, sizeof path_buf, "%s/%s", root, dir->d_name);
+      const bool is_dir = entry_is_dir(path_buf, dir);
+      if (is_dir && !imv->recursive_load) {
+        continue;
+      }
+      struct scan_job *job = calloc(1, sizeof *job);
+      job->path = strdup(path_buf);
+      job->is_dir = is_dir;
+      job->results = list_create();
+      list_append(state.jobs, job);
+    }
+    closedir(d);
+  }
+
+  pthread_t workers[SCAN_WORKERS];
+  for (size_t i = 0; i < SCAN_WORKERS; ++i) {
+    pthread_create(&workers[i], NULL, scan_worker, &state);
+  }
+
+  /* emit each job's results in job order as soon as it completes */
+  for (size_t i = 0; i < state.jobs->len; ++i) {
+    struct scan_job *job = state.jobs->items[i];
+    pthread_mutex_lock(&state.mutex);
+    while (!job->done) {
+      pthread_cond_wait(&state.cond, &state.mutex);
+    }
+    pthread_mutex_unlock(&state.mutex);
+
+    for (size_t j = 0; j < job->results->len; ++j) {
+      push_new_path(imv, job->results->items[j]);
+    }
+    list_deep_free(job->results);
+    free(job->path);
+    free(job);
+  }
+
+  for (size_t i = 0; i < SCAN_WORKERS; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  list_free(state.jobs);
+
+  /* tell the main thread the walk covered every root, so paths restored
+   * from a session index but no longer on disk can be dropped */
+  struct internal_event *event = calloc(1, sizeof *event);
+  event->type = SCAN_DONE;
+  struct imv_event e = {
+    .type = IMV_EVENT_CUSTOM,
+    .data = {
+      .custom = event
+    }
+  };
+  imv_window_push_event(imv->window, &e);
+  return NULL;
+}
+
 static void print_help(struct imv *imv)
 {
   printf("imv %s\nSee manual for usage information.\n", IMV_VERSION);
@@ -822,6 +1524,15 @@ bool imv_parse_args(struct imv *imv, int argc, char **argv)
 
 void imv_add_path(struct imv *imv, const char *path)
 {
+  /* Until the window is open, defer directory scanning to the background
+   * scanner thread rather than walking the tree before first paint */
+  if (!imv->window) {
+    struct stat path_info;
+    if (stat(path, &path_info) == 0 && S_ISDIR(path_info.st_mode)) {
+      list_append(imv->pending_scans, strdup(path));
+      return;
+    }
+  }
   imv_navigator_add(imv->navigator, path, imv->recursive_load);
 }
 
@@ -836,8 +1547,27 @@ int imv_run(struct imv *imv)
   /* if loading paths from stdin, kick off a thread to do that - we'll receive
    * events back via internal events */
   if (imv->paths_from_stdin) {
+    pthread_create(&imv->stdin_reader, NULL, load_paths_from_stdin, imv);
+    imv->stdin_reader_running = true;
+  }
+
+  /* likewise, directories given on the command line are scanned in the
+   * background, streaming discovered paths back as internal events */
+  if (imv->pending_scans->len > 0) {
+    /* with the session index on, restore last run's path list for these
+     * directories up front; the scan then reconciles it against the
+     * filesystem instead of populating the navigator from scratch */
+    if (imv->use_session_index) {
+      imv->session_index = imv_session_index_create();
+      for (size_t i = 0; i < imv->pending_scans->len; ++i) {
+        imv_session_index_add_root(imv->session_index,
+            imv->pending_scans->items[i], imv->recursive_load);
+      }
+      imv_session_index_load(imv->session_index, imv->navigator);
+    }
+
     pthread_t thread;
-    pthread_create(&thread, NULL, load_paths_from_stdin, imv);
+    pthread_create(&thread, NULL, scan_paths_thread, imv);
     pthread_detach(thread);
   }
 
@@ -853,6 +1583,9 @@ int imv_run(struct imv *imv)
 
     if (index >= 0) {
       imv_navigator_select_abs(imv->navigator, index);
+    } else if (imv->pending_scans->len > 0) {
+      /* the path may not have been discovered yet; retry as paths arrive */
+      imv->starting_path_pending = true;
     } else {
       imv_log(IMV_ERROR, "Invalid starting image: %s\n", imv->starting_path);
     }
@@ -882,62 +1615,126 @@ int imv_run(struct imv *imv)
      * may immediate close one and navigate onto the next. So we attempt to
      * load in a while loop until the navigation stops.
      */
-    while (imv_navigator_poll_changed(imv->navigator)) {
-      const char *current_path = imv_navigator_selection(imv->navigator);
-      /* check we got a path back */
-      if (strcmp("", current_path)) {
-
-        const bool path_is_stdin = !strcmp("-", current_path);
-        struct imv_source *new_source;
+    bool nav_changed = false;
+    if (imv->ipc) {
+      imv_ipc_dispatch(imv->ipc);
+    }
+    if (imv_watcher_poll(imv->watcher)) {
+      imv_navigator_mark_file_changed(imv->navigator);
+    }
 
-        enum backend_result result = BACKEND_UNSUPPORTED;
+    /* The held key has gone quiet; the scrub is over. Re-trigger the load
+     * path so the image we settled on gets a full decode, even if it was
+     * skipped or decoded small on the way past. */
+    if (imv->scrub.active
+        && cur_time() - imv->scrub.last_nav >= SCRUB_SETTLE) {
+      imv->scrub.active = false;
+      imv->scrub.skipped = 0;
+      imv_navigator_mark_file_changed(imv->navigator);
+    }
 
-        if (!imv->backends) {
-          imv_log(IMV_ERROR, "No backends installed. Unable to load image.\n");
+    while (imv_navigator_poll_changed(imv->navigator)) {
+      const char *current_path = imv_navigator_selection(imv->navigator);
+      /* check we got a path back */
+      if (strcmp("", current_path)) {
+        nav_changed = true;
+
+        /* Note how quickly navigation is arriving. Key repeats land one
+         * per loop pass, each one cancelling the decode the last started;
+         * once they outpace the decoder, switch to scrubbing. */
+        const double nav_time = cur_time();
+        if (imv->loading && nav_time - imv->scrub.last_nav < SCRUB_WINDOW) {
+          imv->scrub.active = true;
         }
+        imv->scrub.last_nav = nav_time;
 
-        for (size_t i = 0; i < imv->backends->len; ++i) {
-          const struct imv_backend *backend = imv->backends->items[i];
-          if (path_is_stdin) {
+        drop_thumb_source(imv);
 
-            if (!backend->open_memory) {
-              /* memory loading unsupported by backend */
-              continue;
-            }
+        /* If the decode-ahead cache already has this path, adopt its source,
+         * and its image too if the decode has already finished.
+         */
+        struct prefetch_item *cached = prefetch_take(imv, current_path);
+        if (cached) {
+          if (imv->current_source) {
+            imv_source_async_free(imv->current_source);
+          }
+          imv->current_source = cached->source;
+          imv->current_source_scaled = cached->scaled;
+          imv_viewport_set_playing(imv->view, true);
 
-            result = backend->open_memory(imv->stdin_image_data,
-                imv->stdin_image_data_len, &new_source);
+          if (cached->image) {
+            imv->last_source = cached->source;
+            handle_new_image(imv, cached->image, cached->frametime,
+                cached->image_partial);
           } else {
+            /* Decode still in flight, its result arrives as a NEW_IMAGE
+             * event in the usual way now that the source is current.
+             */
+            imv->loading = true;
+          }
 
-            if (!backend->open_path) {
-              /* path loading unsupported by backend */
-              continue;
-            }
+          update_env_text(imv);
 
-            result = backend->open_path(current_path, &new_source);
-          }
-          if (result == BACKEND_UNSUPPORTED) {
-            /* Try the next backend */
-            continue;
-          } else {
-            break;
-          }
+          free(cached->path);
+          free(cached);
+          continue;
         }
 
+        /* Scrubbing: only every SCRUB_STRIDE'th image is worth a decode
+         * that'll be on screen for a frame or two; the ones in between
+         * keep the previous image up and just advance the title */
+        if (imv->scrub.active && ++imv->scrub.skipped < SCRUB_STRIDE) {
+          update_env_text(imv);
+          continue;
+        }
+        imv->scrub.skipped = 0;
+
+        struct imv_source *new_source;
+        const double open_start = cur_time();
+        enum backend_result result = open_source(imv, current_path, &new_source);
+        imv->perf.open_ms = (cur_time() - open_start) * 1000.0;
+
         if (result == BACKEND_SUCCESS) {
           if (imv->current_source) {
             imv_source_async_free(imv->current_source);
           }
           imv->current_source = new_source;
+
+          /* Ask for a decode no larger than the window. Sources that can't
+           * decode to size ignore this and give us the full image.
+           */
+          int ww, wh;
+          imv_window_get_size(imv->window, &ww, &wh);
+          if (imv->scrub.active) {
+            /* quarter-area decodes are plenty while the list flies past;
+             * the settle snap restores full resolution */
+            ww /= 2;
+            wh /= 2;
+          }
+          imv->current_source_scaled =
+            imv_source_set_preferred_size(imv->current_source, ww, wh);
+
           imv_source_set_callback(imv->current_source, &source_callback, imv);
           imv_source_async_load_first_frame(imv->current_source);
+          imv->perf.load_start = cur_time();
 
           imv->loading = true;
           imv_viewport_set_playing(imv->view, true);
 
-          char title[1024];
-          generate_env_text(imv, title, sizeof title, imv->title_text);
-          imv_window_set_title(imv->window, title);
+          /* If the thumbnail cache has this image, decode the small
+           * thumbnail too; it'll be on screen long before the full image */
+          char *thumb = imv_thumbs_find(imv->thumbs, current_path);
+          if (thumb) {
+            struct imv_source *thumb_source;
+            if (open_source(imv, thumb, &thumb_source) == BACKEND_SUCCESS) {
+              imv->thumb_source = thumb_source;
+              imv_source_set_callback(thumb_source, &source_callback, imv);
+              imv_source_async_load_first_frame(thumb_source);
+            }
+            free(thumb);
+          }
+
+          update_env_text(imv);
         } else {
           /* Error loading path so remove it from the navigator */
           imv_navigator_remove(imv->navigator, current_path);
@@ -951,6 +1748,20 @@ int imv_run(struct imv *imv)
       }
     }
 
+    /* Keep the decode-ahead cache pointed at our neighbours. Not while
+     * scrubbing: those decodes would be cancelled by the next repeat; the
+     * settle snap re-points the cache at wherever we stop. */
+    if (nav_changed && !imv->scrub.active) {
+      prefetch_update(imv);
+      const char *current_path = imv_navigator_selection(imv->navigator);
+      if (strcmp("", current_path) && strcmp("-", current_path)) {
+        imv_watcher_watch(imv->watcher, current_path);
+      }
+    }
+
+    /* evict cache entries if decoded images have outgrown the budget */
+    enforce_memory_budget(imv);
+
     if (imv->need_rescale) {
       imv->need_rescale = false;
       imv_viewport_rescale(imv->view, imv->current_image, imv->scaling_mode);
@@ -970,6 +1781,10 @@ int imv_run(struct imv *imv)
 
     if (should_change_frame) {
       if (imv->current_image) {
+        /* A re-decode may arrive at a different resolution; keep the
+         * on-screen size stable across the swap */
+        imv_viewport_keep_onscreen_size(imv->view, imv->current_image,
+            imv->next_frame.image);
         imv_image_free(imv->current_image);
       }
       imv->current_image = imv->next_frame.image;
@@ -979,6 +1794,7 @@ int imv_run(struct imv *imv)
       imv->next_frame.force_next_frame = false;
 
       imv->need_redraw = true;
+      imv->last_scene.dirty = true;
 
       /* Trigger loading of a new frame, now this one's being displayed */
       if (imv->current_source) {
@@ -1000,42 +1816,132 @@ int imv_run(struct imv *imv)
 
     last_time = current_time;
 
+    /* If the user zoomed past 1:1 on a reduced-resolution decode, ask the
+     * source for the full-resolution image. It arrives as a next frame and
+     * is swapped in via the force path above.
+     */
+    if (imv->current_source_scaled && !imv->loading && !imv->scrub.active
+        && !imv_image_has_regions(imv->current_image)) {
+      double scale;
+      imv_viewport_get_scale(imv->view, &scale);
+      if (scale > 1.0) {
+        imv->current_source_scaled = false;
+        imv_source_set_preferred_size(imv->current_source, 0, 0);
+        imv_source_async_load_first_frame(imv->current_source);
+        imv->next_frame.force_next_frame = true;
+      }
+    }
+
+    /* apply the latest resize, coalescing the stream of events a resize
+     * drag delivers into one viewport and canvas update per frame */
+    if (imv->resize.pending) {
+      imv->resize.pending = false;
+      imv_viewport_update(imv->view, imv->resize.width, imv->resize.height,
+          imv->resize.buffer_width, imv->resize.buffer_height,
+          imv->current_image, imv->scaling_mode);
+      imv_canvas_resize(imv->canvas, imv->resize.buffer_width,
+          imv->resize.buffer_height);
+      imv->need_redraw = true;
+    }
+
     /* check if the viewport needs a redraw */
     if (imv_viewport_needs_redraw(imv->view)) {
       imv->need_redraw = true;
     }
 
-    if (imv->need_redraw) {
-      imv_window_clear(imv->window, 0, 0, 0);
-      render_window(imv);
-      imv_window_present(imv->window);
+    /* a debounced SVG re-rasterization whose delay has expired also wants
+     * a redraw; if it hasn't expired yet it shortens the sleep below */
+    double rerender_delay = 0;
+    const bool rerender_pending =
+      imv_canvas_needs_rerender(imv->canvas, &rerender_delay);
+    if (rerender_pending && rerender_delay <= 0) {
+      imv->need_redraw = true;
+      /* the scene parameters haven't changed but the pixels will; don't
+       * let the damage hint claim nothing did */
+      imv->last_scene.dirty = true;
     }
 
-    /* sleep until we have something to do */
-    double timeout = 1.0; /* seconds */
+    /* a hidden window renders nothing; need_redraw stays set, and the
+     * visibility event triggers the catch-up frame on expose */
+    bool redraw_held = false;
+    if (imv->need_redraw && !imv->hidden) {
+      if (imv_window_frame_ready(imv->window)) {
+        imv_window_clear(imv->window, 0, 0, 0);
+        render_window(imv);
+        imv_window_present(imv->window);
+      } else {
+        /* the display hasn't consumed the last frame yet; hold the
+         * redraw, collapsing however many requests pile up meanwhile
+         * into one render when it has */
+        redraw_held = true;
+      }
+    }
 
-    /* If we need to display the next frame of an animation soon we should
-     * limit our sleep until the next frame is due.
+    /* Keep the animation and slideshow timerfds pointed at their next
+     * deadlines; they're in the window's poll set, so frames fire with
+     * timer precision rather than poll-timeout quantization. An animation
+     * whose next frame hasn't decoded yet isn't armed - the frame's
+     * arrival wakes us instead.
      */
-    if (imv_viewport_is_playing(imv->view) && imv->next_frame.due != 0.0) {
-      timeout = imv->next_frame.due - current_time;
-      if (timeout < 0.001) {
-        timeout = 0.001;
-      }
+    /* nobody can see a hidden animation; leaving its timer unarmed stops
+     * its wakeups entirely until the window reappears */
+    double animation_due = 0.0;
+    if (!imv->hidden && imv_viewport_is_playing(imv->view)
+        && imv->next_frame.due != 0.0 && imv->next_frame.image) {
+      animation_due = imv->next_frame.due;
     }
+    arm_timer(imv->timers.animation_fd, &imv->timers.animation_due,
+        animation_due);
 
+    double slideshow_due = 0.0;
     if (imv->slideshow.duration > 0) {
-      double timeleft = imv->slideshow.duration - imv->slideshow.elapsed;
-      if (timeleft > 0.0 && timeleft < timeout) {
-        timeout = timeleft + 0.001;
+      slideshow_due = current_time
+        + (imv->slideshow.duration - imv->slideshow.elapsed);
+    }
+    arm_timer(imv->timers.slideshow_fd, &imv->timers.slideshow_due,
+        slideshow_due);
+
+    /* With everything due on a timer or an fd, sleep indefinitely: a
+     * static image costs no wakeups at all. The exceptions are a pending
+     * debounced re-render, and falling back to the navigator's mtime
+     * polling when the file watcher couldn't start.
+     */
+    double timeout = -1.0;
+    if (rerender_pending && rerender_delay > 0) {
+      timeout = rerender_delay + 0.001;
+    } else if (imv_watcher_get_fd(imv->watcher) < 0) {
+      timeout = 1.0;
+    }
+
+    /* a held redraw is normally released by the frame callback waking the
+     * poll; re-check on a timer too in case it never comes */
+    if (redraw_held && (timeout < 0 || timeout > 1.0)) {
+      timeout = 1.0;
+    }
+
+    /* wake in time to notice a scrub settling once the key is released */
+    if (imv->scrub.active) {
+      double settle_in = imv->scrub.last_nav + SCRUB_SETTLE - cur_time();
+      if (settle_in < 0.001) {
+        settle_in = 0.001;
+      }
+      if (timeout < 0 || settle_in < timeout) {
+        timeout = settle_in;
       }
     }
 
-    /* Go to sleep until an input/internal event or the timeout expires */
+    /* Go to sleep until an input/internal event or a timer fires */
     imv_window_wait_for_event(imv->window, timeout);
 
     /* Handle the new events that have arrived */
     imv_window_pump_events(imv->window, event_handler, imv);
+
+    drain_timer(imv->timers.animation_fd);
+    drain_timer(imv->timers.slideshow_fd);
+  }
+
+  if (imv->session_index) {
+    imv_session_index_save(imv->session_index, imv->navigator);
   }
 
   if (imv->list_files_at_exit) {
@@ -1046,6 +1952,13 @@ int imv_run(struct imv *imv)
   return 0;
 }
 
+/* Adapts imv_window_import_dmabuf to the canvas's importer callback */
+static unsigned int window_dmabuf_importer(void *data, int fd,
+    int width, int height, int stride)
+{
+  return imv_window_import_dmabuf(data, fd, width, height, stride);
+}
+
 static bool setup_window(struct imv *imv)
 {
   imv->window = imv_window_create(imv->initial_width, imv->initial_height, "imv");
@@ -1069,10 +1982,34 @@ static bool setup_window(struct imv *imv)
   /* put us in fullscren mode to begin with if requested */
   imv_window_set_fullscreen(imv->window, imv->start_fullscreen);
 
+  /* With a working file watcher we get woken for file changes instantly,
+   * so the navigator's once-a-second mtime stat isn't needed */
+  if (imv_watcher_get_fd(imv->watcher) >= 0) {
+    imv_window_add_event_fd(imv->window, imv_watcher_get_fd(imv->watcher));
+    imv_navigator_set_mtime_polling(imv->navigator, 0);
+  }
+
+  /* Where possible the ipc server is serviced by the main loop too,
+   * instead of by its own threads */
+  if (imv->ipc && imv_ipc_get_fd(imv->ipc) >= 0) {
+    imv_window_add_event_fd(imv->window, imv_ipc_get_fd(imv->ipc));
+  }
+
+  /* The animation and slideshow timers wake the main loop when they fire */
+  if (imv->timers.animation_fd >= 0) {
+    imv_window_add_event_fd(imv->window, imv->timers.animation_fd);
+  }
+  if (imv->timers.slideshow_fd >= 0) {
+    imv_window_add_event_fd(imv->window, imv->timers.slideshow_fd);
+  }
+
   {
     int ww, wh;
     imv_window_get_size(imv->window, &ww, &wh);
     imv->canvas = imv_canvas_create(ww, wh);
+    imv_canvas_set_renderer(imv->canvas, imv->canvas_renderer);
+    imv_canvas_set_dmabuf_importer(imv->canvas, &window_dmabuf_importer, imv->window);
+    imv_canvas_set_display_profile(imv->canvas, imv->display_profile);
     imv_canvas_font(imv->canvas, imv->font.name, imv->font.size);
   }
 
@@ -1080,7 +2017,379 @@ static bool setup_window(struct imv *imv)
 }
 
 
-static void handle_new_image(struct imv *imv, struct imv_image *image, int frametime)
+/* Well-known file signatures, mapped to the name of the backend that
+ * decodes the format natively. Sniffing these up front lets the loading
+ * path pick the right backend with a single small read, instead of having
+ * every backend in turn reopen and header-parse the file. */
+static const struct magic_entry {
+  const char *backend_name;
+  size_t offset;
+  size_t len;
+  const char *bytes;
+} magic_table[] = {
+  { "libpng",        0, 8, "\x89PNG\r\n\x1a\n" },
+  { "libjpeg-turbo", 0, 3, "\xff\xd8\xff" },
+  { "libtiff",       0, 4, "II*\0" },
+  { "libtiff",       0, 4, "MM\0*" },
+  { "libnsgif",      0, 6, "GIF87a" },
+  { "libnsgif",      0, 6, "GIF89a" },
+  { "libavif",       4, 8, "ftypavif" },
+  { "libavif",       4, 8, "ftypavis" },
+  { "libwebp",       8, 4, "WEBP" },
+  { "libRSVG",       0, 5, "<?xml" },
+  { "libRSVG",       0, 4, "<svg" },
+  { "raw",           0, 8, "farbfeld" },
+  { "raw",           0, 4, "qoif" },
+  { "raw",           0, 2, "P6" },
+  { "raw",           0, 2, "P7" },
+};
+
+/* Read the file's header and look its signature up in the magic table,
+ * returning the installed backend that should handle it, or NULL to fall
+ * back to probing every backend in order. */
+static const struct imv_backend *sniff_backend(struct imv *imv, const char *path)
+{
+  char header[16];
+
+  const int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  const ssize_t header_len = read(fd, header, sizeof header);
+  close(fd);
+  if (header_len <= 0) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < sizeof magic_table / sizeof magic_table[0]; ++i) {
+    const struct magic_entry *entry = &magic_table[i];
+    if ((size_t)header_len < entry->offset + entry->len
+        || memcmp(header + entry->offset, entry->bytes, entry->len)) {
+      continue;
+    }
+    for (size_t b = 0; b < imv->backends->len; ++b) {
+      const struct imv_backend *backend = imv->backends->items[b];
+      if (!strcmp(backend->name, entry->backend_name)) {
+        return backend;
+      }
+    }
+  }
+  return NULL;
+}
+
+static enum backend_result open_source(struct imv *imv, const char *path,
+    struct imv_source **src)
+{
+  const bool path_is_stdin = !strcmp("-", path);
+
+  enum backend_result result = BACKEND_UNSUPPORTED;
+
+  if (!imv->backends) {
+    imv_log(IMV_ERROR, "No backends installed. Unable to load image.\n");
+  }
+
+  /* if another instance already decoded this image, map its pixels in
+   * instead of decoding them again */
+  if (imv->shm_cache && !path_is_stdin) {
+    struct imv_source *cached = imv_shm_cache_open(imv->shm_cache, path);
+    if (cached) {
+      *src = cached;
+      return BACKEND_SUCCESS;
+    }
+  }
+
+  /* fast path: recognise the format from its signature and go straight to
+   * the right backend */
+  const struct imv_backend *sniffed = NULL;
+  if (!path_is_stdin) {
+    sniffed = sniff_backend(imv, path);
+    if (sniffed && sniffed->open_path) {
+      result = sniffed->open_path(path, src);
+      if (result != BACKEND_UNSUPPORTED) {
+        return result;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < imv->backends->len; ++i) {
+    const struct imv_backend *backend = imv->backends->items[i];
+    if (backend == sniffed) {
+      /* already tried above */
+      continue;
+    }
+    if (path_is_stdin) {
+
+      if (!backend->open_memory) {
+        /* memory loading unsupported by backend */
+        continue;
+      }
+
+      result = backend->open_memory(imv->stdin_image_data,
+          imv->stdin_image_data_len, src);
+    } else {
+
+      if (!backend->open_path) {
+        /* path loading unsupported by backend */
+        continue;
+      }
+
+      result = backend->open_path(path, src);
+    }
+    if (result == BACKEND_UNSUPPORTED) {
+      /* Try the next backend */
+      continue;
+    } else {
+      break;
+    }
+  }
+
+  return result;
+}
+
+static struct prefetch_item *prefetch_take(struct imv *imv, const char *path)
+{
+  for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+    struct prefetch_item *item = imv->prefetch.items->items[i];
+    if (!strcmp(item->path, path)) {
+      list_remove(imv->prefetch.items, i);
+      return item;
+    }
+  }
+  return NULL;
+}
+
+static struct prefetch_item *prefetch_find_source(struct imv *imv,
+    struct imv_source *source)
+{
+  for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+    struct prefetch_item *item = imv->prefetch.items->items[i];
+    if (item->source == source) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+static void prefetch_item_free(struct prefetch_item *item)
+{
+  imv_source_async_free(item->source);
+  if (item->image) {
+    imv_image_free(item->image);
+  }
+  free(item->path);
+  free(item);
+}
+
+static void prefetch_update(struct imv *imv)
+{
+  const size_t len = imv_navigator_length(imv->navigator);
+
+  /* Build the list of paths we want decoded ahead: the depth nearest
+   * entries each side of the current one, nearest first, biased towards
+   * the direction the user is moving in.
+   *
+   * A running slideshow always advances forwards, so it gets at least one
+   * slide of forward decode-ahead even with decode_ahead unset; the next
+   * slide decodes during the display interval and the transition swaps in
+   * a finished image instead of hitching.
+   */
+  int depth = imv->prefetch.depth;
+  bool forward_only = false;
+  if (imv->slideshow.duration != 0.0 && depth < 1) {
+    depth = 1;
+    forward_only = true;
+  }
+
+  struct list *wanted = list_create();
+  if (depth > 0 && len > 1) {
+    const ssize_t cur = (ssize_t)imv_navigator_index(imv->navigator);
+    const int dir = forward_only ? 1 : imv_navigator_last_direction(imv->navigator);
+
+    for (int d = 1; d <= depth; ++d) {
+      const ssize_t offsets[] = { d * dir, -d * dir };
+      const size_t sides = forward_only ? 1 : sizeof offsets / sizeof *offsets;
+      for (size_t s = 0; s < sides; ++s) {
+        ssize_t index = (cur + offsets[s]) % (ssize_t)len;
+        if (index < 0) {
+          index += (ssize_t)len;
+        }
+        if (index == cur) {
+          continue;
+        }
+        char *path = imv_navigator_at(imv->navigator, (size_t)index);
+        if (!path || !strcmp("-", path)) {
+          /* stdin can't be usefully prefetched */
+          continue;
+        }
+        bool duplicate = false;
+        for (size_t w = 0; w < wanted->len; ++w) {
+          if (!strcmp(wanted->items[w], path)) {
+            duplicate = true;
+            break;
+          }
+        }
+        if (!duplicate) {
+          list_append(wanted, path);
+        }
+      }
+    }
+  }
+
+  /* Evict cached entries that fell out of range */
+  for (size_t i = imv->prefetch.items->len; i > 0; --i) {
+    struct prefetch_item *item = imv->prefetch.items->items[i - 1];
+    bool keep = false;
+    for (size_t w = 0; w < wanted->len; ++w) {
+      if (!strcmp(wanted->items[w], item->path)) {
+        keep = true;
+        break;
+      }
+    }
+    if (!keep && !item->pinned) {
+      prefetch_item_free(item);
+      list_remove(imv->prefetch.items, i - 1);
+    }
+  }
+
+  /* Kick off background decodes for wanted entries we don't have yet */
+  for (size_t w = 0; w < wanted->len; ++w) {
+    prefetch_start(imv, wanted->items[w], false);
+  }
+
+  list_free(wanted);
+}
+
+/* Start a background decode of path into the decode-ahead cache, unless
+ * it's already there. Pinned entries survive navigation until dropped
+ * explicitly; the memory budget can still evict either kind. */
+static void prefetch_start(struct imv *imv, const char *path, bool pinned)
+{
+  for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+    struct prefetch_item *item = imv->prefetch.items->items[i];
+    if (!strcmp(item->path, path)) {
+      if (pinned) {
+        item->pinned = true;
+      }
+      return;
+    }
+  }
+
+  struct imv_source *source;
+  if (open_source(imv, path, &source) != BACKEND_SUCCESS) {
+    return;
+  }
+
+  struct prefetch_item *item = calloc(1, sizeof *item);
+  item->path = strdup(path);
+  item->source = source;
+  item->pinned = pinned;
+  item->last_used = cur_time();
+
+  int ww, wh;
+  imv_window_get_size(imv->window, &ww, &wh);
+  item->scaled = imv_source_set_preferred_size(source, ww, wh);
+
+  list_append(imv->prefetch.items, item);
+
+  imv_source_set_callback(source, &source_callback, imv);
+  imv_source_async_load_first_frame(source);
+}
+
+static size_t image_memory(const struct imv_image *image)
+{
+  if (!image) {
+    return 0;
+  }
+  return 4 * (size_t)imv_image_width(image) * (size_t)imv_image_height(image);
+}
+
+/* Estimated bytes of decoded bitmap data held by the images on screen and
+ * the decode-ahead and gallery caches */
+static size_t decoded_memory_usage(struct imv *imv)
+{
+  size_t total = image_memory(imv->current_image);
+  total += image_memory(imv->next_frame.image);
+
+  for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+    const struct prefetch_item *item = imv->prefetch.items->items[i];
+    total += image_memory(item->image);
+  }
+
+  for (size_t i = 0; i < imv->gallery.thumbs->len; ++i) {
+    const struct gallery_thumb *thumb = imv->gallery.thumbs->items[i];
+    if (thumb->bitmap) {
+      total += 4 * (size_t)thumb->bitmap->width * (size_t)thumb->bitmap->height;
+    }
+  }
+
+  return total;
+}
+
+/* Free the least-recently-displayed cache entries until decoded memory
+ * fits the budget again. The current image and the pending animation
+ * frame are never evicted; neither are gallery thumbs on screen. */
+static void enforce_memory_budget(struct imv *imv)
+{
+  if (imv->memory.budget == 0) {
+    return;
+  }
+
+  size_t usage = decoded_memory_usage(imv);
+  while (usage > imv->memory.budget) {
+    struct gallery_thumb *thumb_victim = NULL;
+    size_t thumb_index = 0;
+    struct prefetch_item *item_victim = NULL;
+    size_t item_index = 0;
+    double oldest = 0;
+
+    for (size_t i = 0; i < imv->gallery.thumbs->len; ++i) {
+      struct gallery_thumb *thumb = imv->gallery.thumbs->items[i];
+      if (!thumb->bitmap || thumb->source) {
+        continue;
+      }
+      if (imv->gallery.active
+          && thumb->last_drawn == imv->gallery.last_render) {
+        continue;
+      }
+      if (!thumb_victim || thumb->last_drawn < oldest) {
+        thumb_victim = thumb;
+        thumb_index = i;
+        oldest = thumb->last_drawn;
+      }
+    }
+
+    for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+      struct prefetch_item *item = imv->prefetch.items->items[i];
+      if (!item->image) {
+        continue;
+      }
+      if ((!thumb_victim && !item_victim) || item->last_used < oldest) {
+        item_victim = item;
+        item_index = i;
+        oldest = item->last_used;
+      }
+    }
+
+    if (item_victim) {
+      usage -= image_memory(item_victim->image);
+      prefetch_item_free(item_victim);
+      list_remove(imv->prefetch.items, item_index);
+    } else if (thumb_victim) {
+      usage -= 4 * (size_t)thumb_victim->bitmap->width
+          * (size_t)thumb_victim->bitmap->height;
+      imv_bitmap_unref(thumb_victim->bitmap);
+      free(thumb_victim->path);
+      free(thumb_victim);
+      list_remove(imv->gallery.thumbs, thumb_index);
+    } else {
+      /* nothing left to evict */
+      break;
+    }
+  }
+}
+
+static void handle_new_image(struct imv *imv, struct imv_image *image,
+    int frametime, bool partial)
 {
   if (imv->current_image) {
     imv_image_free(imv->current_image);
@@ -1088,10 +2397,30 @@ static void handle_new_image(struct imv *imv, struct imv_image *image, int frame
   imv->current_image = image;
   imv->need_redraw = true;
   imv->need_rescale = true;
-  imv->loading = false;
+  /* the pointer may be reused by the allocator, so flag the change */
+  imv->last_scene.dirty = true;
+
+  /* A partial image is a preview of one still decoding; stay in the loading
+   * state and wait for the fuller versions to stream in */
+  imv->loading = partial;
+  if (partial) {
+    return;
+  }
+
   imv->next_frame.due = frametime ? cur_time() + frametime * 0.001 : 0.0;
   imv->next_frame.duration = 0.0;
 
+  /* Share fully-decoded stills with other instances. Downscaled decodes
+   * would poison the cache for instances with bigger windows, and frames
+   * that came from the cache are already in it. */
+  if (imv->shm_cache && !frametime && !imv->current_source_scaled) {
+    struct imv_bitmap *bmp = imv_image_get_bitmap(image);
+    if (bmp && !bmp->map) {
+      imv_shm_cache_put(imv->shm_cache,
+          imv_navigator_selection(imv->navigator), bmp);
+    }
+  }
+
   /* If this is an animated image, we should kick off loading the next frame */
   if (imv->current_source && frametime) {
     imv_source_async_load_next_frame(imv->current_source);
@@ -1108,44 +2437,272 @@ static void handle_new_frame(struct imv *imv, struct imv_image *image, int frame
   imv->next_frame.duration = frametime * 0.001;
 }
 
+static struct gallery_thumb *gallery_find(struct imv *imv, const char *path)
+{
+  for (size_t i = 0; i < imv->gallery.thumbs->len; ++i) {
+    struct gallery_thumb *thumb = imv->gallery.thumbs->items[i];
+    if (!strcmp(thumb->path, path)) {
+      return thumb;
+    }
+  }
+  return NULL;
+}
+
+static struct gallery_thumb *gallery_find_source(struct imv *imv,
+    struct imv_source *source)
+{
+  for (size_t i = 0; i < imv->gallery.thumbs->len; ++i) {
+    struct gallery_thumb *thumb = imv->gallery.thumbs->items[i];
+    if (thumb->source == source) {
+      return thumb;
+    }
+  }
+  return NULL;
+}
+
+/* Returns a bitmap no larger than max_size in either dimension, sampling
+ * down if needed. Always returns a new reference. */
+static struct imv_bitmap *bitmap_shrink(struct imv_bitmap *bmp, int max_size)
+{
+  int div = 1;
+  while (bmp->width / div > max_size || bmp->height / div > max_size) {
+    ++div;
+  }
+  if (div == 1) {
+    return imv_bitmap_ref(bmp);
+  }
+
+  struct imv_bitmap *out = calloc(1, sizeof *out);
+  out->width = bmp->width / div;
+  out->height = bmp->height / div;
+  out->format = bmp->format;
+  out->data = malloc(4 * out->width * out->height);
+  out->refs = 1;
+  for (int y = 0; y < out->height; ++y) {
+    for (int x = 0; x < out->width; ++x) {
+      memcpy(out->data + 4 * (y * out->width + x),
+          bmp->data + 4 * (y * div * bmp->width + x * div), 4);
+    }
+  }
+  return out;
+}
+
+/* Get the gallery thumbnail for the given path, starting an async decode
+ * for it if one hasn't been started yet */
+static struct gallery_thumb *gallery_request(struct imv *imv, const char *path)
+{
+  struct gallery_thumb *thumb = gallery_find(imv, path);
+  if (thumb) {
+    return thumb;
+  }
+
+  thumb = calloc(1, sizeof *thumb);
+  thumb->path = strdup(path);
+  list_append(imv->gallery.thumbs, thumb);
+
+  /* prefer decoding a cached thumbnail over the full image */
+  char *cached = imv_thumbs_find(imv->thumbs, path);
+  struct imv_source *source;
+  if (open_source(imv, cached ? cached : path, &source) == BACKEND_SUCCESS) {
+    if (!cached) {
+      imv_source_set_preferred_size(source, GALLERY_THUMB_SIZE,
+          GALLERY_THUMB_SIZE);
+    }
+    thumb->source = source;
+    imv_source_set_callback(source, &source_callback, imv);
+    imv_source_async_load_first_frame(source);
+  } else {
+    thumb->failed = true;
+  }
+  free(cached);
+  return thumb;
+}
+
 static void consume_internal_event(struct imv *imv, struct internal_event *event)
 {
   if (event->type == NEW_IMAGE) {
-    /* New image vs just a new frame of the same image */
-    if (event->data.new_image.is_new_image) {
-      handle_new_image(imv, event->data.new_image.image, event->data.new_image.frametime);
+    const double event_start = cur_time();
+    struct imv_source *source = event->data.new_image.source;
+
+    struct gallery_thumb *gallery_thumb = gallery_find_source(imv, source);
+
+    if (source == imv->thumb_source) {
+      /* A cached thumbnail decoded; display it as a loading preview
+       * unless the real image beat it here */
+      if (imv->loading && imv->last_source != imv->current_source) {
+        handle_new_image(imv, event->data.new_image.image, 0, true);
+      } else {
+        imv_image_free(event->data.new_image.image);
+      }
+
+    } else if (gallery_thumb) {
+      /* A decode for the gallery finished; keep a shrunk copy */
+      struct imv_bitmap *bmp =
+        imv_image_get_bitmap(event->data.new_image.image);
+      if (bmp) {
+        if (gallery_thumb->bitmap) {
+          imv_bitmap_unref(gallery_thumb->bitmap);
+        }
+        gallery_thumb->bitmap = bitmap_shrink(bmp, GALLERY_THUMB_SIZE);
+      } else {
+        gallery_thumb->failed = true;
+      }
+      imv_image_free(event->data.new_image.image);
+      if (!event->data.new_image.partial) {
+        imv_source_async_free(gallery_thumb->source);
+        gallery_thumb->source = NULL;
+      }
+      imv->need_redraw = true;
+
+    } else if (source != imv->current_source) {
+      /* Either a decode-ahead entry finishing, or a stale source we've
+       * already moved on from.
+       */
+      struct prefetch_item *item = prefetch_find_source(imv, source);
+      if (item) {
+        if (item->image) {
+          imv_image_free(item->image);
+        }
+        item->image = event->data.new_image.image;
+        item->frametime = event->data.new_image.frametime;
+        item->image_partial = event->data.new_image.partial;
+      } else {
+        imv_image_free(event->data.new_image.image);
+      }
+
     } else {
-      handle_new_frame(imv, event->data.new_image.image, event->data.new_image.frametime);
+      /* Keep track of the last source to send us an image in order to detect
+       * when we're getting a new image, as opposed to a new frame from the
+       * same image.
+       */
+      const bool is_new_image = source != imv->last_source;
+      imv->last_source = source;
+
+      if (is_new_image || imv->loading) {
+        /* Either the first result from a new source, or a progressive
+         * update of the image we're still loading */
+        handle_new_image(imv, event->data.new_image.image,
+            event->data.new_image.frametime, event->data.new_image.partial);
+
+        if (!event->data.new_image.partial) {
+          imv->perf.load_ms = (cur_time() - imv->perf.load_start) * 1000.0;
+
+          /* The full image is up; retire any thumbnail preview and
+           * freshen the thumbnail cache from the decoded bitmap */
+          drop_thumb_source(imv);
+          const char *path = imv_navigator_selection(imv->navigator);
+          struct imv_bitmap *bmp =
+            imv_image_get_bitmap(event->data.new_image.image);
+          if (bmp && strcmp("", path) && strcmp("-", path)
+              && (bmp->width > 256 || bmp->height > 256)) {
+            char *existing = imv_thumbs_find(imv->thumbs, path);
+            if (existing) {
+              free(existing);
+            } else {
+              imv_thumbs_store_async(imv->thumbs, path, bmp);
+            }
+          }
+        }
+      } else {
+        handle_new_frame(imv, event->data.new_image.image, event->data.new_image.frametime);
+      }
     }
 
+    imv->perf.event_ms = (cur_time() - event_start) * 1000.0;
+
   } else if (event->type == BAD_IMAGE) {
-    /* An image failed to load, remove it from our image list */
-    const char *err_path = imv_navigator_selection(imv->navigator);
-
-    /* Special case: the image came from stdin */
-    if (strcmp(err_path, "-") == 0) {
-      if (imv->stdin_image_data) {
-        free(imv->stdin_image_data);
-        imv->stdin_image_data = NULL;
-        imv->stdin_image_data_len = 0;
+    struct imv_source *source = event->data.bad_image.source;
+    struct prefetch_item *item = prefetch_find_source(imv, source);
+
+    struct gallery_thumb *gallery_thumb = gallery_find_source(imv, source);
+
+    if (source == imv->thumb_source) {
+      /* A stale cache entry; the full decode is still on its way */
+      drop_thumb_source(imv);
+
+    } else if (gallery_thumb) {
+      gallery_thumb->failed = true;
+      imv_source_async_free(gallery_thumb->source);
+      gallery_thumb->source = NULL;
+
+    } else if (item) {
+      /* A decode-ahead entry failed; prune it before the user gets there */
+      char *bad_path = strdup(item->path);
+      prefetch_take(imv, item->path);
+      prefetch_item_free(item);
+      imv_navigator_remove(imv->navigator, bad_path);
+      free(bad_path);
+
+    } else if (source == imv->current_source) {
+      /* The current image failed to load, remove it from our image list */
+      const char *err_path = imv_navigator_selection(imv->navigator);
+
+      /* Special case: the image came from stdin */
+      if (strcmp(err_path, "-") == 0) {
+        release_stdin_image_data(imv);
+        imv_log(IMV_ERROR, "Failed to load image from stdin.\n");
       }
-      imv_log(IMV_ERROR, "Failed to load image from stdin.\n");
-    }
 
-    imv_navigator_remove(imv->navigator, err_path);
+      imv_navigator_remove(imv->navigator, err_path);
+    }
 
   } else if (event->type == NEW_PATH) {
-    /* Received a new path from the stdin reading thread */
-    imv_add_path(imv, event->data.new_path.path);
+    /* Received a new path from the stdin reading or scanner thread. Paths
+     * already restored from the session index are only marked as still
+     * present, not added again. */
+    if (!imv->session_index ||
+        !imv_session_index_confirm(imv->session_index, event->data.new_path.path)) {
+      imv_add_path(imv, event->data.new_path.path);
+      /* Need to update image count in title */
+      imv->need_redraw = true;
+    }
+    if (imv->starting_path_pending) {
+      ssize_t index = imv_navigator_find_path(imv->navigator, imv->starting_path);
+      if (index >= 0) {
+        imv_navigator_select_abs(imv->navigator, index);
+        imv->starting_path_pending = false;
+      }
+    }
     free(event->data.new_path.path);
-    /* Need to update image count in title */
-    imv->need_redraw = true;
+
+  } else if (event->type == SCAN_DONE) {
+    /* The background scan covered every root; anything restored from the
+     * session index it didn't re-find is gone from disk */
+    if (imv->session_index) {
+      imv_session_index_reconcile(imv->session_index, imv->navigator);
+      imv->need_redraw = true;
+    }
+
+  } else if (event->type == NEW_MEMORY) {
+    /* An image arrived as an fd over ipc; show it as the '-' entry,
+     * decoding straight out of the mapping */
+    release_stdin_image_data(imv);
+    imv->stdin_image_data = event->data.new_memory.data;
+    imv->stdin_image_data_len = event->data.new_memory.len;
+    imv->stdin_image_data_mapped = true;
+
+    ssize_t index = imv_navigator_find_path(imv->navigator, "-");
+    if (index == -1) {
+      imv_navigator_add(imv->navigator, "-", 0);
+      index = imv_navigator_find_path(imv->navigator, "-");
+    }
+    imv_navigator_select_abs(imv->navigator, index);
+    /* force a reload even if '-' was already selected */
+    imv_navigator_mark_file_changed(imv->navigator);
 
   } else if (event->type == COMMAND) {
-    struct list *commands = list_create();
-    list_append(commands, event->data.command.text);
+    /* The whole batch runs back to back: one redraw, and one pass over
+     * the navigator's changes, however many commands arrived together */
+    struct list *commands = list_from_string(event->data.command.text, '\n');
     imv_command_exec_list(imv->commands, commands, imv);
+    if (event->data.command.ack_fd >= 0) {
+      char ack[32];
+      const int len = snprintf(ack, sizeof ack, "ok %zu\n", commands->len);
+      send(event->data.command.ack_fd, ack, len, MSG_NOSIGNAL);
+      close(event->data.command.ack_fd);
+    }
     list_deep_free(commands);
+    free(event->data.command.text);
     imv->need_redraw = true;
   }
 
@@ -1153,52 +2710,142 @@ static void consume_internal_event(struct imv *imv, struct internal_event *event
   return;
 }
 
+/* Draw the gallery's scrollable contact sheet. Thumbnails are decoded
+ * asynchronously as their cells first become visible. */
+static void render_gallery(struct imv *imv, int ww, int wh)
+{
+  const int cell = GALLERY_CELL_SIZE;
+  const int pad = GALLERY_CELL_PADDING;
+
+  int columns = ww / cell;
+  if (columns < 1) {
+    columns = 1;
+  }
+  imv->gallery.columns = columns;
+
+  const size_t len = imv_navigator_length(imv->navigator);
+  const int rows = ((int)len + columns - 1) / columns;
+  const int rows_onscreen = wh / cell > 0 ? wh / cell : 1;
+
+  /* keep the selection's row in view */
+  const int selected_row = (int)imv_navigator_index(imv->navigator) / columns;
+  if (selected_row < imv->gallery.scroll) {
+    imv->gallery.scroll = selected_row;
+  }
+  if (selected_row >= imv->gallery.scroll + rows_onscreen) {
+    imv->gallery.scroll = selected_row - rows_onscreen + 1;
+  }
+  if (imv->gallery.scroll > rows - rows_onscreen) {
+    imv->gallery.scroll = rows - rows_onscreen;
+  }
+  if (imv->gallery.scroll < 0) {
+    imv->gallery.scroll = 0;
+  }
+
+  const size_t first = (size_t)imv->gallery.scroll * columns;
+  const size_t last = first + (size_t)(rows_onscreen + 1) * columns;
+
+  const double now = cur_time();
+  imv->gallery.last_render = now;
+
+  for (size_t i = first; i < len && i < last; ++i) {
+    const char *path = imv_navigator_at(imv->navigator, i);
+    struct gallery_thumb *thumb = gallery_request(imv, path);
+    thumb->last_drawn = now;
+
+    const int cell_x = (int)((i - first) % (size_t)columns) * cell;
+    const int cell_y = (int)((i - first) / (size_t)columns) * cell;
+
+    if (thumb->bitmap) {
+      /* fit the thumbnail into the cell, preserving aspect ratio */
+      const int avail = cell - 2 * pad;
+      double scale = (double)avail / thumb->bitmap->width;
+      if (thumb->bitmap->height * scale > avail) {
+        scale = (double)avail / thumb->bitmap->height;
+      }
+      const int width = thumb->bitmap->width * scale;
+      const int height = thumb->bitmap->height * scale;
+      imv_canvas_draw_bitmap(imv->canvas, thumb->bitmap,
+          cell_x + (cell - width) / 2, cell_y + (cell - height) / 2,
+          width, height);
+    } else {
+      /* placeholder while the decode is in flight, faded if it failed */
+      imv_canvas_color(imv->canvas, 0.2, 0.2, 0.2, thumb->failed ? 0.3 : 1.0);
+      imv_canvas_fill_rectangle(imv->canvas, cell_x + pad, cell_y + pad,
+          cell - 2 * pad, cell - 2 * pad);
+    }
+
+    if (i == imv_navigator_index(imv->navigator)) {
+      /* selection border */
+      imv_canvas_color(imv->canvas, 1, 1, 1, 0.9);
+      imv_canvas_fill_rectangle(imv->canvas, cell_x, cell_y, cell, 2);
+      imv_canvas_fill_rectangle(imv->canvas, cell_x, cell_y + cell - 2, cell, 2);
+      imv_canvas_fill_rectangle(imv->canvas, cell_x, cell_y, 2, cell);
+      imv_canvas_fill_rectangle(imv->canvas, cell_x + cell - 2, cell_y, 2, cell);
+    }
+  }
+}
+
 static void render_window(struct imv *imv)
 {
+  imv_trace_begin("render_window");
+  const double frame_start = cur_time();
+
   int ww, wh;
   imv_window_get_size(imv->window, &ww, &wh);
 
-  /* update window title */
-  char title_text[1024];
-  generate_env_text(imv, title_text, sizeof title_text, imv->title_text);
-  imv_window_set_title(imv->window, title_text);
+  /* refresh the cached title/overlay text; updates the title if it changed */
+  update_env_text(imv);
 
   /* first we draw the background */
   if (imv->background.type == BACKGROUND_SOLID) {
-    imv_canvas_clear(imv->canvas);
-    imv_canvas_color(imv->canvas,
-        imv->background.color.r / 255.f,
-        imv->background.color.g / 255.f,
-        imv->background.color.b / 255.f,
-        1.0);
-    imv_canvas_fill(imv->canvas);
-    imv_canvas_draw(imv->canvas);
+    /* a GL clear, rather than uploading a solid canvas every frame */
+    imv_window_clear(imv->window,
+        imv->background.color.r,
+        imv->background.color.g,
+        imv->background.color.b);
   } else {
-    /* chequered background */
-    imv_canvas_fill_checkers(imv->canvas, 16);
-    imv_canvas_draw(imv->canvas);
+    /* chequered background, drawn from a tiny repeating GL texture rather
+     * than rasterized and uploaded every frame */
+    imv_canvas_draw_checkers(imv->canvas, 16);
   }
 
   /* draw our actual image */
-  if (imv->current_image) {
-    int x, y;
-    double scale;
-    imv_viewport_get_offset(imv->view, &x, &y);
-    imv_viewport_get_scale(imv->view, &scale);
-    imv_canvas_draw_image(imv->canvas, imv->current_image, x, y, scale, imv->upscaling_method);
+  int view_x = 0, view_y = 0;
+  double view_scale = 0;
+  if (!imv->gallery.active && imv->current_image) {
+    imv_viewport_get_offset(imv->view, &view_x, &view_y);
+    imv_viewport_get_scale(imv->view, &view_scale);
+    imv_canvas_draw_image(imv->canvas, imv->current_image, view_x, view_y,
+        view_scale, imv->upscaling_method, imv->downscaling_method);
   }
 
   imv_canvas_clear(imv->canvas);
 
+  if (imv->gallery.active) {
+    render_gallery(imv, ww, wh);
+  }
+
   /* if the overlay needs to be drawn, draw that too */
   if (imv->overlay_enabled) {
     const int height = imv->font.size * 1.2;
     imv_canvas_color(imv->canvas, 0, 0, 0, 0.75);
     imv_canvas_fill_rectangle(imv->canvas, 0, 0, ww, height);
     imv_canvas_color(imv->canvas, 1, 1, 1, 1);
-    char overlay_text[1024];
-    generate_env_text(imv, overlay_text, sizeof overlay_text, imv->overlay_text);
-    imv_canvas_printf(imv->canvas, 0, 0, "%s", overlay_text);
+    imv_canvas_printf(imv->canvas, 0, 0, "%s", imv->env_text.overlay);
+  }
+
+  /* live timing readout, below the overlay when both are up */
+  if (imv->perf.hud) {
+    const int height = imv->font.size * 1.2;
+    const int y = imv->overlay_enabled ? height : 0;
+    imv_canvas_color(imv->canvas, 0, 0, 0, 0.75);
+    imv_canvas_fill_rectangle(imv->canvas, 0, y, ww, height);
+    imv_canvas_color(imv->canvas, 1, 1, 1, 1);
+    imv_canvas_printf(imv->canvas, 0, y,
+        "open %.1fms  load %.1fms  event %.1fms  upload %.1fms  frame %.1fms",
+        imv->perf.open_ms, imv->perf.load_ms, imv->perf.event_ms,
+        imv_canvas_get_upload_ms(imv->canvas), imv->perf.frame_ms);
   }
 
   /* draw command entry bar if needed */
@@ -1225,10 +2872,49 @@ static void render_window(struct imv *imv)
         imv_console_prompt(imv->console) + imv_console_prompt_cursor(imv->console));
   }
 
+  /* when everything beneath the canvas was repainted identically, only the
+   * canvas' dirty rectangle differs from the previous frame */
+  const bool scene_changed = !imv->last_scene.valid
+      || imv->last_scene.dirty
+      || imv->gallery.active
+      || imv->last_scene.image != imv->current_image
+      || imv->last_scene.x != view_x
+      || imv->last_scene.y != view_y
+      || imv->last_scene.scale != view_scale
+      || imv->last_scene.upscaling_method != imv->upscaling_method
+      || imv->last_scene.downscaling_method != imv->downscaling_method
+      || imv->last_scene.bg_type != imv->background.type
+      || imv->last_scene.bg_color.r != imv->background.color.r
+      || imv->last_scene.bg_color.g != imv->background.color.g
+      || imv->last_scene.bg_color.b != imv->background.color.b;
+
+  imv->last_scene.valid = !imv->gallery.active;
+  imv->last_scene.dirty = false;
+  imv->last_scene.image = imv->current_image;
+  imv->last_scene.x = view_x;
+  imv->last_scene.y = view_y;
+  imv->last_scene.scale = view_scale;
+  imv->last_scene.upscaling_method = imv->upscaling_method;
+  imv->last_scene.downscaling_method = imv->downscaling_method;
+  imv->last_scene.bg_type = imv->background.type;
+  imv->last_scene.bg_color.r = imv->background.color.r;
+  imv->last_scene.bg_color.g = imv->background.color.g;
+  imv->last_scene.bg_color.b = imv->background.color.b;
+
+  int damage_x, damage_y, damage_w, damage_h;
+  if (!scene_changed && imv_canvas_get_damage(imv->canvas,
+        &damage_x, &damage_y, &damage_w, &damage_h)) {
+    imv_window_set_damage(imv->window, damage_x, damage_y, damage_w, damage_h);
+  }
+
   imv_canvas_draw(imv->canvas);
 
   /* redraw complete, unset the flag */
   imv->need_redraw = false;
+
+  /* shown on the next frame's HUD */
+  imv->perf.frame_ms = (cur_time() - frame_start) * 1000.0;
+  imv_trace_end("render_window");
 }
 
 static char *get_config_path(void)
@@ -1310,10 +2996,56 @@ static int handle_ini_value(void *user, const char *section, const char *name,
       return 1;
     }
 
+    if (!strcmp(name, "decode_ahead")) {
+      imv->prefetch.depth = (int)strtol(value, NULL, 10);
+      return 1;
+    }
+
+    if (!strcmp(name, "memory_budget")) {
+      imv->memory.budget = (size_t)strtol(value, NULL, 10) * 1024 * 1024;
+      return 1;
+    }
+
+    if (!strcmp(name, "release_hidden")) {
+      imv->release_hidden = parse_bool(value);
+      return 1;
+    }
+
+    if (!strcmp(name, "session_index")) {
+      imv->use_session_index = parse_bool(value);
+      return 1;
+    }
+
+    if (!strcmp(name, "shared_cache")) {
+      if (parse_bool(value)) {
+        if (!imv->shm_cache) {
+          imv->shm_cache = imv_shm_cache_create();
+        }
+      } else {
+        imv_shm_cache_free(imv->shm_cache);
+        imv->shm_cache = NULL;
+      }
+      return 1;
+    }
+
+    if (!strcmp(name, "display_profile")) {
+      free(imv->display_profile);
+      imv->display_profile = strdup(value);
+      return 1;
+    }
+
     if (!strcmp(name, "upscaling_method")) {
       return parse_upscaling_method(imv, value);
     }
 
+    if (!strcmp(name, "downscaling_method")) {
+      return parse_downscaling_method(imv, value);
+    }
+
+    if (!strcmp(name, "renderer")) {
+      return parse_renderer(imv, value);
+    }
+
     if (!strcmp(name, "recursive")) {
       imv->recursive_load = parse_bool(value);
       return 1;
@@ -1367,12 +3099,14 @@ static int handle_ini_value(void *user, const char *section, const char *name,
     if (!strcmp(name, "overlay_text")) {
       free(imv->overlay_text);
       imv->overlay_text = strdup(value);
+      imv->env_text.valid = false;
       return 1;
     }
 
     if (!strcmp(name, "title_text")) {
       free(imv->title_text);
       imv->title_text = strdup(value);
+      imv->env_text.valid = false;
       return 1;
     }
 
@@ -1433,6 +3167,21 @@ static void command_pan(struct list *args, const char *argstr, void *data)
   long int x = strtol(args->items[1], NULL, 10);
   long int y = strtol(args->items[2], NULL, 10);
 
+  if (imv->gallery.active) {
+    /* in the gallery, panning moves the selection around the grid */
+    if (y > 0) {
+      imv_navigator_select_rel(imv->navigator, -imv->gallery.columns);
+    } else if (y < 0) {
+      imv_navigator_select_rel(imv->navigator, imv->gallery.columns);
+    } else if (x > 0) {
+      imv_navigator_select_rel(imv->navigator, -1);
+    } else if (x < 0) {
+      imv_navigator_select_rel(imv->navigator, 1);
+    }
+    imv->need_redraw = true;
+    return;
+  }
+
   imv_viewport_move(imv->view, x, y, imv->current_image);
 }
 
@@ -1484,6 +3233,18 @@ static void command_zoom(struct list *args, const char *argstr, void *data)
 {
   (void)argstr;
   struct imv *imv = data;
+  if (imv->gallery.active) {
+    /* in the gallery, scrolling moves the selection a row at a time */
+    if (args->len == 2) {
+      long int amount = strtol(args->items[1], NULL, 10);
+      if (amount) {
+        imv_navigator_select_rel(imv->navigator,
+            amount > 0 ? -imv->gallery.columns : imv->gallery.columns);
+        imv->need_redraw = true;
+      }
+    }
+    return;
+  }
   if (args->len == 2) {
     const char *str = args->items[1];
     if (!strcmp(str, "actual")) {
@@ -1561,6 +3322,96 @@ static void command_overlay(struct list *args, const char *argstr, void *data)
   imv->need_redraw = true;
 }
 
+static void command_perf(struct list *args, const char *argstr, void *data)
+{
+  (void)args;
+  (void)argstr;
+  struct imv *imv = data;
+  imv->perf.hud = !imv->perf.hud;
+  imv->need_redraw = true;
+}
+
+static void command_prefetch(struct list *args, const char *argstr, void *data)
+{
+  (void)argstr;
+  struct imv *imv = data;
+
+  for (size_t i = 1; i < args->len; ++i) {
+    const char *path = args->items[i];
+    char *end;
+    long int index = strtol(path, &end, 10);
+    if (*path && !*end) {
+      /* a bare number names a navigator entry, 1-based like goto */
+      path = imv_navigator_at(imv->navigator, (size_t)(index - 1));
+      if (!path) {
+        imv_log(IMV_WARNING, "prefetch: no image at index %ld\n", index);
+        continue;
+      }
+    }
+    if (!strcmp("-", path)) {
+      /* stdin can't be usefully prefetched */
+      continue;
+    }
+    prefetch_start(imv, path, true);
+  }
+}
+
+static void command_drop_cache(struct list *args, const char *argstr, void *data)
+{
+  (void)args;
+  (void)argstr;
+  struct imv *imv = data;
+
+  for (size_t i = 0; i < imv->prefetch.items->len; ++i) {
+    prefetch_item_free(imv->prefetch.items->items[i]);
+  }
+  list_clear(imv->prefetch.items);
+}
+
+static void command_sort(struct list *args, const char *argstr, void *data)
+{
+  (void)argstr;
+  struct imv *imv = data;
+  if (args->len < 2) {
+    return;
+  }
+
+  enum nav_sort_mode mode;
+  const char *arg = args->items[1];
+  if (!strcmp("none", arg)) {
+    mode = NAV_SORT_NONE;
+  } else if (!strcmp("name", arg)) {
+    mode = NAV_SORT_NAME;
+  } else if (!strcmp("natural", arg)) {
+    mode = NAV_SORT_NATURAL;
+  } else if (!strcmp("mtime", arg)) {
+    mode = NAV_SORT_MTIME;
+  } else if (!strcmp("size", arg)) {
+    mode = NAV_SORT_SIZE;
+  } else {
+    imv_log(IMV_WARNING, "sort: unknown mode %s\n", arg);
+    return;
+  }
+
+  const int descending = args->len >= 3 && !strcmp("reverse", args->items[2]);
+  imv_navigator_sort(imv->navigator, mode, descending);
+  prefetch_update(imv);
+  imv->need_redraw = true;
+}
+
+static void command_gallery(struct list *args, const char *argstr, void *data)
+{
+  (void)args;
+  (void)argstr;
+  struct imv *imv = data;
+  imv->gallery.active = !imv->gallery.active;
+  if (!imv->gallery.active) {
+    /* the selection may have moved while browsing the gallery */
+    imv->need_rescale = true;
+  }
+  imv->need_redraw = true;
+}
+
 static void command_exec(struct list *args, const char *argstr, void *data)
 {
   (void)args;
@@ -1652,6 +3503,29 @@ static void command_set_upscaling_method(struct list *args, const char *argstr,
   imv->need_redraw = true;
 }
 
+static void command_set_downscaling_method(struct list *args, const char *argstr, void *data)
+{
+  (void)args;
+  (void)argstr;
+  struct imv *imv = data;
+
+  if (args->len != 2) {
+    return;
+  }
+
+  const char *mode = args->items[1];
+
+  if (!strcmp(mode, "next")) {
+    imv->downscaling_method++;
+    imv->downscaling_method %= DOWNSCALING_METHOD_COUNT;
+  } else if (!parse_downscaling_method(imv, mode)) {
+    /* no changes, don't bother to redraw */
+    return;
+  }
+
+  imv->need_redraw = true;
+}
+
 static void command_set_slideshow_duration(struct list *args, const char *argstr, void *data)
 {
   (void)argstr;
@@ -1676,6 +3550,10 @@ static void command_set_slideshow_duration(struct list *args, const char *argstr
 
     imv->slideshow.duration = new_duration;
     imv->need_redraw = true;
+
+    /* Get the next slide decoding now rather than waiting for the first
+     * transition; prefetch_update otherwise only runs on navigation */
+    prefetch_update(imv);
   }
 }
 
@@ -1739,6 +3617,21 @@ static void update_env_vars(struct imv *imv)
 
   snprintf(str, sizeof str, "%f", imv->slideshow.elapsed);
   setenv("imv_slideshow_elapsed", str, 1);
+
+  snprintf(str, sizeof str, "%.1f", imv->perf.open_ms);
+  setenv("imv_open_ms", str, 1);
+
+  snprintf(str, sizeof str, "%.1f", imv->perf.load_ms);
+  setenv("imv_load_ms", str, 1);
+
+  snprintf(str, sizeof str, "%.1f", imv_canvas_get_upload_ms(imv->canvas));
+  setenv("imv_upload_ms", str, 1);
+
+  snprintf(str, sizeof str, "%.1f", imv->perf.frame_ms);
+  setenv("imv_frame_ms", str, 1);
+
+  snprintf(str, sizeof str, "%zu", decoded_memory_usage(imv) >> 20);
+  setenv("imv_decoded_memory_mb", str, 1);
 }
 
 static size_t generate_env_text(struct imv *imv, char *buf, size_t buf_len, const char *format)
@@ -1759,6 +3652,53 @@ static size_t generate_env_text(struct imv *imv, char *buf, size_t buf_len, cons
   return len;
 }
 
+/* Regenerate the cached title and overlay text if any of their inputs have
+ * changed, pushing a new window title when they have. Cheap to call once per
+ * frame; the expensive generation only runs on an actual change. */
+static void update_env_text(struct imv *imv)
+{
+  const char *path = imv_navigator_selection(imv->navigator);
+  const size_t file_count = imv_navigator_length(imv->navigator);
+  const size_t index = file_count ? imv_navigator_index(imv->navigator) + 1 : 0;
+  double scale;
+  imv_viewport_get_scale(imv->view, &scale);
+
+  if (imv->env_text.valid
+      && imv->env_text.index == index
+      && imv->env_text.file_count == file_count
+      && imv->env_text.loading == imv->loading
+      && imv->env_text.width == imv_image_width(imv->current_image)
+      && imv->env_text.height == imv_image_height(imv->current_image)
+      && imv->env_text.scale == (int)(scale * 100.0)
+      && imv->env_text.scaling_mode == imv->scaling_mode
+      && imv->env_text.slideshow_duration == imv->slideshow.duration
+      && imv->env_text.slideshow_elapsed == imv->slideshow.elapsed
+      && imv->env_text.memory_mb == decoded_memory_usage(imv) >> 20
+      && !strcmp(imv->env_text.path, path)) {
+    return;
+  }
+
+  imv->env_text.index = index;
+  imv->env_text.file_count = file_count;
+  imv->env_text.loading = imv->loading;
+  imv->env_text.width = imv_image_width(imv->current_image);
+  imv->env_text.height = imv_image_height(imv->current_image);
+  imv->env_text.scale = (int)(scale * 100.0);
+  imv->env_text.scaling_mode = imv->scaling_mode;
+  imv->env_text.slideshow_duration = imv->slideshow.duration;
+  imv->env_text.slideshow_elapsed = imv->slideshow.elapsed;
+  imv->env_text.memory_mb = decoded_memory_usage(imv) >> 20;
+  snprintf(imv->env_text.path, sizeof imv->env_text.path, "%s", path);
+
+  generate_env_text(imv, imv->env_text.title, sizeof imv->env_text.title,
+      imv->title_text);
+  generate_env_text(imv, imv->env_text.overlay, sizeof imv->env_text.overlay,
+      imv->overlay_text);
+  imv->env_text.valid = true;
+
+  imv_window_set_title(imv->window, imv->env_text.title);
+}
+
 static size_t read_from_stdin(void **buffer)
 {
   size_t len = 0;
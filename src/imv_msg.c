@@ -1,16 +1,158 @@
+#ifdef __linux__
+/* for memfd_create */
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <unistd.h>
 
 #include "ipc.h"
 
+#ifdef __linux__
+/* Read image data from stdin into a sealed memfd and pass it to imv with
+ * SCM_RIGHTS, so imv can map and decode it without any disk I/O */
+static int send_stdin_image(int sockfd)
+{
+  int memfd = memfd_create("imv-msg", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0) {
+    perror("memfd_create");
+    return 1;
+  }
+
+  char buf[16384];
+  ssize_t len;
+  while ((len = read(STDIN_FILENO, buf, sizeof buf)) > 0) {
+    if (write(memfd, buf, len) != len) {
+      perror("write");
+      return 1;
+    }
+  }
+
+  fcntl(memfd, F_ADD_SEALS,
+      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+  const char command[] = "open-memory\n";
+  struct iovec iov = {
+    .iov_base = (void *)command,
+    .iov_len = sizeof command - 1
+  };
+  char control[CMSG_SPACE(sizeof(int))] = {0};
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof control
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &memfd, sizeof memfd);
+
+  if (sendmsg(sockfd, &msg, 0) < 0) {
+    perror("sendmsg");
+    return 1;
+  }
+
+  close(memfd);
+  return 0;
+}
+#endif
+
+/* Consume "ok <count>" acknowledgment lines from buf, returning how many
+ * commands they cover and leaving any partial line in place */
+static long parse_acks(char *buf, size_t *len)
+{
+  long acked = 0;
+  char *line = buf;
+  char *newline;
+  while ((newline = memchr(line, '\n', *len - (line - buf)))) {
+    *newline = 0;
+    long count = 0;
+    if (sscanf(line, "ok %ld", &count) == 1) {
+      acked += count;
+    }
+    line = newline + 1;
+  }
+  *len -= line - buf;
+  memmove(buf, line, *len);
+  return acked;
+}
+
+/* Stream newline-separated commands from stdin down the socket, consuming
+ * the server's acknowledgments as they arrive so thousands of commands can
+ * be pipelined without sleeping between them. Returns once every command
+ * sent has been acknowledged or the server hangs up.
+ */
+static int send_command_stream(int sockfd)
+{
+  long sent = 0;
+  long acked = 0;
+  bool eof = false;
+  char ackbuf[256];
+  size_t acklen = 0;
+
+  while (!eof || acked < sent) {
+    if (!eof) {
+      char buf[16384];
+      ssize_t len = read(STDIN_FILENO, buf, sizeof buf);
+      if (len < 0) {
+        perror("read");
+        return 1;
+      }
+      if (len == 0) {
+        eof = true;
+        /* no more commands; the server sees eof once its acks are done */
+        shutdown(sockfd, SHUT_WR);
+      } else {
+        for (ssize_t i = 0; i < len; ++i) {
+          if (buf[i] == '\n') {
+            ++sent;
+          }
+        }
+        for (ssize_t off = 0; off < len;) {
+          ssize_t written = write(sockfd, buf + off, len - off);
+          if (written <= 0) {
+            perror("write");
+            return 1;
+          }
+          off += written;
+        }
+      }
+    }
+
+    /* Drain acknowledgments; blocking only once there's nothing left to
+     * send. A server old enough not to ack just closes the socket. */
+    ssize_t len;
+    while ((len = recv(sockfd, ackbuf + acklen, sizeof ackbuf - acklen,
+            eof && acked < sent ? 0 : MSG_DONTWAIT)) > 0) {
+      acklen += len;
+      acked += parse_acks(ackbuf, &acklen);
+      if (!eof || acked >= sent) {
+        break;
+      }
+    }
+    if (len == 0) {
+      break;
+    }
+  }
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
-  if (argc < 3) {
-    fprintf(stderr, "Usage: %s <pid> <command>\n", argv[0]);
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <pid> <command>\n"
+                    "       %s <pid> - < image\n"
+                    "       %s <pid> < commands\n", argv[0], argv[0], argv[0]);
     return 0;
   }
 
@@ -27,6 +169,26 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  /* With no command, stream a batch of commands from stdin */
+  if (argc == 2) {
+    int ret = send_command_stream(sockfd);
+    close(sockfd);
+    return ret;
+  }
+
+  /* Special case: '-' sends image data from stdin */
+  if (argc == 3 && !strcmp("-", argv[2])) {
+#ifdef __linux__
+    int ret = send_stdin_image(sockfd);
+    close(sockfd);
+    return ret;
+#else
+    fprintf(stderr, "Sending image data is not supported on this platform\n");
+    close(sockfd);
+    return 1;
+#endif
+  }
+
   char buf[4096] = {0};
   for (int i = 2; i < argc; ++i) {
     strncat(buf, argv[i], sizeof buf - 1);
@@ -37,6 +199,14 @@ int main(int argc, char **argv)
   strncat(buf, "\n", sizeof buf - 1);
 
   write(sockfd, buf, strlen(buf));
+
+  /* Wait for the command to be acknowledged, so serial callers don't need
+   * to sleep between invocations. Servers old enough not to ack see our
+   * eof and close the socket, unblocking us. */
+  shutdown(sockfd, SHUT_WR);
+  char ack[64];
+  recv(sockfd, ack, sizeof ack, 0);
+
   close(sockfd);
   return 0;
 }
@@ -1,72 +1,294 @@
 #include "ipc.h"
 
 #include <ctype.h>
-#include <pthread.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#include <pthread.h>
+#endif
+
+/* Maximum simultaneous client connections for the fallback poll loop */
+#define MAX_CONNECTIONS 32
+
+/* Per-client read buffer; commands larger than this are dispatched in
+ * pieces rather than rejected */
+#define CLIENT_BUFFER 16384
+
+struct ipc_client {
+  int fd;
+  /* bytes of a partial command carried over until its newline arrives */
+  size_t len;
+  char buf[CLIENT_BUFFER];
+};
+
 struct imv_ipc {
   int fd;
   imv_ipc_callback callback;
   void *data;
+  imv_ipc_fd_callback fd_callback;
+  void *fd_data;
+#ifdef __linux__
+  /* all connection handling happens on the main thread; this epoll fd is
+   * merged into the main loop's poll set and becomes readable whenever the
+   * listening socket or any client has work pending */
+  int epoll_fd;
+#else
+  struct ipc_client *clients[MAX_CONNECTIONS];
+  int num_clients;
+#endif
 };
 
-struct connection {
-  struct imv_ipc *ipc;
-  int fd;
-};
+static void set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if (flags != -1) {
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  }
+}
 
-static void *wait_for_commands(void* void_conn)
+/* Hand the first len bytes of the client's buffer - a batch of one or more
+ * commands - to the command callback, along with a duplicate of the socket
+ * for the acknowledgment, then keep whatever follows them. */
+static void dispatch_commands(struct imv_ipc *ipc, struct ipc_client *client,
+    size_t len)
 {
-  struct connection *conn = void_conn;
+  const char saved = client->buf[len];
+  client->buf[len] = 0;
 
-  while (1) {
-    char buf[1024];
-    ssize_t len = recv(conn->fd, buf, sizeof buf - 1, 0);
-    if (len <= 0) {
-      break;
+  size_t end = len;
+  while (end > 0 && isspace(client->buf[end-1])) {
+    client->buf[end-1] = 0;
+    --end;
+  }
+  if (end > 0 && ipc->callback) {
+    ipc->callback(client->buf, dup(client->fd), ipc->data);
+  }
+
+  client->buf[len] = saved;
+  memmove(client->buf, client->buf + len, client->len - len);
+  client->len -= len;
+}
+
+/* Read from a client, dispatching every complete newline-terminated command
+ * received so far to the relevant callback in one batch. Partial commands
+ * wait in the client's buffer for the rest to arrive.
+ * Returns 0 if the connection was closed. */
+static int handle_message(struct imv_ipc *ipc, struct ipc_client *client)
+{
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {
+    .iov_base = client->buf + client->len,
+    .iov_len = sizeof client->buf - 1 - client->len
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof control
+  };
+  ssize_t len = recvmsg(client->fd, &msg, 0);
+  if (len <= 0) {
+    /* dispatch any unterminated trailing command before hanging up */
+    if (client->len > 0) {
+      dispatch_commands(ipc, client, client->len);
     }
+    return 0;
+  }
 
-    buf[len] = 0;
-    while (len > 0 && isspace(buf[len-1])) {
-      buf[len-1] = 0;
-      --len;
+  /* The client may have attached a file descriptor to its command */
+  int passed_fd = -1;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof passed_fd);
     }
+  }
 
-    if (conn->ipc->callback) {
-      conn->ipc->callback(buf, conn->ipc->data);
+  client->len += len;
+
+  if (passed_fd >= 0) {
+    client->buf[client->len] = 0;
+    while (client->len > 0 && isspace(client->buf[client->len-1])) {
+      client->buf[client->len-1] = 0;
+      --client->len;
+    }
+    if (ipc->fd_callback) {
+      ipc->fd_callback(client->buf, passed_fd, ipc->fd_data);
+    } else {
+      close(passed_fd);
     }
+    client->len = 0;
+    return 1;
   }
 
-  close(conn->fd);
-  free(conn);
-  return NULL;
+  /* everything up to the last newline is ready to run */
+  size_t complete = 0;
+  for (size_t i = client->len; i > 0; --i) {
+    if (client->buf[i-1] == '\n') {
+      complete = i;
+      break;
+    }
+  }
+  if (complete > 0 || client->len == sizeof client->buf - 1) {
+    dispatch_commands(ipc, client,
+        complete > 0 ? complete : client->len);
+  }
+  return 1;
+}
+
+#ifdef __linux__
+
+int imv_ipc_get_fd(const struct imv_ipc *ipc)
+{
+  return ipc->epoll_fd;
 }
 
-static void *wait_for_connections(void* void_ipc)
+void imv_ipc_dispatch(struct imv_ipc *ipc)
+{
+  struct epoll_event events[16];
+  int num_events;
+  while ((num_events = epoll_wait(ipc->epoll_fd, events, 16, 0)) > 0) {
+    for (int i = 0; i < num_events; ++i) {
+      struct ipc_client *client = events[i].data.ptr;
+      if (!client) {
+        /* the listening socket */
+        int fd;
+        while ((fd = accept(ipc->fd, NULL, NULL)) != -1) {
+          set_nonblocking(fd);
+          client = calloc(1, sizeof *client);
+          client->fd = fd;
+          struct epoll_event event = {
+            .events = EPOLLIN,
+            .data = { .ptr = client }
+          };
+          epoll_ctl(ipc->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        }
+      } else if (!handle_message(ipc, client)) {
+        epoll_ctl(ipc->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        close(client->fd);
+        free(client);
+      }
+    }
+  }
+}
+
+static int setup_event_loop(struct imv_ipc *ipc)
+{
+  set_nonblocking(ipc->fd);
+
+  ipc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (ipc->epoll_fd == -1) {
+    return -1;
+  }
+
+  struct epoll_event event = {
+    .events = EPOLLIN,
+    .data = { .ptr = NULL }
+  };
+  epoll_ctl(ipc->epoll_fd, EPOLL_CTL_ADD, ipc->fd, &event);
+  return 0;
+}
+
+static void teardown_event_loop(struct imv_ipc *ipc)
+{
+  close(ipc->epoll_fd);
+}
+
+#else
+
+int imv_ipc_get_fd(const struct imv_ipc *ipc)
+{
+  (void)ipc;
+  return -1;
+}
+
+void imv_ipc_dispatch(struct imv_ipc *ipc)
 {
-  struct imv_ipc *ipc = void_ipc;
   (void)ipc;
+}
+
+/* Without epoll, a single service thread polls the listening socket and
+ * every client, rather than spawning a thread per connection */
+static void *wait_for_connections(void *void_ipc)
+{
+  struct imv_ipc *ipc = void_ipc;
 
   while (1) {
-    int client = accept(ipc->fd, NULL, NULL);
-    if (client == -1) {
+    struct pollfd fds[MAX_CONNECTIONS + 1];
+    fds[0].fd = ipc->fd;
+    fds[0].events = POLLIN;
+    for (int i = 0; i < ipc->num_clients; ++i) {
+      fds[i + 1].fd = ipc->clients[i]->fd;
+      fds[i + 1].events = POLLIN;
+    }
+
+    if (poll(fds, ipc->num_clients + 1, -1) <= 0) {
+      break;
+    }
+
+    if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      /* listening socket closed by imv_ipc_free */
       break;
     }
-    struct connection *conn = calloc(1, sizeof *conn);
-    conn->ipc = ipc;
-    conn->fd = client;
 
-    pthread_t thread;
-    pthread_create(&thread, NULL, wait_for_commands, conn);
-    pthread_detach(thread);
+    for (int i = ipc->num_clients - 1; i >= 0; --i) {
+      if (!(fds[i + 1].revents & (POLLIN | POLLHUP))) {
+        continue;
+      }
+      if (!handle_message(ipc, ipc->clients[i])) {
+        close(ipc->clients[i]->fd);
+        free(ipc->clients[i]);
+        ipc->clients[i] = ipc->clients[ipc->num_clients - 1];
+        --ipc->num_clients;
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(ipc->fd, NULL, NULL);
+      if (fd == -1) {
+        break;
+      }
+      if (ipc->num_clients == MAX_CONNECTIONS) {
+        close(fd);
+      } else {
+        struct ipc_client *client = calloc(1, sizeof *client);
+        client->fd = fd;
+        ipc->clients[ipc->num_clients++] = client;
+      }
+    }
   }
   return NULL;
 }
 
+static int setup_event_loop(struct imv_ipc *ipc)
+{
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, wait_for_connections, ipc)) {
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+static void teardown_event_loop(struct imv_ipc *ipc)
+{
+  for (int i = 0; i < ipc->num_clients; ++i) {
+    close(ipc->clients[i]->fd);
+    free(ipc->clients[i]);
+  }
+}
+
+#endif
+
 struct imv_ipc *imv_ipc_create(void)
 {
   int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -94,9 +316,11 @@ struct imv_ipc *imv_ipc_create(void)
   struct imv_ipc *ipc = calloc(1, sizeof *ipc);
   ipc->fd = sockfd;
 
-  pthread_t thread;
-  pthread_create(&thread, NULL, wait_for_connections, ipc);
-  pthread_detach(thread);
+  if (setup_event_loop(ipc) == -1) {
+    close(sockfd);
+    free(ipc);
+    return NULL;
+  }
   return ipc;
 }
 
@@ -109,6 +333,7 @@ void imv_ipc_free(struct imv_ipc *ipc)
   char ipc_filename[1024];
   imv_ipc_path(ipc_filename, sizeof ipc_filename, getpid());
   unlink(ipc_filename);
+  teardown_event_loop(ipc);
   close(ipc->fd);
 
   free(ipc);
@@ -121,3 +346,10 @@ void imv_ipc_set_command_callback(struct imv_ipc *ipc,
   ipc->data = data;
 }
 
+void imv_ipc_set_fd_callback(struct imv_ipc *ipc,
+    imv_ipc_fd_callback callback, void *data)
+{
+  ipc->fd_callback = callback;
+  ipc->fd_data = data;
+}
+
@@ -14,15 +14,43 @@ struct imv_ipc *imv_ipc_create(void);
 /* Cleans up an imv_ipc instance */
 void imv_ipc_free(struct imv_ipc *ipc);
 
-typedef void (*imv_ipc_callback)(const char *command, void *data);
-
-/* When a command is received, imv_ipc will call the callback function passed
- * in. Only one callback function at a time can be connected. The data argument
- * is passed back to the callback to allow for context passing
+typedef void (*imv_ipc_callback)(const char *commands, int ack_fd, void *data);
+
+/* When commands are received, imv_ipc will call the callback function passed
+ * in. commands holds one or more newline-separated commands: everything a
+ * client sent that has arrived so far, so a pipelined batch is delivered
+ * (and can be executed) as one transaction. ack_fd is a duplicate of the
+ * client's socket, which the callback owns and should write an
+ * acknowledgment to once the commands have run, or -1. Only one callback
+ * function at a time can be connected. The data argument is passed back to
+ * the callback to allow for context passing
  */
 void imv_ipc_set_command_callback(struct imv_ipc *ipc,
     imv_ipc_callback callback, void *data);
 
+typedef void (*imv_ipc_fd_callback)(const char *command, int fd, void *data);
+
+/* When a client attaches a file descriptor to its command with SCM_RIGHTS
+ * (for example a memfd holding image data), this callback is called instead
+ * of the command callback. The callback takes ownership of the fd. Only one
+ * callback function at a time can be connected.
+ */
+void imv_ipc_set_fd_callback(struct imv_ipc *ipc,
+    imv_ipc_fd_callback callback, void *data);
+
+/* Get an fd to merge into the main loop's poll set (see
+ * imv_window_add_event_fd). It becomes readable when ipc work is pending,
+ * which imv_ipc_dispatch then handles. Returns -1 on platforms where the
+ * ipc server runs on its own thread instead.
+ */
+int imv_ipc_get_fd(const struct imv_ipc *ipc);
+
+/* Accept pending connections and read pending commands, invoking callbacks
+ * on the calling thread. Does not block. No-op when imv_ipc_get_fd
+ * returns -1.
+ */
+void imv_ipc_dispatch(struct imv_ipc *ipc);
+
 /* Given a pid, emits the path of the unix socket that would connect to an imv
  * instance with that pid
  */
@@ -3,35 +3,171 @@
 #include "list.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <time.h>
 
-static struct list *g_log_clients = NULL;
-static char g_log_buffer[16384];
+/* Log writes go through a lock-free ring drained by a background thread, so
+ * a loader thread logging a warning mid-decode never blocks on a slow
+ * terminal or journald behind stderr. Entries are dropped, and the drop
+ * counted and reported, when the drain thread can't keep up.
+ *
+ * The ring is the same sequenced-slot design as event_ring.c: each slot
+ * carries a sequence number that tells producers whether it's free and the
+ * consumer whether it's filled.
+ */
+#define LOG_RING_SIZE 256 /* must be a power of two */
+#define LOG_MSG_SIZE 1024
+
+struct log_entry {
+  unsigned sequence;
+  enum imv_log_level level;
+  char text[LOG_MSG_SIZE];
+};
+
+static struct log_entry g_ring[LOG_RING_SIZE];
+static unsigned g_head; /* next slot to write; shared by producers */
+static unsigned g_tail; /* next slot to read; advanced by the drain thread */
+static unsigned g_dropped;
+static sem_t g_pending;
+static pthread_t g_drain_thread;
+static unsigned g_running;
+
+/* nonzero once a callback is registered; lets imv_log bail out without
+ * taking any locks when no one is listening */
+static unsigned g_active;
+
+/* guards the client list; held while callbacks run, so removing a client
+ * guarantees its callback isn't mid-flight on the drain thread */
+static pthread_mutex_t g_clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct list *g_log_clients;
 
 struct log_client {
   imv_log_callback callback;
   void *data;
 };
 
+static bool try_push(enum imv_log_level level, const char *fmt, va_list args)
+{
+  unsigned head = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+  while (true) {
+    struct log_entry *entry = &g_ring[head % LOG_RING_SIZE];
+    const unsigned sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+    const int filled = (int)(sequence - head);
+    if (filled == 0) {
+      if (__atomic_compare_exchange_n(&g_head, &head, head + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        entry->level = level;
+        vsnprintf(entry->text, sizeof entry->text, fmt, args);
+        __atomic_store_n(&entry->sequence, head + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (filled < 0) {
+      /* the slot is a whole lap behind: the ring is full */
+      return false;
+    } else {
+      /* another producer claimed this slot; reload and try the next */
+      head = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void deliver(enum imv_log_level level, const char *text)
+{
+  pthread_mutex_lock(&g_clients_mutex);
+  for (size_t i = 0; g_log_clients && i < g_log_clients->len; ++i) {
+    struct log_client *client = g_log_clients->items[i];
+    client->callback(level, text, client->data);
+  }
+  pthread_mutex_unlock(&g_clients_mutex);
+}
+
+/* Deliver every filled entry. Slots are released only after their callback
+ * runs, so an empty ring means everything has truly been delivered. */
+static void drain(void)
+{
+  while (true) {
+    const unsigned tail = __atomic_load_n(&g_tail, __ATOMIC_RELAXED);
+    struct log_entry *entry = &g_ring[tail % LOG_RING_SIZE];
+    const unsigned sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+    if ((int)(sequence - (tail + 1)) < 0) {
+      break;
+    }
+    deliver(entry->level, entry->text);
+    __atomic_store_n(&entry->sequence, tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    /* a release store so flushers observing the new tail also observe the
+     * delivery that preceded it */
+    __atomic_store_n(&g_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  const unsigned dropped = __atomic_exchange_n(&g_dropped, 0, __ATOMIC_RELAXED);
+  if (dropped) {
+    char msg[64];
+    snprintf(msg, sizeof msg, "log: dropped %u messages\n", dropped);
+    deliver(IMV_WARNING, msg);
+  }
+}
+
+static void *drain_thread(void *unused)
+{
+  (void)unused;
+  while (true) {
+    sem_wait(&g_pending);
+    if (!__atomic_load_n(&g_running, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    drain();
+  }
+  /* deliver anything that arrived while stopping */
+  drain();
+  return NULL;
+}
+
+static void stop_drain_thread(void)
+{
+  if (!__atomic_load_n(&g_running, __ATOMIC_RELAXED)) {
+    return;
+  }
+  __atomic_store_n(&g_active, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&g_running, 0, __ATOMIC_RELEASE);
+  sem_post(&g_pending);
+  pthread_join(g_drain_thread, NULL);
+}
+
 void imv_log(enum imv_log_level level, const char *fmt,  ...)
 {
   assert(fmt);
 
   /* Exit early if no one's listening */
-  if (!g_log_clients || !g_log_clients->len) {
+  if (!__atomic_load_n(&g_active, __ATOMIC_RELAXED)) {
     return;
   }
 
   va_list args;
   va_start(args, fmt);
-  vsnprintf(g_log_buffer, sizeof g_log_buffer, fmt, args);
+  const bool pushed = try_push(level, fmt, args);
   va_end(args);
 
-  for (size_t i = 0; i < g_log_clients->len; ++i) {
-    struct log_client *client = g_log_clients->items[i];
-    client->callback(level, g_log_buffer, client->data);
+  if (pushed) {
+    sem_post(&g_pending);
+  } else {
+    __atomic_fetch_add(&g_dropped, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void imv_log_flush(void)
+{
+  if (!__atomic_load_n(&g_running, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  while (__atomic_load_n(&g_tail, __ATOMIC_ACQUIRE)
+      != __atomic_load_n(&g_head, __ATOMIC_ACQUIRE)) {
+    const struct timespec delay = { .tv_nsec = 1000000 };
+    nanosleep(&delay, NULL);
   }
 }
 
@@ -43,27 +179,43 @@ void imv_log_add_log_callback(imv_log_callback callback, void *data)
   client->callback = callback;
   client->data = data;
 
+  pthread_mutex_lock(&g_clients_mutex);
   if (!g_log_clients) {
     g_log_clients = list_create();
   }
-
   list_append(g_log_clients, client);
+  pthread_mutex_unlock(&g_clients_mutex);
+
+  if (!__atomic_load_n(&g_running, __ATOMIC_RELAXED)) {
+    for (unsigned i = 0; i < LOG_RING_SIZE; ++i) {
+      g_ring[i].sequence = i;
+    }
+    sem_init(&g_pending, 0, 0);
+    __atomic_store_n(&g_running, 1, __ATOMIC_RELEASE);
+    pthread_create(&g_drain_thread, NULL, &drain_thread, NULL);
+    /* undelivered entries are lost when the process exits; drain first */
+    atexit(&stop_drain_thread);
+  }
+  __atomic_store_n(&g_active, 1, __ATOMIC_RELAXED);
 }
 
 void imv_log_remove_log_callback(imv_log_callback callback)
 {
   assert(callback);
 
-  if (!callback || !g_log_clients) {
-    return;
-  }
-
-  for (size_t i = 0; i < g_log_clients->len; ++i) {
+  pthread_mutex_lock(&g_clients_mutex);
+  for (size_t i = 0; g_log_clients && i < g_log_clients->len; ++i) {
     struct log_client *client = g_log_clients->items[i];
     if (client->callback == callback) {
       free(client);
       list_remove(g_log_clients, i);
-      return;
+      break;
     }
   }
+  const bool empty = !g_log_clients || !g_log_clients->len;
+  pthread_mutex_unlock(&g_clients_mutex);
+
+  if (empty) {
+    __atomic_store_n(&g_active, 0, __ATOMIC_RELAXED);
+  }
 }
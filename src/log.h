@@ -8,9 +8,14 @@ enum imv_log_level {
   IMV_ERROR
 };
 
-/* Write to the log */
+/* Write to the log. The entry is queued and delivered by a background
+ * thread, so this never blocks on the terminal; entries are dropped (and
+ * the drop reported) if the queue backs up */
 void imv_log(enum imv_log_level level, const char *fmt,  ...);
 
+/* Block until every entry written so far has been delivered */
+void imv_log_flush(void);
+
 typedef void (*imv_log_callback)(enum imv_log_level level, const char *text, void *data);
 
 /* Subscribe to the log, callback is called whenever a log entry is written */
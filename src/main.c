@@ -8,6 +8,9 @@ extern const struct imv_backend imv_backend_librsvg;
 extern const struct imv_backend imv_backend_libtiff;
 extern const struct imv_backend imv_backend_libjpeg;
 extern const struct imv_backend imv_backend_libnsgif;
+extern const struct imv_backend imv_backend_libavif;
+extern const struct imv_backend imv_backend_libwebp;
+extern const struct imv_backend imv_backend_raw;
 
 int main(int argc, char **argv)
 {
@@ -37,6 +40,18 @@ int main(int argc, char **argv)
   imv_install_backend(imv, &imv_backend_libnsgif);
 #endif
 
+#ifdef IMV_BACKEND_LIBAVIF
+  imv_install_backend(imv, &imv_backend_libavif);
+#endif
+
+#ifdef IMV_BACKEND_LIBWEBP
+  imv_install_backend(imv, &imv_backend_libwebp);
+#endif
+
+#ifdef IMV_BACKEND_RAW
+  imv_install_backend(imv, &imv_backend_raw);
+#endif
+
 #ifdef IMV_BACKEND_FREEIMAGE
   imv_install_backend(imv, &imv_backend_freeimage);
 #endif
@@ -1,14 +1,21 @@
+/* for dirent.d_type */
+#define _DEFAULT_SOURCE
+
 #include "navigator.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "list.h"
 
@@ -19,23 +26,161 @@
 
 struct nav_item {
   char *path;
+  size_t index; /* position of this item in nav->paths */
+  uint64_t seq; /* order the item was discovered in, for NAV_SORT_NONE */
+  /* file metadata for the mtime and size sort modes. Captured from stats
+   * the navigator performs anyway where it can; the directory scan itself
+   * never stats, so the rest is filled in (across threads) on the first
+   * sort that needs it */
+  time_t mtime;
+  long long size;
+  bool have_meta;
+};
+
+/* Chained hash table from a string key to a nav_item, so that path lookups
+ * don't have to scan the whole list. Entries with equal keys keep their
+ * insertion order, matching what a scan of the list would find first. */
+struct hash_entry {
+  const char *key;
+  struct nav_item *item;
+  struct hash_entry *next;
+};
+
+struct hash_table {
+  struct hash_entry **buckets;
+  size_t num_buckets; /* always a power of two */
+  size_t len;
 };
 
 struct imv_navigator {
   struct list *paths;
+  struct hash_table by_path; /* full path -> nav_item */
+  struct hash_table by_base; /* basename -> nav_item */
+  uint64_t next_seq;
   size_t cur_path;
   time_t last_change;
   time_t last_check;
   int last_move_direction;
   int changed;
   int wrapped;
+  int mtime_polling;
 };
 
+static uint64_t hash_str(const char *str)
+{
+  uint64_t hash = UINT64_C(14695981039346656037); /* FNV-1a */
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= UINT64_C(1099511628211);
+  }
+  return hash;
+}
+
+static void hash_init(struct hash_table *table)
+{
+  table->num_buckets = 128;
+  table->buckets = calloc(table->num_buckets, sizeof *table->buckets);
+  table->len = 0;
+}
+
+static void hash_free(struct hash_table *table)
+{
+  for (size_t i = 0; i < table->num_buckets; ++i) {
+    struct hash_entry *entry = table->buckets[i];
+    while (entry) {
+      struct hash_entry *next = entry->next;
+      free(entry);
+      entry = next;
+    }
+  }
+  free(table->buckets);
+  table->buckets = NULL;
+  table->len = 0;
+}
+
+static void hash_append(struct hash_table *table, struct hash_entry *entry)
+{
+  struct hash_entry **slot =
+    &table->buckets[hash_str(entry->key) & (table->num_buckets - 1)];
+  while (*slot) {
+    slot = &(*slot)->next;
+  }
+  entry->next = NULL;
+  *slot = entry;
+}
+
+static void hash_grow(struct hash_table *table)
+{
+  struct hash_entry **old_buckets = table->buckets;
+  const size_t old_num = table->num_buckets;
+  table->num_buckets = old_num * 2;
+  table->buckets = calloc(table->num_buckets, sizeof *table->buckets);
+  for (size_t i = 0; i < old_num; ++i) {
+    struct hash_entry *entry = old_buckets[i];
+    while (entry) {
+      struct hash_entry *next = entry->next;
+      hash_append(table, entry);
+      entry = next;
+    }
+  }
+  free(old_buckets);
+}
+
+static void hash_add(struct hash_table *table, const char *key,
+                     struct nav_item *item)
+{
+  if (table->len >= table->num_buckets * 2) {
+    hash_grow(table);
+  }
+  struct hash_entry *entry = calloc(1, sizeof *entry);
+  entry->key = key;
+  entry->item = item;
+  hash_append(table, entry);
+  table->len++;
+}
+
+static struct nav_item *hash_find(struct hash_table *table, const char *key)
+{
+  struct hash_entry *entry =
+    table->buckets[hash_str(key) & (table->num_buckets - 1)];
+  for (; entry; entry = entry->next) {
+    if (!strcmp(entry->key, key)) {
+      return entry->item;
+    }
+  }
+  return NULL;
+}
+
+static void hash_remove(struct hash_table *table, const char *key,
+                        struct nav_item *item)
+{
+  struct hash_entry **slot =
+    &table->buckets[hash_str(key) & (table->num_buckets - 1)];
+  for (; *slot; slot = &(*slot)->next) {
+    if ((*slot)->item == item) {
+      struct hash_entry *entry = *slot;
+      *slot = entry->next;
+      free(entry);
+      table->len--;
+      return;
+    }
+  }
+}
+
+static const char *base_name(const char *path)
+{
+  const char *sep = strrchr(path, '/');
+  return sep ? sep + 1 : path;
+}
+
 struct imv_navigator *imv_navigator_create(void)
 {
   struct imv_navigator *nav = calloc(1, sizeof *nav);
   nav->last_move_direction = 1;
+  nav->mtime_polling = 1;
   nav->paths = list_create();
+  hash_init(&nav->by_path);
+  hash_init(&nav->by_base);
   return nav;
 }
 
@@ -45,20 +190,62 @@ void imv_navigator_free(struct imv_navigator *nav)
     struct nav_item *nav_item = nav->paths->items[i];
     free(nav_item->path);
   }
+  hash_free(&nav->by_path);
+  hash_free(&nav->by_base);
   list_deep_free(nav->paths);
   free(nav);
 }
 
-static int add_item(struct imv_navigator *nav, const char *path)
+/* True if the path is absolute and free of '.', '..' and empty components,
+ * i.e. already in the form realpath() would produce (symlinks aside) */
+static bool path_is_canonical(const char *path)
+{
+  if (path[0] != '/') {
+    return false;
+  }
+  for (const char *p = path; *p; ++p) {
+    if (p[0] == '/') {
+      if (p[1] == '/') {
+        return false;
+      }
+      if (p[1] == '.' && (p[2] == '\0' || p[2] == '/')) {
+        return false;
+      }
+      if (p[1] == '.' && p[2] == '.' && (p[3] == '\0' || p[3] == '/')) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static int add_item(struct imv_navigator *nav, const char *path,
+                    const struct stat *info)
 {
   struct nav_item *nav_item = calloc(1, sizeof *nav_item);
 
-  nav_item->path = realpath(path, NULL);
-  if (!nav_item->path) {
+  /* paths reached by walking a canonical directory are already canonical;
+   * only pay for a full path resolution when they aren't */
+  if (path_is_canonical(path)) {
     nav_item->path = strdup(path);
+  } else {
+    nav_item->path = realpath(path, NULL);
+    if (!nav_item->path) {
+      nav_item->path = strdup(path);
+    }
+  }
+
+  if (info) {
+    nav_item->mtime = info->st_mtim.tv_sec;
+    nav_item->size = info->st_size;
+    nav_item->have_meta = true;
   }
 
+  nav_item->seq = nav->next_seq++;
+  nav_item->index = nav->paths->len;
   list_append(nav->paths, nav_item);
+  hash_add(&nav->by_path, nav_item->path, nav_item);
+  hash_add(&nav->by_base, base_name(nav_item->path), nav_item);
 
   if (nav->paths->len == 1) {
     nav->cur_path = 0;
@@ -68,6 +255,47 @@ static int add_item(struct imv_navigator *nav, const char *path)
   return 0;
 }
 
+/* Remove the item at the given index from the list and both hash tables,
+ * re-numbering the items that follow it */
+static void remove_item_at(struct imv_navigator *nav, size_t index)
+{
+  struct nav_item *item = nav->paths->items[index];
+  hash_remove(&nav->by_path, item->path, item);
+  hash_remove(&nav->by_base, base_name(item->path), item);
+  free(item->path);
+  free(item);
+  list_remove(nav->paths, index);
+  for (size_t i = index; i < nav->paths->len; ++i) {
+    struct nav_item *moved = nav->paths->items[i];
+    moved->index = i;
+  }
+}
+
+/* Decide whether an entry is a directory without a stat() syscall where the
+ * filesystem fills in d_type, falling back to stat() where it doesn't. When
+ * the fallback fired, the result is left in *info with *have_info set, so
+ * the caller can reuse it instead of statting again. */
+static bool entry_is_dir(const char *path, const struct dirent *entry,
+                         struct stat *info, bool *have_info)
+{
+  *have_info = false;
+#ifndef DT_DIR
+  (void)entry;
+#else
+  if (entry->d_type == DT_DIR) {
+    return true;
+  }
+  if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+    return false;
+  }
+#endif
+  if (stat(path, info)) {
+    return false;
+  }
+  *have_info = true;
+  return S_ISDIR(info->st_mode);
+}
+
 int imv_navigator_add(struct imv_navigator *nav, const char *path,
                        int recursive)
 {
@@ -86,19 +314,16 @@ int imv_navigator_add(struct imv_navigator *nav, const char *path,
           continue;
         }
         snprintf(path_buf, sizeof path_buf, "%s/%s", path, dir->d_name);
-        struct stat new_path_info;
-        if (stat(path_buf, &new_path_info)) {
-          result = 1;
-          break;
-        }
-        int is_dir = S_ISDIR(new_path_info.st_mode);
+        struct stat entry_info;
+        bool have_info;
+        const bool is_dir = entry_is_dir(path_buf, dir, &entry_info, &have_info);
         if (is_dir && recursive) {
           if (imv_navigator_add(nav, path_buf, recursive) != 0) {
             result = 1;
             break;
           }
         } else if (!is_dir) {
-          if (add_item(nav, path_buf) != 0) {
+          if (add_item(nav, path_buf, have_info ? &entry_info : NULL) != 0) {
             result = 1;
             break;
           }
@@ -108,12 +333,22 @@ int imv_navigator_add(struct imv_navigator *nav, const char *path,
     }
     return result;
   } else {
-    return add_item(nav, path);
+    return add_item(nav, path, &path_info);
   }
 
   return 0;
 }
 
+void imv_navigator_add_indexed(struct imv_navigator *nav, const char *path,
+                               time_t mtime, long long size)
+{
+  struct stat info;
+  memset(&info, 0, sizeof info);
+  info.st_mtim.tv_sec = mtime;
+  info.st_size = size;
+  add_item(nav, path, &info);
+}
+
 const char *imv_navigator_selection(struct imv_navigator *nav)
 {
   const char *path = imv_navigator_at(nav, nav->cur_path);
@@ -181,23 +416,12 @@ void imv_navigator_select_abs(struct imv_navigator *nav, ssize_t index)
 
 void imv_navigator_remove(struct imv_navigator *nav, const char *path)
 {
-  bool found = false;
-  size_t removed = 0;
-  for (size_t i = 0; i < nav->paths->len; ++i) {
-    struct nav_item *item = nav->paths->items[i];
-    if (!strcmp(item->path, path)) {
-      free(item->path);
-      free(item);
-      list_remove(nav->paths, i);
-      removed = i;
-      found = true;
-      break;
-    }
-  }
-
-  if (!found) {
+  struct nav_item *item = hash_find(&nav->by_path, path);
+  if (!item) {
     return;
   }
+  const size_t removed = item->index;
+  remove_item_at(nav, removed);
 
   if (nav->cur_path == removed) {
     /* We just removed the current path */
@@ -220,10 +444,7 @@ void imv_navigator_remove_at(struct imv_navigator *nav, size_t index)
   if (index >= nav->paths->len) {
     return;
   }
-  struct nav_item *item = nav->paths->items[index];
-  free(item->path);
-  free(item);
-  list_remove(nav->paths, index);
+  remove_item_at(nav, index);
 
   if (nav->cur_path == index) {
     /* We just removed the current path */
@@ -249,6 +470,10 @@ void imv_navigator_remove_all(struct imv_navigator *nav)
     free(item);
   }
   list_clear(nav->paths);
+  hash_free(&nav->by_path);
+  hash_free(&nav->by_base);
+  hash_init(&nav->by_path);
+  hash_init(&nav->by_base);
   nav->cur_path = 0;
   nav->changed = 1;
 }
@@ -256,20 +481,15 @@ void imv_navigator_remove_all(struct imv_navigator *nav)
 ssize_t imv_navigator_find_path(struct imv_navigator *nav, const char *path)
 {
   /* first try to match the exact path */
-  for (size_t i = 0; i < nav->paths->len; ++i) {
-    struct nav_item *item = nav->paths->items[i];
-    if (!strcmp(item->path, path)) {
-      return (ssize_t)i;
-    }
+  struct nav_item *item = hash_find(&nav->by_path, path);
+  if (item) {
+    return (ssize_t)item->index;
   }
 
   /* no exact matches, try the final portion of the path */
-  for (size_t i = 0; i < nav->paths->len; ++i) {
-    struct nav_item *item = nav->paths->items[i];
-    char *last_sep = strrchr(item->path, '/');
-    if (last_sep && !strcmp(last_sep+1, path)) {
-      return (ssize_t)i;
-    }
+  item = hash_find(&nav->by_base, path);
+  if (item) {
+    return (ssize_t)item->index;
   }
 
   /* no matches at all, give up */
@@ -284,7 +504,7 @@ int imv_navigator_poll_changed(struct imv_navigator *nav)
     return 1;
   }
 
-  if (nav->paths->len == 0) {
+  if (nav->paths->len == 0 || !nav->mtime_polling) {
     return 0;
   };
 
@@ -308,16 +528,260 @@ int imv_navigator_poll_changed(struct imv_navigator *nav)
   return 0;
 }
 
+void imv_navigator_set_mtime_polling(struct imv_navigator *nav, int enabled)
+{
+  nav->mtime_polling = enabled;
+}
+
+void imv_navigator_mark_file_changed(struct imv_navigator *nav)
+{
+  nav->changed = 1;
+}
+
 int imv_navigator_wrapped(struct imv_navigator *nav)
 {
   return nav->wrapped;
 }
 
+int imv_navigator_last_direction(struct imv_navigator *nav)
+{
+  return nav->last_move_direction < 0 ? -1 : 1;
+}
+
 size_t imv_navigator_length(struct imv_navigator *nav)
 {
   return nav->paths->len;
 }
 
+/* Sorting splits the item array in half recursively, handing one half to a
+ * new thread while this one sorts the other, down to a depth chosen from
+ * the core count; a 500k-entry list sorts in roughly 1/cores the time.
+ * Below this size the thread hand-off costs more than it saves. */
+#define PARALLEL_SORT_MIN (1 << 15)
+
+/* comparator context; sorts run one at a time, from the main thread */
+static enum nav_sort_mode sort_mode;
+static int sort_descending;
+
+/* Compare paths so that "img9" comes before "img10": runs of digits are
+ * compared by numeric value, everything else byte-wise */
+static int natural_compare(const char *a, const char *b)
+{
+  while (*a && *b) {
+    if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+      /* skip leading zeros, then the longer run of digits is the bigger
+       * number; equal-length runs compare lexically */
+      while (*a == '0') {
+        ++a;
+      }
+      while (*b == '0') {
+        ++b;
+      }
+      size_t la = 0;
+      while (isdigit((unsigned char)a[la])) {
+        ++la;
+      }
+      size_t lb = 0;
+      while (isdigit((unsigned char)b[lb])) {
+        ++lb;
+      }
+      if (la != lb) {
+        return la < lb ? -1 : 1;
+      }
+      const int cmp = memcmp(a, b, la);
+      if (cmp) {
+        return cmp;
+      }
+      a += la;
+      b += lb;
+    } else {
+      if (*a != *b) {
+        return (unsigned char)*a - (unsigned char)*b;
+      }
+      ++a;
+      ++b;
+    }
+  }
+  return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int compare_items(const struct nav_item *a, const struct nav_item *b)
+{
+  int cmp = 0;
+  switch (sort_mode) {
+    case NAV_SORT_NONE:
+      cmp = a->seq < b->seq ? -1 : 1;
+      break;
+    case NAV_SORT_NAME:
+      cmp = strcmp(a->path, b->path);
+      break;
+    case NAV_SORT_NATURAL:
+      cmp = natural_compare(a->path, b->path);
+      break;
+    case NAV_SORT_MTIME:
+      if (a->mtime != b->mtime) {
+        cmp = a->mtime < b->mtime ? -1 : 1;
+      } else {
+        cmp = strcmp(a->path, b->path);
+      }
+      break;
+    case NAV_SORT_SIZE:
+      if (a->size != b->size) {
+        cmp = a->size < b->size ? -1 : 1;
+      } else {
+        cmp = strcmp(a->path, b->path);
+      }
+      break;
+  }
+  return sort_descending ? -cmp : cmp;
+}
+
+struct sort_job {
+  struct nav_item **items;
+  struct nav_item **tmp;
+  size_t len;
+  int depth;
+};
+
+static void merge_sort(struct nav_item **items, struct nav_item **tmp,
+                       size_t len, int depth);
+
+static void *sort_thread(void *raw)
+{
+  struct sort_job *job = raw;
+  merge_sort(job->items, job->tmp, job->len, job->depth);
+  return NULL;
+}
+
+static void merge_sort(struct nav_item **items, struct nav_item **tmp,
+                       size_t len, int depth)
+{
+  if (len < 2) {
+    return;
+  }
+  const size_t half = len / 2;
+
+  if (depth > 0 && len >= PARALLEL_SORT_MIN) {
+    struct sort_job job = { items, tmp, half, depth - 1 };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &sort_thread, &job) == 0) {
+      merge_sort(items + half, tmp + half, len - half, depth - 1);
+      pthread_join(thread, NULL);
+    } else {
+      merge_sort(items, tmp, half, 0);
+      merge_sort(items + half, tmp + half, len - half, 0);
+    }
+  } else {
+    merge_sort(items, tmp, half, depth);
+    merge_sort(items + half, tmp + half, len - half, depth);
+  }
+
+  /* merge the sorted halves; taking the left on ties keeps this stable */
+  size_t i = 0;
+  size_t j = half;
+  size_t k = 0;
+  while (i < half && j < len) {
+    tmp[k++] = compare_items(items[i], items[j]) <= 0 ? items[i++] : items[j++];
+  }
+  while (i < half) {
+    tmp[k++] = items[i++];
+  }
+  while (j < len) {
+    tmp[k++] = items[j++];
+  }
+  memcpy(items, tmp, len * sizeof *items);
+}
+
+struct meta_job {
+  struct nav_item **items;
+  size_t len;
+};
+
+/* Fill in mtime and size for items that haven't been statted yet */
+static void *meta_thread(void *raw)
+{
+  struct meta_job *job = raw;
+  for (size_t i = 0; i < job->len; ++i) {
+    struct nav_item *item = job->items[i];
+    if (item->have_meta) {
+      continue;
+    }
+    struct stat info;
+    if (stat(item->path, &info) == 0) {
+      item->mtime = info.st_mtim.tv_sec;
+      item->size = info.st_size;
+    }
+    item->have_meta = true;
+  }
+  return NULL;
+}
+
+static int sort_depth(void)
+{
+  long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cores > 8) {
+    num_cores = 8;
+  }
+  int depth = 0;
+  while ((1 << (depth + 1)) <= num_cores) {
+    ++depth;
+  }
+  return depth;
+}
+
+void imv_navigator_sort(struct imv_navigator *nav, enum nav_sort_mode mode,
+                        int descending)
+{
+  const size_t len = nav->paths->len;
+  if (len < 2) {
+    return;
+  }
+
+  struct nav_item **items = (struct nav_item **)nav->paths->items;
+  const int depth = sort_depth();
+
+  if (mode == NAV_SORT_MTIME || mode == NAV_SORT_SIZE) {
+    /* stat whatever metadata the scan didn't capture, split across the
+     * same number of threads the sort will use */
+    const size_t num_jobs = (size_t)1 << depth;
+    const size_t stride = (len + num_jobs - 1) / num_jobs;
+    struct meta_job jobs[1 << 3];
+    pthread_t threads[1 << 3];
+    size_t spawned = 0;
+    for (size_t j = 1; j < num_jobs && j * stride < len; ++j) {
+      const size_t begin = j * stride;
+      const size_t count = begin + stride > len ? len - begin : stride;
+      jobs[spawned] = (struct meta_job) { items + begin, count };
+      if (pthread_create(&threads[spawned], NULL, &meta_thread,
+            &jobs[spawned]) != 0) {
+        break;
+      }
+      ++spawned;
+    }
+    struct meta_job own = { items, stride < len ? stride : len };
+    meta_thread(&own);
+    for (size_t j = 0; j < spawned; ++j) {
+      pthread_join(threads[j], NULL);
+    }
+    /* anything a failed spawn left behind */
+    struct meta_job rest = { items, len };
+    meta_thread(&rest);
+  }
+
+  struct nav_item *cur = items[nav->cur_path];
+
+  sort_mode = mode;
+  sort_descending = descending;
+  struct nav_item **tmp = malloc(len * sizeof *tmp);
+  merge_sort(items, tmp, len, depth);
+  free(tmp);
+
+  for (size_t i = 0; i < len; ++i) {
+    items[i]->index = i;
+  }
+  nav->cur_path = cur->index;
+}
+
 char *imv_navigator_at(struct imv_navigator *nav, size_t index)
 {
   if (index < nav->paths->len) {
@@ -327,4 +791,19 @@ char *imv_navigator_at(struct imv_navigator *nav, size_t index)
   return NULL;
 }
 
+int imv_navigator_get_meta(struct imv_navigator *nav, size_t index,
+                           time_t *mtime, long long *size)
+{
+  if (index >= nav->paths->len) {
+    return 0;
+  }
+  struct nav_item *item = nav->paths->items[index];
+  if (!item->have_meta) {
+    return 0;
+  }
+  *mtime = item->mtime;
+  *size = item->size;
+  return 1;
+}
+
 /* vim:set ts=2 sts=2 sw=2 et: */
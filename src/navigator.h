@@ -1,6 +1,7 @@
 #ifndef IMV_NAVIGATOR_H
 #define IMV_NAVIGATOR_H
 
+#include <time.h>
 #include <unistd.h>
 
 /* Creates an instance of imv_navigator */
@@ -17,6 +18,12 @@ void imv_navigator_free(struct imv_navigator *nav);
 int imv_navigator_add(struct imv_navigator *nav, const char *path,
                        int recursive);
 
+/* Adds a path restored from a saved session index: assumed to be a file,
+ * with the metadata captured on a previous run, so no stat is performed.
+ * An internal copy of path is made. */
+void imv_navigator_add_indexed(struct imv_navigator *nav, const char *path,
+                               time_t mtime, long long size);
+
 /* Returns a read-only reference to the current path. The pointer is only
  * guaranteed to be valid until the next call to an imv_navigator method. */
 const char *imv_navigator_selection(struct imv_navigator *nav);
@@ -48,15 +55,48 @@ ssize_t imv_navigator_find_path(struct imv_navigator *nav, const char *path);
  * changed since last called */
 int imv_navigator_poll_changed(struct imv_navigator *nav);
 
+/* Enable or disable the once-a-second mtime stat of the current file in
+ * imv_navigator_poll_changed. Disabled when an imv_watcher delivers change
+ * notifications instead. */
+void imv_navigator_set_mtime_polling(struct imv_navigator *nav, int enabled);
+
+/* Note that the underlying file changed, so the next poll_changed reports it.
+ * Called when an imv_watcher sees the current file rewritten. */
+void imv_navigator_mark_file_changed(struct imv_navigator *nav);
+
 /* Check whether navigator wrapped around paths list */
 int imv_navigator_wrapped(struct imv_navigator *nav);
 
+/* Return the direction of the last selection change: 1 forwards, -1 backwards */
+int imv_navigator_last_direction(struct imv_navigator *nav);
+
 /* Return how many paths in navigator */
 size_t imv_navigator_length(struct imv_navigator *nav);
 
 /* Return a path for a given index */
 char *imv_navigator_at(struct imv_navigator *nav, size_t index);
 
+/* Fetch the file metadata held for the given index, as captured by a scan,
+ * sort or session index. Returns 0 with the outputs untouched when none
+ * has been captured. */
+int imv_navigator_get_meta(struct imv_navigator *nav, size_t index,
+                           time_t *mtime, long long *size);
+
+/* How imv_navigator_sort orders the path list */
+enum nav_sort_mode {
+  NAV_SORT_NONE,    /* the order paths were discovered in */
+  NAV_SORT_NAME,    /* full path, byte-wise */
+  NAV_SORT_NATURAL, /* full path, with runs of digits compared numerically */
+  NAV_SORT_MTIME,   /* file modification time, oldest first */
+  NAV_SORT_SIZE,    /* file size, smallest first */
+};
+
+/* Sort the path list. The current selection follows the file it was on.
+ * File metadata is taken from stats the navigator already performed where
+ * possible, and large lists are sorted across several threads. */
+void imv_navigator_sort(struct imv_navigator *nav, enum nav_sort_mode mode,
+                        int descending);
+
 
 #endif
 
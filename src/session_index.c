@@ -0,0 +1,326 @@
+#include "session_index.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "navigator.h"
+
+/* Some systems like GNU/Hurd don't define PATH_MAX */
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Bumped when the file layout changes; files with another version are
+ * ignored and rewritten on exit */
+#define INDEX_VERSION 1
+
+/* One path restored into the navigator, tracked until the background scan
+ * either re-finds it or finishes without it */
+struct index_entry {
+  char *path;
+  bool confirmed;
+  struct index_entry *next;
+};
+
+struct imv_session_index {
+  uint64_t key; /* hash of the canonical root paths and the recursive flag */
+  bool have_roots;
+  /* restored paths, chained on their hash so the scan's confirm lookups
+   * don't walk the whole list */
+  struct index_entry **buckets;
+  size_t num_buckets; /* always a power of two */
+  size_t num_entries;
+};
+
+static uint64_t hash_str(uint64_t hash, const char *str)
+{
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= UINT64_C(1099511628211);
+  }
+  return hash;
+}
+
+#define FNV_BASIS UINT64_C(14695981039346656037)
+
+struct imv_session_index *imv_session_index_create(void)
+{
+  struct imv_session_index *index = calloc(1, sizeof *index);
+  index->key = FNV_BASIS;
+  index->num_buckets = 128;
+  index->buckets = calloc(index->num_buckets, sizeof *index->buckets);
+  return index;
+}
+
+static void free_entries(struct imv_session_index *index)
+{
+  for (size_t i = 0; i < index->num_buckets; ++i) {
+    struct index_entry *entry = index->buckets[i];
+    while (entry) {
+      struct index_entry *next = entry->next;
+      free(entry->path);
+      free(entry);
+      entry = next;
+    }
+    index->buckets[i] = NULL;
+  }
+  index->num_entries = 0;
+}
+
+void imv_session_index_free(struct imv_session_index *index)
+{
+  if (!index) {
+    return;
+  }
+  free_entries(index);
+  free(index->buckets);
+  free(index);
+}
+
+void imv_session_index_add_root(struct imv_session_index *index,
+                                const char *path, bool recursive)
+{
+  /* canonicalise so 'imv pics' and 'imv ./pics/' share an index */
+  char *real = realpath(path, NULL);
+  index->key = hash_str(index->key, real ? real : path);
+  /* fold in a flag byte after each root, so roots "a","b" differ from "ab"
+   * and a recursive run doesn't reuse a non-recursive index */
+  index->key ^= recursive ? 1 : 2;
+  index->key *= UINT64_C(1099511628211);
+  index->have_roots = true;
+  free(real);
+}
+
+/* Build the path of the index file for the current roots. Returns false
+ * when no cache directory can be determined. */
+static bool index_file_path(const struct imv_session_index *index,
+                            char *buf, size_t buf_len)
+{
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home && cache_home[0]) {
+    snprintf(buf, buf_len, "%s/imv/index-%016" PRIx64, cache_home, index->key);
+  } else {
+    const char *home = getenv("HOME");
+    if (!home || !home[0]) {
+      return false;
+    }
+    snprintf(buf, buf_len, "%s/.cache/imv/index-%016" PRIx64, home, index->key);
+  }
+  return true;
+}
+
+static void mkdir_recursively(const char *path)
+{
+  char buf[PATH_MAX];
+  snprintf(buf, sizeof buf, "%s", path);
+  for (char *p = buf + 1; *p; ++p) {
+    if (*p == '/') {
+      *p = 0;
+      mkdir(buf, 0700);
+      *p = '/';
+    }
+  }
+  mkdir(buf, 0700);
+}
+
+static struct index_entry **bucket_for(struct imv_session_index *index,
+                                       const char *path)
+{
+  return &index->buckets[hash_str(FNV_BASIS, path) & (index->num_buckets - 1)];
+}
+
+static void add_entry(struct imv_session_index *index, const char *path)
+{
+  if (index->num_entries >= index->num_buckets * 2) {
+    struct index_entry **old_buckets = index->buckets;
+    const size_t old_num = index->num_buckets;
+    index->num_buckets = old_num * 2;
+    index->buckets = calloc(index->num_buckets, sizeof *index->buckets);
+    for (size_t i = 0; i < old_num; ++i) {
+      struct index_entry *entry = old_buckets[i];
+      while (entry) {
+        struct index_entry *next = entry->next;
+        struct index_entry **slot = bucket_for(index, entry->path);
+        entry->next = *slot;
+        *slot = entry;
+        entry = next;
+      }
+    }
+    free(old_buckets);
+  }
+
+  struct index_entry *entry = calloc(1, sizeof *entry);
+  entry->path = strdup(path);
+  struct index_entry **slot = bucket_for(index, path);
+  entry->next = *slot;
+  *slot = entry;
+  index->num_entries++;
+}
+
+static struct index_entry *find_entry(struct imv_session_index *index,
+                                      const char *path)
+{
+  struct index_entry *entry = *bucket_for(index, path);
+  for (; entry; entry = entry->next) {
+    if (!strcmp(entry->path, path)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+size_t imv_session_index_load(struct imv_session_index *index,
+                              struct imv_navigator *nav)
+{
+  char path[PATH_MAX+1];
+  if (!index->have_roots || !index_file_path(index, path, sizeof path)) {
+    return 0;
+  }
+
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return 0;
+  }
+
+  char *line = NULL;
+  size_t line_cap = 0;
+
+  int version = 0;
+  if (getline(&line, &line_cap, f) < 0 ||
+      sscanf(line, "imv-index %d", &version) != 1 ||
+      version != INDEX_VERSION) {
+    imv_log(IMV_DEBUG, "session index: ignoring %s: bad header\n", path);
+    free(line);
+    fclose(f);
+    return 0;
+  }
+
+  /* each line is '<mtime> <size> <path>'; the path runs to the newline
+   * as paths may contain spaces */
+  size_t restored = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_cap, f)) > 0) {
+    if (line[len-1] == '\n') {
+      line[--len] = 0;
+    }
+    char *end = NULL;
+    const long long mtime = strtoll(line, &end, 10);
+    if (end == line || *end != ' ') {
+      continue;
+    }
+    char *start = end + 1;
+    const long long size = strtoll(start, &end, 10);
+    if (end == start || *end != ' ' || end[1] != '/') {
+      continue;
+    }
+    imv_navigator_add_indexed(nav, end + 1, (time_t)mtime, size);
+    add_entry(index, end + 1);
+    ++restored;
+  }
+
+  free(line);
+  fclose(f);
+  imv_log(IMV_DEBUG, "session index: restored %zu paths from %s\n",
+      restored, path);
+  return restored;
+}
+
+bool imv_session_index_confirm(struct imv_session_index *index,
+                               const char *path)
+{
+  if (index->num_entries == 0) {
+    return false;
+  }
+  struct index_entry *entry = find_entry(index, path);
+  if (!entry) {
+    /* the index holds canonical paths; scan results are only canonical
+     * when the root given on the command line was */
+    char *real = realpath(path, NULL);
+    if (real) {
+      entry = find_entry(index, real);
+      free(real);
+    }
+  }
+  if (!entry) {
+    return false;
+  }
+  entry->confirmed = true;
+  return true;
+}
+
+void imv_session_index_reconcile(struct imv_session_index *index,
+                                 struct imv_navigator *nav)
+{
+  size_t removed = 0;
+  for (size_t i = 0; i < index->num_buckets; ++i) {
+    for (struct index_entry *entry = index->buckets[i]; entry;
+         entry = entry->next) {
+      if (!entry->confirmed) {
+        imv_navigator_remove(nav, entry->path);
+        ++removed;
+      }
+    }
+  }
+  if (removed) {
+    imv_log(IMV_DEBUG, "session index: dropped %zu stale paths\n", removed);
+  }
+  /* the scan is over; nothing left for confirm lookups to do */
+  free_entries(index);
+}
+
+void imv_session_index_save(struct imv_session_index *index,
+                            struct imv_navigator *nav)
+{
+  char path[PATH_MAX+1];
+  if (!index->have_roots || !index_file_path(index, path, sizeof path)) {
+    return;
+  }
+
+  char dir[PATH_MAX+1];
+  snprintf(dir, sizeof dir, "%s", path);
+  char *sep = strrchr(dir, '/');
+  if (sep) {
+    *sep = 0;
+    mkdir_recursively(dir);
+  }
+
+  /* write a sibling and rename it into place, so a crash mid-write can't
+   * leave a truncated index behind */
+  char tmp_path[PATH_MAX+32];
+  snprintf(tmp_path, sizeof tmp_path, "%s.%d", path, (int)getpid());
+  FILE *f = fopen(tmp_path, "w");
+  if (!f) {
+    return;
+  }
+
+  fprintf(f, "imv-index %d\n", INDEX_VERSION);
+  const size_t len = imv_navigator_length(nav);
+  for (size_t i = 0; i < len; ++i) {
+    const char *item = imv_navigator_at(nav, i);
+    /* skip stdin's '-' entry, and the (pathological) paths the line-based
+     * format can't represent */
+    if (!item || item[0] != '/' || strchr(item, '\n')) {
+      continue;
+    }
+    time_t mtime = 0;
+    long long size = 0;
+    imv_navigator_get_meta(nav, i, &mtime, &size);
+    fprintf(f, "%lld %lld %s\n", (long long)mtime, size, item);
+  }
+
+  if (fclose(f) != 0) {
+    unlink(tmp_path);
+    return;
+  }
+  rename(tmp_path, path);
+}
+
+/* vim:set ts=2 sts=2 sw=2 et: */
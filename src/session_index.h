@@ -0,0 +1,51 @@
+#ifndef IMV_SESSION_INDEX_H
+#define IMV_SESSION_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct imv_navigator;
+
+/* Persists the navigator's path list between runs, keyed by the directories
+ * given on the command line, so restarting over a large collection doesn't
+ * wait for the directory walk before showing the first image. The saved
+ * list is restored up front and the normal background scan reconciles it
+ * against the filesystem. */
+
+/* Creates an instance of imv_session_index */
+struct imv_session_index *imv_session_index_create(void);
+
+/* Cleans up an imv_session_index instance */
+void imv_session_index_free(struct imv_session_index *index);
+
+/* Mix a scan root into the key identifying this session's index file.
+ * Call once per directory given at startup, before loading. */
+void imv_session_index_add_root(struct imv_session_index *index,
+                                const char *path, bool recursive);
+
+/* Restore the paths saved for these roots into the navigator, with the
+ * metadata captured last run, without touching the filesystem. Returns the
+ * number of paths restored; 0 when no usable index exists. */
+size_t imv_session_index_load(struct imv_session_index *index,
+                              struct imv_navigator *nav);
+
+/* Note that the background scan re-found the given path. Returns true when
+ * the path was restored from the index, i.e. it is already in the navigator
+ * and should not be added again. */
+bool imv_session_index_confirm(struct imv_session_index *index,
+                               const char *path);
+
+/* Call when the background scan has covered every root: removes restored
+ * paths the scan didn't confirm from the navigator - files deleted since
+ * the index was saved. */
+void imv_session_index_reconcile(struct imv_session_index *index,
+                                 struct imv_navigator *nav);
+
+/* Write the navigator's current path list and metadata out for the next
+ * run over the same roots */
+void imv_session_index_save(struct imv_session_index *index,
+                            struct imv_navigator *nav);
+
+#endif
+
+/* vim:set ts=2 sts=2 sw=2 et: */
@@ -0,0 +1,263 @@
+#include "shm_cache.h"
+
+#include "bitmap.h"
+#include "image.h"
+#include "list.h"
+#include "source.h"
+#include "source_private.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Entries are plain files under XDG_RUNTIME_DIR - tmpfs on most systems -
+ * named after a hash of the image's canonical path. They are written to a
+ * temporary name and renamed into place, so a reader either sees a whole
+ * entry or none at all, and carry the source file's size and mtime so a
+ * stale entry reads as a miss. A hit costs an mmap; the pixels stay in the
+ * page cache, shared between every instance mapping them. */
+
+#define CACHE_MAGIC UINT32_C(0x766d6901) /* "imv", version 1 */
+
+/* How much pixel data one instance will keep published; the oldest entries
+ * are withdrawn first. Everything an instance published is withdrawn when
+ * it exits. */
+#define CACHE_BUDGET ((size_t)512 * 1024 * 1024)
+
+struct cache_header {
+  uint32_t magic;
+  int32_t width;
+  int32_t height;
+  uint32_t format; /* enum imv_pixelformat */
+  uint64_t file_size; /* of the source image, for staleness checks */
+  int64_t file_mtime;
+  uint64_t profile_len; /* ICC profile bytes following the pixels */
+};
+
+/* An entry this instance published, so it can be withdrawn later */
+struct published_entry {
+  char *name;
+  size_t size;
+};
+
+struct imv_shm_cache {
+  struct list *published; /* list of published_entry */
+  size_t published_size;
+};
+
+static uint64_t hash_str(const char *str)
+{
+  uint64_t hash = UINT64_C(14695981039346656037); /* FNV-1a */
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= UINT64_C(1099511628211);
+  }
+  return hash;
+}
+
+/* Derive the cache entry filename for an image path. Hashes the canonical
+ * path, so instances viewing the same file through different relative paths
+ * share an entry. Returns -1 if the path can't be resolved. */
+static int entry_name(char *buf, size_t len, const char *path)
+{
+  char real[PATH_MAX];
+  if (!realpath(path, real)) {
+    return -1;
+  }
+
+  const char *base = getenv("XDG_RUNTIME_DIR");
+  if (!base) {
+    base = "/tmp";
+  }
+  /* the uid matters only for the /tmp fallback; the runtime dir is already
+   * per-user */
+  snprintf(buf, len, "%s/imv-cache-%d-%016" PRIx64, base, (int)getuid(),
+      hash_str(real));
+  return 0;
+}
+
+struct imv_shm_cache *imv_shm_cache_create(void)
+{
+  struct imv_shm_cache *cache = calloc(1, sizeof *cache);
+  cache->published = list_create();
+  return cache;
+}
+
+static void withdraw_entry(struct imv_shm_cache *cache, size_t index)
+{
+  struct published_entry *entry = cache->published->items[index];
+  unlink(entry->name);
+  cache->published_size -= entry->size;
+  free(entry->name);
+  free(entry);
+  list_remove(cache->published, index);
+}
+
+void imv_shm_cache_free(struct imv_shm_cache *cache)
+{
+  if (!cache) {
+    return;
+  }
+  while (cache->published->len > 0) {
+    withdraw_entry(cache, cache->published->len - 1);
+  }
+  list_free(cache->published);
+  free(cache);
+}
+
+/* The source serving a mapped entry. The bitmap is full resolution and
+ * already decoded, so size preferences are ignored and each first-frame
+ * load just takes another reference. */
+struct private {
+  struct imv_bitmap *bmp;
+};
+
+static void free_private(void *raw_private)
+{
+  struct private *private = raw_private;
+  imv_bitmap_unref(private->bmp);
+  free(private);
+}
+
+static void load_image(void *raw_private, struct imv_image **image,
+    int *frametime)
+{
+  struct private *private = raw_private;
+  *frametime = 0;
+  *image = imv_image_create_from_bitmap(imv_bitmap_ref(private->bmp));
+}
+
+static const struct imv_source_vtable vtable = {
+  .load_first_frame = load_image,
+  .free = free_private
+};
+
+struct imv_source *imv_shm_cache_open(struct imv_shm_cache *cache,
+    const char *path)
+{
+  (void)cache;
+
+  char name[PATH_MAX + 64];
+  struct stat file_info;
+  if (entry_name(name, sizeof name, path) || stat(path, &file_info)) {
+    return NULL;
+  }
+
+  int fd = open(name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat entry_info;
+  if (fstat(fd, &entry_info) || (size_t)entry_info.st_size < sizeof(struct cache_header)) {
+    close(fd);
+    return NULL;
+  }
+
+  const size_t map_len = entry_info.st_size;
+  void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  struct cache_header header;
+  memcpy(&header, map, sizeof header);
+
+  const size_t pixels = (size_t)4 * header.width * header.height;
+  if (header.magic != CACHE_MAGIC
+      || header.width <= 0 || header.height <= 0
+      || map_len != sizeof header + pixels + header.profile_len) {
+    munmap(map, map_len);
+    return NULL;
+  }
+  if (header.file_size != (uint64_t)file_info.st_size
+      || header.file_mtime != (int64_t)file_info.st_mtime) {
+    /* published for an older version of the file; withdraw it so the next
+     * decode can republish */
+    munmap(map, map_len);
+    unlink(name);
+    return NULL;
+  }
+
+  struct imv_bitmap *bmp = calloc(1, sizeof *bmp);
+  bmp->width = header.width;
+  bmp->height = header.height;
+  bmp->format = header.format;
+  bmp->data = (unsigned char*)map + sizeof header;
+  bmp->map = map;
+  bmp->map_len = map_len;
+  bmp->refs = 1;
+  if (header.profile_len) {
+    bmp->profile = malloc(header.profile_len);
+    memcpy(bmp->profile, (unsigned char*)map + sizeof header + pixels,
+        header.profile_len);
+    bmp->profile_len = header.profile_len;
+  }
+
+  struct private *private = calloc(1, sizeof *private);
+  private->bmp = bmp;
+  return imv_source_create(&vtable, private);
+}
+
+void imv_shm_cache_put(struct imv_shm_cache *cache, const char *path,
+    struct imv_bitmap *bmp)
+{
+  char name[PATH_MAX + 64];
+  struct stat file_info;
+  if (entry_name(name, sizeof name, path) || stat(path, &file_info)) {
+    return;
+  }
+
+  const size_t pixels = (size_t)4 * bmp->width * bmp->height;
+  const size_t total = sizeof(struct cache_header) + pixels + bmp->profile_len;
+  if (total > CACHE_BUDGET) {
+    return;
+  }
+
+  /* O_EXCL keeps two instances decoding the same image from writing over
+   * each other; whoever loses just leaves the winner's entry in place */
+  char tmp_name[sizeof name + 32];
+  snprintf(tmp_name, sizeof tmp_name, "%s.%d", name, (int)getpid());
+  int fd = open(tmp_name, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return;
+  }
+
+  struct cache_header header = {
+    .magic = CACHE_MAGIC,
+    .width = bmp->width,
+    .height = bmp->height,
+    .format = bmp->format,
+    .file_size = file_info.st_size,
+    .file_mtime = file_info.st_mtime,
+    .profile_len = bmp->profile_len,
+  };
+
+  bool ok = write(fd, &header, sizeof header) == (ssize_t)sizeof header
+      && write(fd, bmp->data, pixels) == (ssize_t)pixels
+      && (!bmp->profile_len
+          || write(fd, bmp->profile, bmp->profile_len) == (ssize_t)bmp->profile_len);
+  close(fd);
+  if (!ok || rename(tmp_name, name)) {
+    unlink(tmp_name);
+    return;
+  }
+
+  struct published_entry *entry = malloc(sizeof *entry);
+  entry->name = strdup(name);
+  entry->size = total;
+  list_append(cache->published, entry);
+  cache->published_size += total;
+  while (cache->published_size > CACHE_BUDGET && cache->published->len > 1) {
+    withdraw_entry(cache, 0);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef IMV_SHM_CACHE_H
+#define IMV_SHM_CACHE_H
+
+struct imv_bitmap;
+struct imv_shm_cache;
+struct imv_source;
+
+/* A decoded-frame cache shared between running imv instances. Instances
+ * publish the stills they decode as mappable files under XDG_RUNTIME_DIR,
+ * keyed by the image's canonical path; other instances showing the same
+ * image then map the pixels in rather than decoding them again.
+ */
+
+/* Create an imv_shm_cache instance */
+struct imv_shm_cache *imv_shm_cache_create(void);
+
+/* Clean up an imv_shm_cache instance, withdrawing the entries it published */
+void imv_shm_cache_free(struct imv_shm_cache *cache);
+
+/* Build a source serving path's pixels from the shared cache, or return
+ * NULL if no other instance has published them */
+struct imv_source *imv_shm_cache_open(struct imv_shm_cache *cache,
+    const char *path);
+
+/* Publish a frame decoded from path for other instances to use */
+void imv_shm_cache_put(struct imv_shm_cache *cache, const char *path,
+    struct imv_bitmap *bmp);
+
+#endif
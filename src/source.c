@@ -1,8 +1,11 @@
 #include "source.h"
 #include "source_private.h"
 
+#include "trace.h"
+
 #include <pthread.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 struct imv_source {
   /* pointers to implementation's functions */
@@ -33,42 +36,111 @@ struct imv_source *imv_source_create(const struct imv_source_vtable *vtable, voi
   return source;
 }
 
-static void *free_thread(void *src)
+/* All sources share a fixed-size pool of worker threads, fed by a simple
+ * queue. Spawning a thread per async call is measurably slow when animations
+ * request a new frame every few milliseconds. The pool is created on first
+ * use and lives for the rest of the process.
+ */
+
+enum task_type {
+  TASK_LOAD_FIRST_FRAME,
+  TASK_LOAD_NEXT_FRAME,
+  TASK_FREE
+};
+
+struct task {
+  enum task_type type;
+  struct imv_source *source;
+  struct task *next;
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct task *pool_head;
+static struct task *pool_tail;
+
+static void *worker_thread(void *unused)
 {
-  imv_source_free(src);
+  (void)unused;
+
+  while (1) {
+    pthread_mutex_lock(&pool_mutex);
+    while (!pool_head) {
+      pthread_cond_wait(&pool_cond, &pool_mutex);
+    }
+    struct task *task = pool_head;
+    pool_head = task->next;
+    if (!pool_head) {
+      pool_tail = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    switch (task->type) {
+      case TASK_LOAD_FIRST_FRAME:
+        imv_source_load_first_frame(task->source);
+        break;
+      case TASK_LOAD_NEXT_FRAME:
+        imv_source_load_next_frame(task->source);
+        break;
+      case TASK_FREE:
+        imv_source_free(task->source);
+        break;
+    }
+
+    free(task);
+  }
   return NULL;
 }
 
-void imv_source_async_free(struct imv_source *src)
+static void pool_init(void)
 {
-  pthread_t thread;
-  pthread_create(&thread, NULL, free_thread, src);
-  pthread_detach(thread);
+  long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_workers < 2) {
+    num_workers = 2;
+  } else if (num_workers > 8) {
+    num_workers = 8;
+  }
+
+  for (long i = 0; i < num_workers; ++i) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, worker_thread, NULL);
+    pthread_detach(thread);
+  }
 }
 
-static void *first_frame_thread(void *src)
+static void pool_submit(enum task_type type, struct imv_source *src)
 {
-  imv_source_load_first_frame(src);
-  return NULL;
+  pthread_once(&pool_once, pool_init);
+
+  struct task *task = calloc(1, sizeof *task);
+  task->type = type;
+  task->source = src;
+
+  pthread_mutex_lock(&pool_mutex);
+  if (pool_tail) {
+    pool_tail->next = task;
+  } else {
+    pool_head = task;
+  }
+  pool_tail = task;
+  pthread_cond_signal(&pool_cond);
+  pthread_mutex_unlock(&pool_mutex);
 }
 
-void imv_source_async_load_first_frame(struct imv_source *src)
+void imv_source_async_free(struct imv_source *src)
 {
-  pthread_t thread;
-  pthread_create(&thread, NULL, first_frame_thread, src);
-  pthread_detach(thread);
+  pool_submit(TASK_FREE, src);
 }
 
-static void *next_frame_thread(void *src)
+void imv_source_async_load_first_frame(struct imv_source *src)
 {
-  imv_source_load_next_frame(src);
-  return NULL;
+  pool_submit(TASK_LOAD_FIRST_FRAME, src);
 }
+
 void imv_source_async_load_next_frame(struct imv_source *src)
 {
-  pthread_t thread;
-  pthread_create(&thread, NULL, next_frame_thread, src);
-  pthread_detach(thread);
+  pool_submit(TASK_LOAD_NEXT_FRAME, src);
 }
 
 void imv_source_free(struct imv_source *src)
@@ -80,9 +152,21 @@ void imv_source_free(struct imv_source *src)
   free(src);
 }
 
+static void emit_partial(void *context, struct imv_image *image)
+{
+  struct imv_source *src = context;
+  struct imv_source_message msg = {
+    .source = src,
+    .user_data = src->callback_data,
+    .image = image,
+    .partial = true,
+  };
+  src->callback(&msg);
+}
+
 void imv_source_load_first_frame(struct imv_source *src)
 {
-  if (!src->vtable->load_first_frame) {
+  if (!src->vtable->load_first_frame && !src->vtable->load_first_frame_streaming) {
     return;
   }
 
@@ -95,7 +179,14 @@ void imv_source_load_first_frame(struct imv_source *src)
     .user_data = src->callback_data
   };
 
-  src->vtable->load_first_frame(src->private, &msg.image, &msg.frametime);
+  imv_trace_begin("decode_first_frame");
+  if (src->vtable->load_first_frame_streaming) {
+    src->vtable->load_first_frame_streaming(src->private, &msg.image,
+        &msg.frametime, &emit_partial, src);
+  } else {
+    src->vtable->load_first_frame(src->private, &msg.image, &msg.frametime);
+  }
+  imv_trace_end("decode_first_frame");
 
   pthread_mutex_unlock(&src->busy);
 
@@ -117,13 +208,24 @@ void imv_source_load_next_frame(struct imv_source *src)
     .user_data = src->callback_data
   };
 
+  imv_trace_begin("decode_next_frame");
   src->vtable->load_next_frame(src->private, &msg.image, &msg.frametime);
+  imv_trace_end("decode_next_frame");
 
   pthread_mutex_unlock(&src->busy);
 
   src->callback(&msg);
 }
 
+bool imv_source_set_preferred_size(struct imv_source *src, int width, int height)
+{
+  if (!src->vtable->set_preferred_size) {
+    return false;
+  }
+  src->vtable->set_preferred_size(src->private, width, height);
+  return true;
+}
+
 void imv_source_set_callback(struct imv_source *src, imv_source_callback callback,
     void *data)
 {
@@ -1,6 +1,8 @@
 #ifndef IMV_SOURCE_H
 #define IMV_SOURCE_H
 
+#include <stdbool.h>
+
 /* While imv_image represents a single frame of an image, be it a bitmap or
  * vector image, imv_source represents an open handle to an image file, which
  * can emit one or more imv_images.
@@ -25,6 +27,12 @@ void imv_source_load_first_frame(struct imv_source *src);
 void imv_source_async_load_next_frame(struct imv_source *src);
 void imv_source_load_next_frame(struct imv_source *src);
 
+/* Hint at the size the image will be displayed at. Sources able to decode
+ * at a reduced resolution may use it to decode only as many pixels as will
+ * be shown. A size of 0x0 clears the hint, requesting full resolution.
+ * Returns true if the source supports the hint, else false. */
+bool imv_source_set_preferred_size(struct imv_source *src, int width, int height);
+
 typedef void (*imv_source_callback)(struct imv_source_message *message);
 
 /* Sets the callback function to be called when frame loading completes */
@@ -42,6 +50,10 @@ struct imv_source_message {
 
   /* If an animated gif, the frame's duration in milliseconds, else 0 */
   int frametime;
+
+  /* True if image is a partially-decoded preview emitted while loading is
+   * still in progress; more complete versions of it will follow */
+  bool partial;
 };
 
 #endif
@@ -10,6 +10,12 @@ struct imv_source;
  * private data, pre-initialised.
  */
 
+/* Handed to streaming-capable sources so they can push partially-decoded
+ * images while a load is still in progress. Each emitted image is owned by
+ * the receiver. context is the opaque pointer given alongside the emitter.
+ */
+typedef void (*imv_source_partial_emitter)(void *context, struct imv_image *image);
+
 struct imv_source_vtable {
 
   /* Loads the first frame, if successful puts output in image and duration
@@ -18,11 +24,25 @@ struct imv_source_vtable {
    */
   void (*load_first_frame)(void *private, struct imv_image **image, int *frametime);
 
+  /* Optional. Preferred over load_first_frame when set. Behaves the same,
+   * but may additionally emit partially-decoded images through
+   * emit(context, image) as bands of rows become available, letting the
+   * display fill in while the rest of the file decodes.
+   */
+  void (*load_first_frame_streaming)(void *private, struct imv_image **image,
+      int *frametime, imv_source_partial_emitter emit, void *context);
+
   /* Loads the next frame, if successful puts output in image and duration
    * (in milliseconds) in frametime. If unsuccessful, image shall be NULL.
    */
   void (*load_next_frame)(void *private, struct imv_image **image, int *frametime);
 
+  /* Optional. Hints at the size the image will be displayed at, allowing
+   * the source to decode at a reduced resolution. A size of 0x0 clears the
+   * hint, requesting full-resolution decodes again.
+   */
+  void (*set_preferred_size)(void *private, int width, int height);
+
   /* Cleans up the private data of a source */
   void (*free)(void *private);
 };
@@ -0,0 +1,465 @@
+#include "thumbs.h"
+
+#ifdef IMV_BACKEND_LIBPNG
+
+#include "bitmap.h"
+#include "log.h"
+
+#include <limits.h>
+#include <png.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Thumbnails are written at the spec's "large" size */
+#define THUMB_SIZE 256
+
+struct thumb_job {
+  char *path;
+  struct imv_bitmap *bitmap;
+  struct thumb_job *next;
+};
+
+struct imv_thumbs {
+  char *cache_dir; /* $XDG_CACHE_HOME/thumbnails/large */
+
+  pthread_t worker;
+  bool worker_spawned;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct thumb_job *queue;
+  bool quit;
+};
+
+/* MD5, as required by the thumbnail spec for naming cache entries.
+ * Reference implementation style, RFC 1321. */
+
+struct md5_ctx {
+  uint32_t state[4];
+  uint64_t len;
+  unsigned char buf[64];
+};
+
+static uint32_t md5_rotl(uint32_t x, int c)
+{
+  return (x << c) | (x >> (32 - c));
+}
+
+static void md5_block(struct md5_ctx *ctx, const unsigned char *p)
+{
+  static const uint32_t k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+  };
+  static const int s[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+  };
+
+  uint32_t m[16];
+  for (int i = 0; i < 16; ++i) {
+    m[i] = (uint32_t)p[i*4] | ((uint32_t)p[i*4+1] << 8)
+         | ((uint32_t)p[i*4+2] << 16) | ((uint32_t)p[i*4+3] << 24);
+  }
+
+  uint32_t a = ctx->state[0];
+  uint32_t b = ctx->state[1];
+  uint32_t c = ctx->state[2];
+  uint32_t d = ctx->state[3];
+
+  for (int i = 0; i < 64; ++i) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t tmp = d;
+    d = c;
+    c = b;
+    b = b + md5_rotl(a + f + k[i] + m[g], s[i]);
+    a = tmp;
+  }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+}
+
+static void md5_hex(const char *input, char out[33])
+{
+  struct md5_ctx ctx = {
+    .state = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 }
+  };
+  size_t len = strlen(input);
+
+  const unsigned char *p = (const unsigned char *)input;
+  size_t remaining = len;
+  while (remaining >= 64) {
+    md5_block(&ctx, p);
+    p += 64;
+    remaining -= 64;
+  }
+
+  /* final block(s) with padding and bit length */
+  memcpy(ctx.buf, p, remaining);
+  ctx.buf[remaining] = 0x80;
+  memset(ctx.buf + remaining + 1, 0, 64 - remaining - 1);
+  if (remaining + 1 > 56) {
+    md5_block(&ctx, ctx.buf);
+    memset(ctx.buf, 0, 64);
+  }
+  uint64_t bits = (uint64_t)len * 8;
+  for (int i = 0; i < 8; ++i) {
+    ctx.buf[56 + i] = (bits >> (8 * i)) & 0xff;
+  }
+  md5_block(&ctx, ctx.buf);
+
+  for (int i = 0; i < 4; ++i) {
+    sprintf(out + i * 8, "%02x%02x%02x%02x",
+        ctx.state[i] & 0xff, (ctx.state[i] >> 8) & 0xff,
+        (ctx.state[i] >> 16) & 0xff, (ctx.state[i] >> 24) & 0xff);
+  }
+}
+
+/* Return the malloc'd spec path for path's thumbnail, along with its
+ * file:// uri if uri_out is given, or NULL if path can't be resolved */
+static char *thumb_path(struct imv_thumbs *thumbs, const char *path,
+    char **uri_out)
+{
+  char real[PATH_MAX];
+  if (!realpath(path, real)) {
+    return NULL;
+  }
+
+  char uri[PATH_MAX + 8];
+  snprintf(uri, sizeof uri, "file://%s", real);
+
+  char hex[33];
+  md5_hex(uri, hex);
+
+  size_t len = strlen(thumbs->cache_dir) + 40;
+  char *out = malloc(len);
+  snprintf(out, len, "%s/%s.png", thumbs->cache_dir, hex);
+
+  if (uri_out) {
+    *uri_out = strdup(uri);
+  }
+  return out;
+}
+
+static void mkdir_recursively(const char *path)
+{
+  char buf[PATH_MAX];
+  snprintf(buf, sizeof buf, "%s", path);
+  for (char *p = buf + 1; *p; ++p) {
+    if (*p == '/') {
+      *p = 0;
+      mkdir(buf, 0700);
+      *p = '/';
+    }
+  }
+  mkdir(buf, 0700);
+}
+
+static void write_thumbnail(struct imv_thumbs *thumbs,
+    struct thumb_job *job)
+{
+  struct stat file_info;
+  if (stat(job->path, &file_info) == -1) {
+    return;
+  }
+
+  char *uri = NULL;
+  char *dest = thumb_path(thumbs, job->path, &uri);
+  if (!dest) {
+    return;
+  }
+
+  /* scale so the largest dimension is at most THUMB_SIZE */
+  struct imv_bitmap *bmp = job->bitmap;
+  int div = 1;
+  while (bmp->width / div > THUMB_SIZE || bmp->height / div > THUMB_SIZE) {
+    ++div;
+  }
+  const int width = bmp->width / div;
+  const int height = bmp->height / div;
+
+  /* sample down to packed rows */
+  unsigned char *rows = malloc(4 * width * height);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      memcpy(rows + 4 * (y * width + x),
+          bmp->data + 4 * (y * div * bmp->width + x * div), 4);
+    }
+  }
+  if (bmp->format == IMV_ARGB) {
+    /* IMV_ARGB is stored b,g,r,a in memory; png expects r,g,b,a */
+    imv_bitmap_swap_rb(rows, rows, (size_t)width * height);
+  }
+
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof tmp, "%s.%d.tmp", dest, (int)getpid());
+
+  FILE *file = fopen(tmp, "wb");
+  if (!file) {
+    free(rows);
+    free(dest);
+    free(uri);
+    return;
+  }
+
+  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+      NULL, NULL, NULL);
+  png_infop info = png_create_info_struct(png);
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+    unlink(tmp);
+    free(rows);
+    free(dest);
+    free(uri);
+    return;
+  }
+
+  png_init_io(png, file);
+  png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA,
+      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+      PNG_FILTER_TYPE_DEFAULT);
+
+  char mtime_str[32];
+  snprintf(mtime_str, sizeof mtime_str, "%lld",
+      (long long)file_info.st_mtime);
+  png_text text[2] = {
+    {
+      .compression = PNG_TEXT_COMPRESSION_NONE,
+      .key = "Thumb::URI",
+      .text = uri
+    },
+    {
+      .compression = PNG_TEXT_COMPRESSION_NONE,
+      .key = "Thumb::MTime",
+      .text = mtime_str
+    }
+  };
+  png_set_text(png, info, text, 2);
+  png_write_info(png, info);
+
+  for (int y = 0; y < height; ++y) {
+    png_write_row(png, rows + 4 * y * width);
+  }
+  png_write_end(png, NULL);
+  png_destroy_write_struct(&png, &info);
+  fclose(file);
+
+  chmod(tmp, 0600);
+  rename(tmp, dest);
+  imv_log(IMV_DEBUG, "thumbs: wrote %s\n", dest);
+
+  free(rows);
+  free(dest);
+  free(uri);
+}
+
+static void *worker_thread(void *raw)
+{
+  struct imv_thumbs *thumbs = raw;
+
+#ifdef SCHED_IDLE
+  /* thumbnail writing only runs when nothing else wants the cpu */
+  struct sched_param param = { .sched_priority = 0 };
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+  pthread_mutex_lock(&thumbs->mutex);
+  while (!thumbs->quit) {
+    struct thumb_job *job = thumbs->queue;
+    if (!job) {
+      pthread_cond_wait(&thumbs->cond, &thumbs->mutex);
+      continue;
+    }
+    thumbs->queue = job->next;
+    pthread_mutex_unlock(&thumbs->mutex);
+
+    write_thumbnail(thumbs, job);
+    imv_bitmap_unref(job->bitmap);
+    free(job->path);
+    free(job);
+
+    pthread_mutex_lock(&thumbs->mutex);
+  }
+  pthread_mutex_unlock(&thumbs->mutex);
+  return NULL;
+}
+
+struct imv_thumbs *imv_thumbs_create(void)
+{
+  char dir[PATH_MAX];
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home && cache_home[0]) {
+    snprintf(dir, sizeof dir, "%s/thumbnails/large", cache_home);
+  } else {
+    const char *home = getenv("HOME");
+    if (!home) {
+      return NULL;
+    }
+    snprintf(dir, sizeof dir, "%s/.cache/thumbnails/large", home);
+  }
+  mkdir_recursively(dir);
+
+  struct imv_thumbs *thumbs = calloc(1, sizeof *thumbs);
+  thumbs->cache_dir = strdup(dir);
+  pthread_mutex_init(&thumbs->mutex, NULL);
+  pthread_cond_init(&thumbs->cond, NULL);
+  return thumbs;
+}
+
+void imv_thumbs_free(struct imv_thumbs *thumbs)
+{
+  if (!thumbs) {
+    return;
+  }
+
+  pthread_mutex_lock(&thumbs->mutex);
+  thumbs->quit = true;
+  pthread_cond_broadcast(&thumbs->cond);
+  pthread_mutex_unlock(&thumbs->mutex);
+  if (thumbs->worker_spawned) {
+    pthread_join(thumbs->worker, NULL);
+  }
+
+  while (thumbs->queue) {
+    struct thumb_job *job = thumbs->queue;
+    thumbs->queue = job->next;
+    imv_bitmap_unref(job->bitmap);
+    free(job->path);
+    free(job);
+  }
+
+  pthread_mutex_destroy(&thumbs->mutex);
+  pthread_cond_destroy(&thumbs->cond);
+  free(thumbs->cache_dir);
+  free(thumbs);
+}
+
+char *imv_thumbs_find(struct imv_thumbs *thumbs, const char *path)
+{
+  if (!thumbs) {
+    return NULL;
+  }
+
+  char *candidate = thumb_path(thumbs, path, NULL);
+  if (!candidate) {
+    return NULL;
+  }
+
+  struct stat thumb_info;
+  struct stat file_info;
+  if (stat(candidate, &thumb_info) == -1 || stat(path, &file_info) == -1) {
+    free(candidate);
+    return NULL;
+  }
+
+  /* A thumbnail older than its source is stale */
+  if (thumb_info.st_mtime < file_info.st_mtime) {
+    free(candidate);
+    return NULL;
+  }
+
+  return candidate;
+}
+
+void imv_thumbs_store_async(struct imv_thumbs *thumbs, const char *path,
+    struct imv_bitmap *bmp)
+{
+  if (!thumbs) {
+    return;
+  }
+
+  /* Never thumbnail the cache itself */
+  if (strstr(path, "/thumbnails/")) {
+    return;
+  }
+
+  struct thumb_job *job = calloc(1, sizeof *job);
+  job->path = strdup(path);
+  job->bitmap = imv_bitmap_ref(bmp);
+
+  pthread_mutex_lock(&thumbs->mutex);
+  job->next = thumbs->queue;
+  thumbs->queue = job;
+  if (!thumbs->worker_spawned) {
+    thumbs->worker_spawned =
+      !pthread_create(&thumbs->worker, NULL, worker_thread, thumbs);
+  }
+  pthread_cond_signal(&thumbs->cond);
+  pthread_mutex_unlock(&thumbs->mutex);
+}
+
+#else
+
+/* Without the libpng backend there is nothing to write thumbnails with */
+
+#include <stdlib.h>
+
+struct imv_thumbs *imv_thumbs_create(void)
+{
+  return NULL;
+}
+
+void imv_thumbs_free(struct imv_thumbs *thumbs)
+{
+  (void)thumbs;
+}
+
+char *imv_thumbs_find(struct imv_thumbs *thumbs, const char *path)
+{
+  (void)thumbs;
+  (void)path;
+  return NULL;
+}
+
+void imv_thumbs_store_async(struct imv_thumbs *thumbs, const char *path,
+    struct imv_bitmap *bmp)
+{
+  (void)thumbs;
+  (void)path;
+  (void)bmp;
+}
+
+#endif
+
+/* vim:set ts=2 sts=2 sw=2 et: */
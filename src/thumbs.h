@@ -0,0 +1,32 @@
+#ifndef IMV_THUMBS_H
+#define IMV_THUMBS_H
+
+struct imv_bitmap;
+
+/* imv_thumbs maintains a freedesktop.org thumbnail cache
+ * ($XDG_CACHE_HOME/thumbnails) shared with other applications. Cached
+ * thumbnails are served while full decodes proceed, and new thumbnails are
+ * written by a low-priority worker thread that never blocks viewing.
+ */
+struct imv_thumbs;
+
+/* Creates an imv_thumbs instance. Returns NULL when thumbnail support is
+ * compiled out (it needs the libpng backend); callers must tolerate that. */
+struct imv_thumbs *imv_thumbs_create(void);
+
+/* Cleans up an imv_thumbs instance */
+void imv_thumbs_free(struct imv_thumbs *thumbs);
+
+/* Returns the path of a cached thumbnail for path, or NULL if none is
+ * valid. The caller owns the returned string. */
+char *imv_thumbs_find(struct imv_thumbs *thumbs, const char *path);
+
+/* Queue writing a thumbnail of bmp for path on the worker thread. A
+ * reference to bmp is taken; the caller keeps its own. */
+void imv_thumbs_store_async(struct imv_thumbs *thumbs, const char *path,
+    struct imv_bitmap *bmp);
+
+#endif
+
+
+/* vim:set ts=2 sts=2 sw=2 et: */
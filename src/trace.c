@@ -0,0 +1,122 @@
+#include "trace.h"
+
+#include "log.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Events are claimed with a wait-free fetch-add, so recording a span from a
+ * loader thread costs a clock read and two stores. Once the buffer fills,
+ * further events fall off the end and are counted. */
+#define TRACE_MAX_EVENTS (1 << 18)
+
+struct trace_event {
+  const char *name;
+  uint64_t ts_ns;
+  int tid;
+  char phase; /* 'B' or 'E', as chrome://tracing spells them */
+};
+
+int imv_trace_active;
+static struct trace_event *g_events;
+static unsigned g_num_events;
+static char g_path[1024];
+
+/* small dense thread ids for the trace, assigned on each thread's first
+ * recorded event */
+static int g_next_tid = 1;
+static __thread int t_tid;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record(const char *name, char phase)
+{
+  const unsigned index = __atomic_fetch_add(&g_num_events, 1, __ATOMIC_RELAXED);
+  if (index >= TRACE_MAX_EVENTS) {
+    return;
+  }
+  if (!t_tid) {
+    t_tid = __atomic_fetch_add(&g_next_tid, 1, __ATOMIC_RELAXED);
+  }
+  struct trace_event *event = &g_events[index];
+  event->name = name;
+  event->ts_ns = now_ns();
+  event->tid = t_tid;
+  event->phase = phase;
+}
+
+void imv_trace_begin_impl(const char *name)
+{
+  record(name, 'B');
+}
+
+void imv_trace_end_impl(const char *name)
+{
+  record(name, 'E');
+}
+
+void imv_trace_init(void)
+{
+  const char *path = getenv("IMV_TRACE");
+  if (!path || !path[0]) {
+    return;
+  }
+  snprintf(g_path, sizeof g_path, "%s", path);
+  g_events = malloc(TRACE_MAX_EVENTS * sizeof *g_events);
+  if (!g_events) {
+    return;
+  }
+  imv_trace_active = 1;
+  imv_log(IMV_INFO, "trace: recording to %s\n", g_path);
+}
+
+void imv_trace_finish(void)
+{
+  if (!imv_trace_active) {
+    return;
+  }
+  imv_trace_active = 0;
+
+  /* a loader thread can still be finishing a record() here; events claimed
+   * before the snapshot below are complete by the time their slot is read,
+   * anything after it is simply left out */
+  unsigned count = __atomic_load_n(&g_num_events, __ATOMIC_ACQUIRE);
+  unsigned lost = 0;
+  if (count > TRACE_MAX_EVENTS) {
+    lost = count - TRACE_MAX_EVENTS;
+    count = TRACE_MAX_EVENTS;
+  }
+
+  FILE *f = fopen(g_path, "w");
+  if (!f) {
+    imv_log(IMV_ERROR, "trace: unable to write %s\n", g_path);
+    return;
+  }
+
+  /* timestamps are emitted relative to the first event, in microseconds */
+  const uint64_t epoch = count ? g_events[0].ts_ns : 0;
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (unsigned i = 0; i < count; ++i) {
+    const struct trace_event *event = &g_events[i];
+    fprintf(f, "{\"name\":\"%s\",\"cat\":\"imv\",\"ph\":\"%c\","
+        "\"pid\":0,\"tid\":%d,\"ts\":%.3f}%s\n",
+        event->name, event->phase, event->tid,
+        (event->ts_ns - epoch) / 1000.0,
+        i + 1 < count ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+
+  if (lost) {
+    imv_log(IMV_WARNING, "trace: buffer filled, %u events lost\n", lost);
+  }
+  imv_log(IMV_INFO, "trace: wrote %u events to %s\n", count, g_path);
+}
@@ -0,0 +1,29 @@
+#ifndef IMV_TRACE_H
+#define IMV_TRACE_H
+
+/* Lightweight trace spans for offline latency analysis. Tracing is enabled
+ * by setting $IMV_TRACE to a file path: begin/end pairs are recorded with
+ * monotonic timestamps as they happen, and written out as chrome://tracing
+ * JSON (load it in about:tracing or ui.perfetto.dev) when the trace
+ * finishes. With tracing disabled a span costs a single branch.
+ */
+
+/* Read $IMV_TRACE and start recording if it's set */
+void imv_trace_init(void);
+
+/* Write the recorded spans out and stop recording */
+void imv_trace_finish(void);
+
+void imv_trace_begin_impl(const char *name);
+void imv_trace_end_impl(const char *name);
+
+extern int imv_trace_active;
+
+/* Mark the start/end of a span. Calls must nest properly within a thread,
+ * and name must outlive the trace (pass a string literal) */
+#define imv_trace_begin(name) \
+  do { if (imv_trace_active) imv_trace_begin_impl(name); } while (0)
+#define imv_trace_end(name) \
+  do { if (imv_trace_active) imv_trace_end_impl(name); } while (0)
+
+#endif
@@ -240,6 +240,18 @@ void imv_viewport_crop_to_window(struct imv_viewport *view, const struct imv_ima
   view->locked = 0;
 }
 
+void imv_viewport_keep_onscreen_size(struct imv_viewport *view,
+                                     const struct imv_image *old_image,
+                                     const struct imv_image *new_image)
+{
+  const int old_width = imv_image_width(old_image);
+  const int new_width = imv_image_width(new_image);
+  if (old_width > 0 && new_width > 0 && old_width != new_width) {
+    view->scale *= (double)old_width / (double)new_width;
+    view->redraw = 1;
+  }
+}
+
 void imv_viewport_set_redraw(struct imv_viewport *view)
 {
   view->redraw = 1;
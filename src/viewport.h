@@ -75,6 +75,12 @@ void imv_viewport_crop_to_window(struct imv_viewport *view,
 void imv_viewport_rescale(struct imv_viewport *view, const struct imv_image *image,
                           enum scaling_mode);
 
+/* Adjust the scale so the image occupies the same space on screen when its
+ * backing resolution changes, e.g. after a re-decode at a different size */
+void imv_viewport_keep_onscreen_size(struct imv_viewport *view,
+                                     const struct imv_image *old_image,
+                                     const struct imv_image *new_image);
+
 /* Tell the viewport that it needs to be redrawn */
 void imv_viewport_set_redraw(struct imv_viewport *view);
 
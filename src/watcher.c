@@ -0,0 +1,114 @@
+#include "watcher.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+struct imv_watcher {
+  int fd; /* -1 when watching is unsupported */
+  int wd; /* current watch descriptor, -1 when nothing is watched */
+  char *basename; /* name of the watched file within its directory */
+};
+
+struct imv_watcher *imv_watcher_create(void)
+{
+  struct imv_watcher *watcher = calloc(1, sizeof *watcher);
+  watcher->fd = -1;
+  watcher->wd = -1;
+#ifdef __linux__
+  watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+  return watcher;
+}
+
+void imv_watcher_free(struct imv_watcher *watcher)
+{
+  if (!watcher) {
+    return;
+  }
+#ifdef __linux__
+  if (watcher->fd >= 0) {
+    close(watcher->fd);
+  }
+#endif
+  free(watcher->basename);
+  free(watcher);
+}
+
+int imv_watcher_get_fd(const struct imv_watcher *watcher)
+{
+  return watcher->fd;
+}
+
+bool imv_watcher_watch(struct imv_watcher *watcher, const char *path)
+{
+#ifdef __linux__
+  if (watcher->fd < 0) {
+    return false;
+  }
+
+  if (watcher->wd >= 0) {
+    inotify_rm_watch(watcher->fd, watcher->wd);
+    watcher->wd = -1;
+  }
+  free(watcher->basename);
+  watcher->basename = NULL;
+
+  /* Watch the containing directory rather than the file itself: editors and
+   * render pipelines typically write a temporary file and rename it into
+   * place, which would orphan a watch on the old inode. */
+  char *dir = strdup(path);
+  const char *slash = strrchr(path, '/');
+  if (slash) {
+    dir[slash - path] = 0;
+    watcher->basename = strdup(slash + 1);
+  } else {
+    strcpy(dir, ".");
+    watcher->basename = strdup(path);
+  }
+
+  watcher->wd = inotify_add_watch(watcher->fd, dir,
+      IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  free(dir);
+
+  return watcher->wd >= 0;
+#else
+  (void)watcher;
+  (void)path;
+  return false;
+#endif
+}
+
+bool imv_watcher_poll(struct imv_watcher *watcher)
+{
+#ifdef __linux__
+  if (watcher->fd < 0) {
+    return false;
+  }
+
+  bool changed = false;
+  char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(watcher->fd, buf, sizeof buf)) > 0) {
+    for (char *ptr = buf; ptr < buf + len; ) {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+      if (event->len && watcher->basename
+          && !strcmp(event->name, watcher->basename)) {
+        changed = true;
+      }
+      ptr += sizeof *event + event->len;
+    }
+  }
+  return changed;
+#else
+  (void)watcher;
+  return false;
+#endif
+}
+
+/* vim:set ts=2 sts=2 sw=2 et: */
@@ -0,0 +1,34 @@
+#ifndef IMV_WATCHER_H
+#define IMV_WATCHER_H
+
+#include <stdbool.h>
+
+/* imv_watcher watches the currently displayed file for modification using
+ * the operating system's file watching facilities, so changes are picked up
+ * instantly without polling. On platforms without such a facility it does
+ * nothing, and callers should fall back to mtime polling.
+ */
+struct imv_watcher;
+
+/* Create a watcher instance */
+struct imv_watcher *imv_watcher_create(void);
+
+/* Clean up a watcher instance */
+void imv_watcher_free(struct imv_watcher *watcher);
+
+/* Get the fd to merge into the event loop's poll set. It becomes readable
+ * when watched files change. Returns -1 if watching is unsupported. */
+int imv_watcher_get_fd(const struct imv_watcher *watcher);
+
+/* Watch the given file, replacing any previous watch. The file's containing
+ * directory is watched so that the file is tracked across atomic
+ * rename-into-place rewrites. Returns false if unsupported or on error. */
+bool imv_watcher_watch(struct imv_watcher *watcher, const char *path);
+
+/* Drain any pending events, returning true if the watched file changed */
+bool imv_watcher_poll(struct imv_watcher *watcher);
+
+#endif
+
+
+/* vim:set ts=2 sts=2 sw=2 et: */
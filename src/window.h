@@ -13,6 +13,7 @@ enum imv_event_type {
   IMV_EVENT_MOUSE_MOTION,
   IMV_EVENT_MOUSE_BUTTON,
   IMV_EVENT_MOUSE_SCROLL,
+  IMV_EVENT_VISIBILITY,
   IMV_EVENT_CUSTOM
 };
 
@@ -41,6 +42,11 @@ struct imv_event {
     struct {
       double dx, dy;
     } mouse_scroll;
+    struct {
+      /* false while the window can't be seen at all - minimized, fully
+       * occluded, or on no output */
+      bool visible;
+    } visibility;
     void *custom;
   } data;
 };
@@ -76,12 +82,39 @@ bool imv_window_get_mouse_button(struct imv_window *window, int button);
 /* Gets the mouse's position */
 void imv_window_get_mouse_position(struct imv_window *window, double *x, double *y);
 
+/* Hint that only the given region, in buffer pixels, differs from the
+ * previously presented frame. Applies to the next imv_window_present only;
+ * without a hint the whole window is assumed to have changed. Backends
+ * without partial presentation support ignore the hint. */
+void imv_window_set_damage(struct imv_window *window, int x, int y,
+    int width, int height);
+
 /* Swap the framebuffers. Present anything rendered since the last call. */
 void imv_window_present(struct imv_window *window);
 
-/* Blocks until an event is received, or the timeout (in seconds) expires */
+/* Whether the display is ready for another frame. False between a present
+ * and the compositor asking for the next frame; redraws requested in the
+ * meantime should be held, collapsing into a single render once this turns
+ * true (which wakes imv_window_wait_for_event). Backends whose present
+ * blocks until the vertical blank instead always return true. */
+bool imv_window_frame_ready(struct imv_window *window);
+
+/* Import a linear ABGR8888 dmabuf as a GL texture backed by an EGLImage,
+ * with no CPU-side copy of the pixels. Returns the texture name, owned by
+ * the caller, or 0 where the window system or driver can't do the import
+ * (the caller should upload the pixels the ordinary way instead). */
+unsigned int imv_window_import_dmabuf(struct imv_window *window, int fd,
+    int width, int height, int stride);
+
+/* Blocks until an event is received, or the timeout (in seconds) expires.
+ * A negative timeout blocks indefinitely */
 void imv_window_wait_for_event(struct imv_window *window, double timeout);
 
+/* Merge an additional fd into the window's event polling. When the fd
+ * becomes readable, imv_window_wait_for_event returns. The caller keeps
+ * ownership of the fd and is responsible for draining it. */
+void imv_window_add_event_fd(struct imv_window *window, int fd);
+
 /* Push an event to the event queue. An internal copy of the event is made.
  * Wakes up imv_window_wait_for_event */
 void imv_window_push_event(struct imv_window *window, struct imv_event *e);
@@ -1,5 +1,6 @@
 #include "window.h"
 
+#include "event_ring.h"
 #include "keyboard.h"
 #include "list.h"
 
@@ -15,8 +16,12 @@
 #include <wayland-client.h>
 #include <wayland-egl.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/gl.h>
 #include "xdg-shell-client-protocol.h"
+#include "viewporter-client-protocol.h"
+
+#define MAX_EVENT_FDS 8
 
 struct imv_window {
   struct wl_display    *wl_display;
@@ -26,6 +31,8 @@ struct imv_window {
   struct xdg_wm_base   *wl_xdg;
   struct xdg_surface   *wl_xdg_surface;
   struct xdg_toplevel  *wl_xdg_toplevel;
+  struct wp_viewporter *wl_viewporter; /* NULL if the compositor lacks it */
+  struct wp_viewport   *wl_viewport;
   struct wl_seat       *wl_seat;
   struct wl_keyboard   *wl_keyboard;
   struct wl_pointer    *wl_pointer;
@@ -34,12 +41,41 @@ struct imv_window {
   EGLSurface           egl_surface;
   struct wl_egl_window *egl_window;
 
+  /* eglSwapBuffersWithDamage{KHR,EXT} if the EGL supports it, else NULL */
+  EGLBoolean (EGLAPIENTRY *egl_swap_with_damage)(
+      EGLDisplay display, EGLSurface surface, const EGLint *rects, EGLint num_rects);
+  /* dmabuf import entry points, resolved once when the driver has the
+   * extensions for it; all NULL otherwise */
+  void *(EGLAPIENTRY *egl_create_image)(
+      EGLDisplay display, EGLContext context, EGLenum target,
+      void *buffer, const EGLint *attribs);
+  EGLBoolean (EGLAPIENTRY *egl_destroy_image)(EGLDisplay display, void *image);
+  void (EGLAPIENTRY *gl_image_target_texture)(GLenum target, void *image);
+  /* damage hint for the next swap: x, y, width, height in buffer pixels
+   * with a bottom-left origin, as EGL expects */
+  EGLint damage[4];
+  bool damage_pending;
+
+  /* frame pacing: the callback requested with each present, and whether
+   * it has fired yet. While it hasn't, the compositor doesn't want
+   * another frame and presents are held back. */
+  struct wl_callback *frame_callback;
+  bool frame_done;
+  double present_time; /* when the held-back frame was presented */
+
   struct imv_keyboard *keyboard;
   struct list *wl_outputs;
 
   int display_fd;
+  /* events go through the ring; the pipe is just a doorbell to wake the
+   * main loop */
+  struct event_ring *events;
   int pipe_fds[2];
 
+  /* caller-owned fds merged into the poll set in wait_for_event */
+  int event_fds[MAX_EVENT_FDS];
+  int num_event_fds;
+
   timer_t timer_id;
   int repeat_scancode; /* scancode of key to repeat */
   int repeat_delay; /* time before repeat in ms */
@@ -49,6 +85,12 @@ struct imv_window {
   int height;
   bool fullscreen;
   int scale;
+  /* whether the surface is on any output; the compositor takes it off all
+   * of them when it can't be seen */
+  bool visible;
+  /* set while an interactive resize is being scaled by the compositor; the
+   * buffer still has its pre-resize size and no RESIZE event has been sent */
+  bool resize_deferred;
 
   struct {
     struct {
@@ -500,6 +542,9 @@ static void on_global(void *data, struct wl_registry *registry, uint32_t id,
     window->wl_xdg =
       wl_registry_bind(registry, id, &xdg_wm_base_interface, version);
     xdg_wm_base_add_listener(window->wl_xdg, &shell_listener_xdg, window);
+  } else if (!strcmp(interface, "wp_viewporter")) {
+    window->wl_viewporter =
+      wl_registry_bind(registry, id, &wp_viewporter_interface, 1);
   } else if (!strcmp(interface, "wl_seat")) {
     window->wl_seat = wl_registry_bind(registry, id, &wl_seat_interface, version);
     wl_seat_add_listener(window->wl_seat, &seat_listener, window);
@@ -559,6 +604,34 @@ static const struct wl_registry_listener registry_listener = {
     .global_remove = on_remove_global
 };
 
+/* Leaving the last output is the closest thing Wayland has to a visibility
+ * notification: the compositor takes the surface off every output when it's
+ * minimized or on an invisible workspace */
+static void update_visibility(struct imv_window *window)
+{
+  bool visible = false;
+  for (size_t i = 0; i < window->wl_outputs->len; ++i) {
+    struct output_data *data = window->wl_outputs->items[i];
+    if (data->contains_window) {
+      visible = true;
+      break;
+    }
+  }
+
+  if (visible != window->visible) {
+    window->visible = visible;
+    struct imv_event e = {
+      .type = IMV_EVENT_VISIBILITY,
+      .data = {
+        .visibility = {
+          .visible = visible
+        }
+      }
+    };
+    imv_window_push_event(window, &e);
+  }
+}
+
 static void surface_enter(void *data, struct wl_surface *wl_surface,
     struct wl_output *output)
 {
@@ -566,6 +639,7 @@ static void surface_enter(void *data, struct wl_surface *wl_surface,
   struct output_data *output_data = wl_output_get_user_data(output);
   output_data->contains_window = true;
   update_scale(data);
+  update_visibility(data);
 }
 
 static void surface_leave(void *data, struct wl_surface *wl_surface,
@@ -575,6 +649,7 @@ static void surface_leave(void *data, struct wl_surface *wl_surface,
   struct output_data *output_data = wl_output_get_user_data(output);
   output_data->contains_window = false;
   update_scale(data);
+  update_visibility(data);
 }
 
 static const struct wl_surface_listener surface_listener = {
@@ -602,17 +677,38 @@ static void toplevel_configure(void *data, struct xdg_toplevel *toplevel,
   window->width = width;
   window->height = height;
   window->fullscreen = false;
+  bool resizing = false;
 
   enum xdg_toplevel_state *state;
   wl_array_for_each(state, states) {
     if (*state == XDG_TOPLEVEL_STATE_FULLSCREEN) {
       window->fullscreen = true;
     }
+    if (*state == XDG_TOPLEVEL_STATE_RESIZING) {
+      resizing = true;
+    }
   }
+
+  /* During an interactive resize the compositor scales the previously
+   * committed buffer to each intermediate size through the viewport, and
+   * re-rendering waits for the final size, so the drag tracks at compositor
+   * rate no matter how long a redraw takes */
+  if (resizing && window->wl_viewport && width > 0 && height > 0) {
+    wp_viewport_set_destination(window->wl_viewport, width, height);
+    wl_surface_commit(window->wl_surface);
+    window->resize_deferred = true;
+    return;
+  }
+
+  window->resize_deferred = false;
   size_t buffer_width = window->width * window->scale;
   size_t buffer_height = window->height * window->scale;
   wl_egl_window_resize(window->egl_window, buffer_width, buffer_height, 0, 0);
   glViewport(0, 0, buffer_width, buffer_height);
+  if (window->wl_viewport && width > 0 && height > 0) {
+    /* the buffer matches the window again; 1:1 destination */
+    wp_viewport_set_destination(window->wl_viewport, width, height);
+  }
 
   struct imv_event e = {
     .type = IMV_EVENT_RESIZE,
@@ -649,6 +745,7 @@ static void connect_to_wayland(struct imv_window *window)
   window->wl_display = wl_display_connect(NULL);
   assert(window->wl_display);
   window->display_fd = wl_display_get_fd(window->wl_display);
+  window->events = event_ring_create();
   pipe(window->pipe_fds);
   set_nonblocking(window->pipe_fds[0]);
   set_nonblocking(window->pipe_fds[1]);
@@ -686,6 +783,11 @@ static void create_window(struct imv_window *window, int width, int height,
   assert(window->wl_surface);
   wl_surface_add_listener(window->wl_surface, &surface_listener, window);
 
+  if (window->wl_viewporter) {
+    window->wl_viewport =
+      wp_viewporter_get_viewport(window->wl_viewporter, window->wl_surface);
+  }
+
   window->wl_xdg_surface = xdg_wm_base_get_xdg_surface(window->wl_xdg, window->wl_surface);
   assert(window->wl_xdg_surface);
 
@@ -702,14 +804,48 @@ static void create_window(struct imv_window *window, int width, int height,
   window->egl_surface = eglCreateWindowSurface(window->egl_display, config, window->egl_window, NULL);
   eglMakeCurrent(window->egl_display, window->egl_surface, window->egl_surface, window->egl_context);
 
+  const char *egl_extensions = eglQueryString(window->egl_display, EGL_EXTENSIONS);
+  if (egl_extensions && strstr(egl_extensions, "EGL_KHR_swap_buffers_with_damage")) {
+    window->egl_swap_with_damage = (EGLBoolean (EGLAPIENTRY *)(
+          EGLDisplay, EGLSurface, const EGLint *, EGLint))
+      eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+  } else if (egl_extensions && strstr(egl_extensions, "EGL_EXT_swap_buffers_with_damage")) {
+    window->egl_swap_with_damage = (EGLBoolean (EGLAPIENTRY *)(
+          EGLDisplay, EGLSurface, const EGLint *, EGLint))
+      eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+  }
+
+  if (egl_extensions && strstr(egl_extensions, "EGL_KHR_image_base")
+      && strstr(egl_extensions, "EGL_EXT_image_dma_buf_import")) {
+    const char *gl_extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (gl_extensions && strstr(gl_extensions, "GL_OES_EGL_image")) {
+      window->egl_create_image = (void *(EGLAPIENTRY *)(
+            EGLDisplay, EGLContext, EGLenum, void *, const EGLint *))
+        eglGetProcAddress("eglCreateImageKHR");
+      window->egl_destroy_image = (EGLBoolean (EGLAPIENTRY *)(
+            EGLDisplay, void *))
+        eglGetProcAddress("eglDestroyImageKHR");
+      window->gl_image_target_texture = (void (EGLAPIENTRY *)(GLenum, void *))
+        eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    }
+  }
+
   wl_surface_commit(window->wl_surface);
   wl_display_roundtrip(window->wl_display);
 }
 
 static void shutdown_wayland(struct imv_window *window)
 {
+  struct imv_event e;
+  while (event_ring_pop(window->events, &e)) {
+    cleanup_event(&e);
+  }
+  event_ring_free(window->events);
   close(window->pipe_fds[0]);
   close(window->pipe_fds[1]);
+  if (window->frame_callback) {
+    wl_callback_destroy(window->frame_callback);
+  }
   if (window->wl_pointer) {
     wl_pointer_destroy(window->wl_pointer);
   }
@@ -728,6 +864,12 @@ static void shutdown_wayland(struct imv_window *window)
   if (window->wl_xdg) {
     xdg_wm_base_destroy(window->wl_xdg);
   }
+  if (window->wl_viewport) {
+    wp_viewport_destroy(window->wl_viewport);
+  }
+  if (window->wl_viewporter) {
+    wp_viewporter_destroy(window->wl_viewporter);
+  }
   if (window->egl_window) {
     wl_egl_window_destroy(window->egl_window);
   }
@@ -754,11 +896,10 @@ static void on_timer(union sigval sigval)
 
 struct imv_window *imv_window_create(int width, int height, const char *title)
 {
-  /* Ensure event writes will always be atomic */
-  assert(sizeof(struct imv_event) <= PIPE_BUF);
-
   struct imv_window *window = calloc(1, sizeof *window);
   window->scale = 1;
+  window->visible = true;
+  window->frame_done = true;
 
   window->keyboard = imv_keyboard_create();
   assert(window->keyboard);
@@ -850,18 +991,141 @@ void imv_window_get_mouse_position(struct imv_window *window, double *x, double
   }
 }
 
+void imv_window_set_damage(struct imv_window *window, int x, int y,
+    int width, int height)
+{
+  /* EGL damage rectangles have a bottom-left origin */
+  const int buffer_height = window->height * window->scale;
+  window->damage[0] = x;
+  window->damage[1] = buffer_height - (y + height);
+  window->damage[2] = width;
+  window->damage[3] = height;
+  window->damage_pending = true;
+}
+
+static double cur_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+static void frame_callback_done(void *data, struct wl_callback *callback,
+    uint32_t time)
+{
+  (void)time;
+  struct imv_window *window = data;
+  wl_callback_destroy(callback);
+  window->frame_callback = NULL;
+  window->frame_done = true;
+  /* Ring the doorbell so a redraw held back since the last present gets
+   * rendered now rather than on the next unrelated wakeup */
+  const char wake = 0;
+  write(window->pipe_fds[1], &wake, 1);
+}
+
+static const struct wl_callback_listener frame_callback_listener = {
+  .done = frame_callback_done,
+};
+
 void imv_window_present(struct imv_window *window)
 {
-  eglSwapBuffers(window->egl_display, window->egl_surface);
+  /* ask to be told when the compositor wants the frame after this one;
+   * must precede the commit the buffer swap performs */
+  if (window->frame_callback) {
+    wl_callback_destroy(window->frame_callback);
+  }
+  window->frame_callback = wl_surface_frame(window->wl_surface);
+  wl_callback_add_listener(window->frame_callback, &frame_callback_listener,
+      window);
+  window->frame_done = false;
+  window->present_time = cur_time();
+
+  if (window->damage_pending && window->egl_swap_with_damage) {
+    window->egl_swap_with_damage(window->egl_display, window->egl_surface,
+        window->damage, 1);
+  } else {
+    eglSwapBuffers(window->egl_display, window->egl_surface);
+  }
+  window->damage_pending = false;
+}
+
+bool imv_window_frame_ready(struct imv_window *window)
+{
+  /* An occluded surface may not get its callback until it's visible
+   * again - exactly the throttling we want - but don't trust every
+   * compositor with an indefinite hold */
+  if (!window->frame_done
+      && cur_time() - window->present_time > 1.0) {
+    window->frame_done = true;
+  }
+  return window->frame_done;
+}
+
+/* DRM_FORMAT_ABGR8888 as drm_fourcc.h spells it ('AB24'); defined here to
+ * avoid pulling in libdrm headers for one constant */
+#define DMABUF_FOURCC_ABGR8888 0x34324241
+
+unsigned int imv_window_import_dmabuf(struct imv_window *window, int fd,
+    int width, int height, int stride)
+{
+  if (!window->egl_create_image || !window->egl_destroy_image
+      || !window->gl_image_target_texture) {
+    return 0;
+  }
+
+  const EGLint attribs[] = {
+    EGL_WIDTH, width,
+    EGL_HEIGHT, height,
+    EGL_LINUX_DRM_FOURCC_EXT, DMABUF_FOURCC_ABGR8888,
+    EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+    EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
+    EGL_NONE
+  };
+  void *image = window->egl_create_image(window->egl_display, EGL_NO_CONTEXT,
+      EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+  if (!image) {
+    return 0;
+  }
+
+  while (glGetError() != GL_NO_ERROR) {
+    /* clear any stale error so we can tell if the attach failed */
+  }
+
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  window->gl_image_target_texture(GL_TEXTURE_2D, image);
+  const GLenum attach_error = glGetError();
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  /* the texture keeps the buffer alive; the image handle isn't needed */
+  window->egl_destroy_image(window->egl_display, image);
+
+  if (attach_error != GL_NO_ERROR) {
+    glDeleteTextures(1, &texture);
+    return 0;
+  }
+  return texture;
 }
 
 void imv_window_wait_for_event(struct imv_window *window, double timeout)
 {
-  struct pollfd fds[] = {
+  struct pollfd fds[2 + MAX_EVENT_FDS] = {
     {.fd = window->display_fd,  .events = POLLIN},
     {.fd = window->pipe_fds[0], .events = POLLIN}
   };
-  nfds_t nfds = sizeof fds / sizeof *fds;
+  nfds_t nfds = 2;
+  for (int i = 0; i < window->num_event_fds; ++i) {
+    fds[nfds].fd = window->event_fds[i];
+    fds[nfds].events = POLLIN;
+    ++nfds;
+  }
 
   if (wl_display_prepare_read(window->wl_display)) {
     /* If an event's already in the wayland queue we return */
@@ -882,23 +1146,31 @@ void imv_window_wait_for_event(struct imv_window *window, double timeout)
   }
 }
 
+void imv_window_add_event_fd(struct imv_window *window, int fd)
+{
+  assert(window->num_event_fds < MAX_EVENT_FDS);
+  window->event_fds[window->num_event_fds++] = fd;
+}
+
 void imv_window_push_event(struct imv_window *window, struct imv_event *e)
 {
-  /* Push it down the pipe */
-  write(window->pipe_fds[1], e, sizeof *e);
+  if (event_ring_push(window->events, e)) {
+    /* Ring the doorbell to wake the main loop */
+    const char wake = 0;
+    write(window->pipe_fds[1], &wake, 1);
+  }
 }
 
 void imv_window_pump_events(struct imv_window *window, imv_event_handler handler, void *data)
 {
   wl_display_dispatch_pending(window->wl_display);
 
-  while (1) {
-    struct imv_event e;
-    ssize_t len = read(window->pipe_fds[0], &e, sizeof e);
-    if (len <= 0) {
-      break;
-    }
-    assert(len == sizeof e);
+  /* Drain the doorbell, then the ring it announces */
+  char wake[16];
+  while (read(window->pipe_fds[0], wake, sizeof wake) > 0);
+
+  struct imv_event e;
+  while (event_ring_pop(window->events, &e)) {
     if (handler) {
       handler(data, &e);
     }
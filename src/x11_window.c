@@ -16,9 +16,12 @@
 #include <xcb/xcb.h>
 #include <xkbcommon/xkbcommon-x11.h>
 
+#include "event_ring.h"
 #include "keyboard.h"
 #include "log.h"
 
+#define MAX_EVENT_FDS 8
+
 struct imv_window {
   Display    *x_display;
   Window     x_window;
@@ -36,9 +39,19 @@ struct imv_window {
     } current;
     bool mouse1;
   } pointer;
+  /* last visibility reported, so obscure/expose chatter doesn't repeat
+   * events */
+  bool visible;
 
   struct imv_keyboard *keyboard;
+  /* events go through the ring; the pipe is just a doorbell to wake the
+   * main loop */
+  struct event_ring *events;
   int pipe_fds[2];
+
+  /* caller-owned fds merged into the poll set in wait_for_event */
+  int event_fds[MAX_EVENT_FDS];
+  int num_event_fds;
 };
 
 static void set_nonblocking(int fd)
@@ -92,12 +105,11 @@ static void setup_keymap(struct imv_window *window)
 
 struct imv_window *imv_window_create(int w, int h, const char *title)
 {
-  /* Ensure event writes will always be atomic */
-  assert(sizeof(struct imv_event) <= PIPE_BUF);
-
   struct imv_window *window = calloc(1, sizeof *window);
   window->pointer.last.x = -1;
   window->pointer.last.y = -1;
+  window->visible = true;
+  window->events = event_ring_create();
   pipe(window->pipe_fds);
   set_nonblocking(window->pipe_fds[0]);
   set_nonblocking(window->pipe_fds[1]);
@@ -125,6 +137,7 @@ struct imv_window *imv_window_create(int w, int h, const char *title)
     .colormap = cmap,
     .event_mask = ExposureMask | KeyPressMask | KeyReleaseMask
                 | ButtonPressMask | ButtonReleaseMask | PointerMotionMask
+                | VisibilityChangeMask | StructureNotifyMask
   };
 
   window->x_window = XCreateWindow(window->x_display, root, 0, 0, w, h,
@@ -145,6 +158,22 @@ struct imv_window *imv_window_create(int w, int h, const char *title)
   assert(window->x_glc);
   glXMakeCurrent(window->x_display, window->x_window, window->x_glc);
 
+  /* Sync buffer swaps to the display's refresh: glXSwapBuffers then waits
+   * for the vertical blank, pacing redraws to one per display frame rather
+   * than presenting as fast as the loop can produce them */
+  void (*swap_interval_ext)(Display *, GLXDrawable, int) =
+    (void (*)(Display *, GLXDrawable, int))
+    glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalEXT");
+  if (swap_interval_ext) {
+    swap_interval_ext(window->x_display, window->x_window, 1);
+  } else {
+    int (*swap_interval_mesa)(unsigned int) = (int (*)(unsigned int))
+      glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalMESA");
+    if (swap_interval_mesa) {
+      swap_interval_mesa(1);
+    }
+  }
+
   window->keyboard = imv_keyboard_create();
   assert(window->keyboard);
 
@@ -156,6 +185,7 @@ struct imv_window *imv_window_create(int w, int h, const char *title)
 void imv_window_free(struct imv_window *window)
 {
   imv_keyboard_free(window->keyboard);
+  event_ring_free(window->events);
   close(window->pipe_fds[0]);
   close(window->pipe_fds[1]);
   glXDestroyContext(window->x_display, window->x_glc);
@@ -258,26 +288,71 @@ void imv_window_get_mouse_position(struct imv_window *window, double *x, double
   }
 }
 
+void imv_window_set_damage(struct imv_window *window, int x, int y,
+    int width, int height)
+{
+  /* glX has no partial swap, so the hint is ignored */
+  (void)window;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+}
+
 void imv_window_present(struct imv_window *window)
 {
   glXSwapBuffers(window->x_display, window->x_window);
 }
 
+bool imv_window_frame_ready(struct imv_window *window)
+{
+  /* the swap interval makes imv_window_present block until the vertical
+   * blank, so a new frame can always be started */
+  (void)window;
+  return true;
+}
+
+unsigned int imv_window_import_dmabuf(struct imv_window *window, int fd,
+    int width, int height, int stride)
+{
+  /* no EGL on the glX path, so no zero-copy import */
+  (void)window;
+  (void)fd;
+  (void)width;
+  (void)height;
+  (void)stride;
+  return 0;
+}
+
 void imv_window_wait_for_event(struct imv_window *window, double timeout)
 {
-  struct pollfd fds[] = {
+  struct pollfd fds[2 + MAX_EVENT_FDS] = {
     {.fd = ConnectionNumber(window->x_display), .events = POLLIN},
     {.fd = window->pipe_fds[0], .events = POLLIN}
   };
-  nfds_t nfds = sizeof fds / sizeof *fds;
+  nfds_t nfds = 2;
+  for (int i = 0; i < window->num_event_fds; ++i) {
+    fds[nfds].fd = window->event_fds[i];
+    fds[nfds].events = POLLIN;
+    ++nfds;
+  }
 
   poll(fds, nfds, timeout * 1000);
 }
 
+void imv_window_add_event_fd(struct imv_window *window, int fd)
+{
+  assert(window->num_event_fds < MAX_EVENT_FDS);
+  window->event_fds[window->num_event_fds++] = fd;
+}
+
 void imv_window_push_event(struct imv_window *window, struct imv_event *e)
 {
-  /* Push it down the pipe */
-  write(window->pipe_fds[1], e, sizeof *e);
+  if (event_ring_push(window->events, e)) {
+    /* Ring the doorbell to wake the main loop */
+    const char wake = 0;
+    write(window->pipe_fds[1], &wake, 1);
+  }
 }
 
 static void handle_keyboard(struct imv_window *window, imv_event_handler handler, void *data, const XEvent *xev)
@@ -407,17 +482,39 @@ void imv_window_pump_events(struct imv_window *window, imv_event_handler handler
       if (handler) {
         handler(data, &e);
       }
+    } else if (xev.type == VisibilityNotify || xev.type == UnmapNotify
+            || xev.type == MapNotify) {
+      /* fully obscured or unmapped both count as hidden; a partial
+       * obscure doesn't */
+      bool visible = true;
+      if (xev.type == UnmapNotify) {
+        visible = false;
+      } else if (xev.type == VisibilityNotify) {
+        visible = xev.xvisibility.state != VisibilityFullyObscured;
+      }
+      if (visible != window->visible) {
+        window->visible = visible;
+        struct imv_event e = {
+          .type = IMV_EVENT_VISIBILITY,
+          .data = {
+            .visibility = {
+              .visible = visible
+            }
+          }
+        };
+        if (handler) {
+          handler(data, &e);
+        }
+      }
     }
   }
 
-  /* Handle any events in the pipe */
-  while (1) {
-    struct imv_event e;
-    ssize_t len = read(window->pipe_fds[0], &e, sizeof e);
-    if (len <= 0) {
-      break;
-    }
-    assert(len == sizeof e);
+  /* Drain the doorbell, then handle any events in the ring */
+  char wake[16];
+  while (read(window->pipe_fds[0], wake, sizeof wake) > 0);
+
+  struct imv_event e;
+  while (event_ring_pop(window->events, &e)) {
     if (handler) {
       handler(data, &e);
     }
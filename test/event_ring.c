@@ -0,0 +1,158 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "event_ring.h"
+
+static void test_fifo(void **state)
+{
+  (void)state;
+
+  struct event_ring *ring = event_ring_create();
+  struct imv_event e;
+
+  assert_false(event_ring_pop(ring, &e));
+
+  for (int i = 0; i < 10; ++i) {
+    e = (struct imv_event) {
+      .type = IMV_EVENT_CUSTOM,
+      .data = { .custom = (void*)(intptr_t)(i + 1) }
+    };
+    event_ring_push(ring, &e);
+  }
+
+  for (int i = 0; i < 10; ++i) {
+    assert_true(event_ring_pop(ring, &e));
+    assert_true(e.type == IMV_EVENT_CUSTOM);
+    assert_true((intptr_t)e.data.custom == i + 1);
+  }
+  assert_false(event_ring_pop(ring, &e));
+
+  event_ring_free(ring);
+}
+
+static void test_doorbell(void **state)
+{
+  (void)state;
+
+  struct event_ring *ring = event_ring_create();
+  struct imv_event e = { .type = IMV_EVENT_CLOSE, .data = { .custom = NULL } };
+
+  /* only the first push of a batch asks for a wakeup */
+  assert_true(event_ring_push(ring, &e));
+  assert_false(event_ring_push(ring, &e));
+  assert_false(event_ring_push(ring, &e));
+
+  while (event_ring_pop(ring, &e));
+
+  /* once the consumer has found the ring empty, pushes ask again */
+  assert_true(event_ring_push(ring, &e));
+  assert_false(event_ring_push(ring, &e));
+
+  event_ring_free(ring);
+}
+
+static void test_scroll_coalescing(void **state)
+{
+  (void)state;
+
+  struct event_ring *ring = event_ring_create();
+  struct imv_event e;
+
+  /* Push far more scroll events than the ring holds. Whatever overflows
+   * must be merged, not dropped: the deltas popped back out have to add
+   * up, in fewer events than went in.
+   */
+  const int pushed = 10000;
+  for (int i = 0; i < pushed; ++i) {
+    e = (struct imv_event) {
+      .type = IMV_EVENT_MOUSE_SCROLL,
+      .data = { .mouse_scroll = { .dx = 0.0, .dy = 1.0 } }
+    };
+    event_ring_push(ring, &e);
+  }
+
+  double total = 0.0;
+  int popped = 0;
+  while (event_ring_pop(ring, &e)) {
+    assert_true(e.type == IMV_EVENT_MOUSE_SCROLL);
+    total += e.data.mouse_scroll.dy;
+    ++popped;
+  }
+  assert_true(popped < pushed);
+  assert_true(total > pushed - 0.5 && total < pushed + 0.5);
+
+  event_ring_free(ring);
+}
+
+#define NUM_PRODUCERS 4
+#define EVENTS_PER_PRODUCER 10000
+
+static void *producer(void *arg)
+{
+  struct event_ring *ring = arg;
+  for (intptr_t i = 0; i < EVENTS_PER_PRODUCER; ++i) {
+    struct imv_event e = {
+      .type = IMV_EVENT_CUSTOM,
+      .data = { .custom = (void*)(i + 1) }
+    };
+    event_ring_push(ring, &e);
+  }
+  return NULL;
+}
+
+static void test_threaded_producers(void **state)
+{
+  (void)state;
+
+  struct event_ring *ring = event_ring_create();
+  pthread_t threads[NUM_PRODUCERS];
+  for (int i = 0; i < NUM_PRODUCERS; ++i) {
+    pthread_create(&threads[i], NULL, &producer, ring);
+  }
+
+  /* Consume in parallel with the producers; every event they push must
+   * come back out exactly once
+   */
+  intptr_t count = 0;
+  intptr_t sum = 0;
+  while (count < NUM_PRODUCERS * EVENTS_PER_PRODUCER) {
+    struct imv_event e;
+    if (event_ring_pop(ring, &e)) {
+      assert_true(e.type == IMV_EVENT_CUSTOM);
+      sum += (intptr_t)e.data.custom;
+      ++count;
+    }
+  }
+
+  for (int i = 0; i < NUM_PRODUCERS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  const intptr_t per_producer =
+    (intptr_t)EVENTS_PER_PRODUCER * (EVENTS_PER_PRODUCER + 1) / 2;
+  assert_true(sum == NUM_PRODUCERS * per_producer);
+
+  struct imv_event e;
+  assert_false(event_ring_pop(ring, &e));
+
+  event_ring_free(ring);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fifo),
+    cmocka_unit_test(test_doorbell),
+    cmocka_unit_test(test_scroll_coalescing),
+    cmocka_unit_test(test_threaded_producers),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+
+/* vim:set ts=2 sts=2 sw=2 et: */
@@ -0,0 +1,81 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+
+static int g_received;
+static char g_last[64];
+
+static void capture(enum imv_log_level level, const char *text, void *data)
+{
+  (void)level;
+  (void)data;
+  /* callbacks run on the drain thread, serialised by the log itself */
+  ++g_received;
+  snprintf(g_last, sizeof g_last, "%s", text);
+}
+
+static void test_ordered_delivery(void **state)
+{
+  (void)state;
+
+  imv_log_add_log_callback(&capture, NULL);
+  g_received = 0;
+
+  for (int i = 0; i < 10; ++i) {
+    imv_log(IMV_INFO, "message %d", i);
+  }
+  imv_log_flush();
+
+  assert_int_equal(g_received, 10);
+  assert_string_equal(g_last, "message 9");
+
+  imv_log_remove_log_callback(&capture);
+}
+
+#define NUM_THREADS 4
+#define PER_THREAD 50 /* must total fewer than the ring's capacity */
+
+static void *log_thread(void *unused)
+{
+  (void)unused;
+  for (int i = 0; i < PER_THREAD; ++i) {
+    imv_log(IMV_INFO, "threaded %d", i);
+  }
+  return NULL;
+}
+
+static void test_threaded_producers(void **state)
+{
+  (void)state;
+
+  imv_log_add_log_callback(&capture, NULL);
+  g_received = 0;
+
+  pthread_t threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; ++i) {
+    pthread_create(&threads[i], NULL, &log_thread, NULL);
+  }
+  for (int i = 0; i < NUM_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  imv_log_flush();
+
+  assert_int_equal(g_received, NUM_THREADS * PER_THREAD);
+
+  imv_log_remove_log_callback(&capture);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_ordered_delivery),
+    cmocka_unit_test(test_threaded_producers),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <cmocka.h>
 #include <errno.h>
+#include <string.h>
 
 #include "navigator.h"
 
@@ -111,12 +112,68 @@ static void test_navigator_file_changed(void **state)
   imv_navigator_free(nav);
 }
 
+static void test_navigator_sort(void **state)
+{
+  (void)state;
+  static const char *names[] = { "sort.file.10", "sort.file.2", "sort.file.1" };
+  const size_t num_names = sizeof names / sizeof *names;
+  struct imv_navigator *nav = imv_navigator_create();
+
+  for (size_t i = 0; i < num_names; ++i) {
+    int fd = open(names[i], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+      imv_navigator_free(nav);
+      for (size_t j = 0; j < num_names; ++j) {
+        (void)unlink(names[j]);
+      }
+      skip();
+    }
+    /* sizes descending in add order, for the size mode below */
+    assert_false(ftruncate(fd, (off_t)(num_names - i)));
+    (void)close(fd);
+    assert_false(imv_navigator_add(nav, names[i], 0));
+  }
+
+  /* selection follows the file it was on, not its index */
+  imv_navigator_select_abs(nav, 1);
+  assert_true(strstr(imv_navigator_selection(nav), "sort.file.2") != NULL);
+
+  imv_navigator_sort(nav, NAV_SORT_NAME, 0);
+  assert_true(strstr(imv_navigator_at(nav, 0), "sort.file.1") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 1), "sort.file.10") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 2), "sort.file.2") != NULL);
+  assert_true(strstr(imv_navigator_selection(nav), "sort.file.2") != NULL);
+
+  /* natural ordering compares the digit runs numerically */
+  imv_navigator_sort(nav, NAV_SORT_NATURAL, 0);
+  assert_true(strstr(imv_navigator_at(nav, 0), "sort.file.1") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 1), "sort.file.2") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 2), "sort.file.10") != NULL);
+
+  imv_navigator_sort(nav, NAV_SORT_SIZE, 0);
+  assert_true(strstr(imv_navigator_at(nav, 0), "sort.file.1") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 1), "sort.file.2") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 2), "sort.file.10") != NULL);
+
+  /* and back to the order the files were added in */
+  imv_navigator_sort(nav, NAV_SORT_NONE, 0);
+  assert_true(strstr(imv_navigator_at(nav, 0), "sort.file.10") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 1), "sort.file.2") != NULL);
+  assert_true(strstr(imv_navigator_at(nav, 2), "sort.file.1") != NULL);
+
+  imv_navigator_free(nav);
+  for (size_t i = 0; i < num_names; ++i) {
+    (void)unlink(names[i]);
+  }
+}
+
 int main(void)
 {
   (void)test_navigator_add_remove; /* skipped for now */
   const struct CMUnitTest tests[] = {
     /* cmocka_unit_test(test_navigator_add_remove), */
     cmocka_unit_test(test_navigator_file_changed),
+    cmocka_unit_test(test_navigator_sort),
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);